@@ -22,9 +22,17 @@
 
 namespace detector {
 
-Base::Base(unsigned int yield_time)
+Base::Base(unsigned int yield_time, bool loop)
   : yield_time_(yield_time),
-    state_(Base::State::kStopped) {
+    loop_(loop),
+    priority_(0),
+    policy_(SCHED_RR),
+    cpus_(0),
+    state_(Base::State::kStopped),
+    warm_(false),
+    phase_("stopped"),
+    kind_(Base::Phase::kIdle),
+    beat_(0) {
 }
 
 Base::~Base() {
@@ -32,13 +40,72 @@ Base::~Base() {
 }
 
 Base::State Base::getState() {
-  std::unique_lock<std::mutex> lck(lock_);
   return state_;
 }
 
-void Base::setState(State s) {
-  std::unique_lock<std::mutex> lck(lock_);
-  state_ = s;
+// not in one of the single-shot states (call with lock_ held)
+bool Base::resting() {
+  State s = state_;
+  return s == Base::State::kStopped || s == Base::State::kPaused || 
+    s == Base::State::kRunning;
+}
+
+// done with 'from' unless a request came in meanwhile
+void Base::settle(State from, State to) {
+  {
+    std::unique_lock<std::mutex> lck(lock_);
+    if (state_ != from) {
+      return;
+    }
+    if (to != Base::State::kPaused) {
+      warm_ = false;
+    }
+    state_ = to;
+  }
+  cv_.notify_all();
+}
+
+static int64_t steadyNow() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Base::phase(const char* tag, Phase kind) {
+  if (kind != Base::Phase::kBusy && kind_ == kind && phase_ == tag) {
+    return;
+  }
+  phase_ = tag;
+  kind_ = kind;
+  beat_ = steadyNow();
+}
+
+bool Base::getPhase(const char*& phase, unsigned int& usec) {
+  if (state_ == Base::State::kStopped || kind_ == Base::Phase::kIdle) {
+    return false;
+  }
+  phase = phase_;
+  int64_t age = steadyNow() - beat_;
+  usec = age > 0 ? static_cast<unsigned int>(age) : 0;
+  return true;
+}
+
+bool Base::running() {
+  return true;
+}
+
+bool Base::paused() {
+  return true;
+}
+
+bool Base::waitingToPause() {
+  return true;
+}
+
+bool Base::waitingToResume() {
+  return true;
+}
+
+void Base::wake() {
 }
 
 unsigned int Base::getPriority() {
@@ -47,22 +114,57 @@ unsigned int Base::getPriority() {
 
 bool Base::setPriority(int priority) {
   sched_param sch_params;
-  sch_params.sched_priority = priority;
+  sch_params.sched_priority = (policy_ == SCHED_OTHER) ? 0 : priority;
   priority_ = priority;
-  if(pthread_setschedparam(thread_.native_handle(), SCHED_RR, &sch_params)) {
+  if (!thread_.joinable()) {
+    return true;
+  }
+  if(pthread_setschedparam(thread_.native_handle(), policy_, &sch_params)) {
     dbgMsg("failed to set thread scheduling\n");
     return false;
   }
   return true;
 }
 
+int Base::getPolicy() {
+  return policy_;
+}
+
+bool Base::setPolicy(int policy) {
+  policy_ = policy;
+  return setPriority(priority_);
+}
+
+unsigned int Base::getAffinity() {
+  return cpus_;
+}
+
+bool Base::setAffinity(unsigned int cpus) {
+  cpus_ = cpus;
+  if (cpus_ == 0 || !thread_.joinable()) {
+    return true;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (unsigned int i = 0; i < 32; i++) {
+    if (cpus_ & (1u << i)) {
+      CPU_SET(i, &set);
+    }
+  }
+  if (pthread_setaffinity_np(thread_.native_handle(), sizeof(set), &set)) {
+    dbgMsg("failed to set thread affinity\n");
+    return false;
+  }
+  return true;
+}
+
 std::string Base::getName() {
   return name_;
 }
 
 bool Base::setName(const char* name) {
   if (name) {
-    std::string str(name, max_name_len_);
+    std::string str = std::string(name).substr(0, max_name_len_);
     name_ = str;
     int err = pthread_setname_np(thread_.native_handle(), str.c_str());
     return err != 0;
@@ -70,32 +172,35 @@ bool Base::setName(const char* name) {
   return true;
 }
 
-void Base::wait(State s, int usec) {
-  while (getState() != s) {
-    std::this_thread::sleep_for(std::chrono::microseconds(usec));
-  }
+void Base::wait(State s) {
+  std::unique_lock<std::mutex> lck(lock_);
+  cv_.wait(lck, [&]() { return state_ == s; });
 }
 
 bool Base::start(const char* name, int priority) {
   {
     std::unique_lock<std::mutex> lck(lock_);
+    cv_.wait(lck, [this]() { return resting(); });
     if (state_ != Base::State::kStopped) {
       return false;
     }
     state_ = Base::State::kWaitingToPause;
+    warm_ = false;
   }
 
   thread_ = std::thread(Base::wrapper0, this);
   setPriority(priority);
+  setAffinity(cpus_);
   setName(name);
 
-  wait(Base::State::kPaused, 10);
+  wait(Base::State::kPaused);
   return true;
 }
 
 bool Base::run() {
   {
     std::unique_lock<std::mutex> lck(lock_);
+    cv_.wait(lck, [this]() { return resting(); });
     if (state_ == Base::State::kRunning) {
       return true;
     }
@@ -105,14 +210,17 @@ bool Base::run() {
     }
     state_ = Base::State::kWaitingToRun;
   }
+  cv_.notify_all();
+  wake();
 
-  wait(Base::State::kRunning, 10);
+  wait(Base::State::kRunning);
   return true;
 }
 
 bool Base::pause() {
   {
     std::unique_lock<std::mutex> lck(lock_);
+    cv_.wait(lck, [this]() { return resting(); });
     if (state_ == Base::State::kPaused) {
       return true;
     }
@@ -121,9 +229,12 @@ bool Base::pause() {
       return false;
     }
     state_ = Base::State::kWaitingToPause;
+    warm_ = true;
   }
+  cv_.notify_all();
+  wake();
 
-  wait(Base::State::kPaused, 10);
+  wait(Base::State::kPaused);
 
   return true;
 }
@@ -131,14 +242,17 @@ bool Base::pause() {
 bool Base::stop() {
   {
     std::unique_lock<std::mutex> lck(lock_);
+    cv_.wait(lck, [this]() { return resting(); });
     if (state_ == Base::State::kStopped) {
       return true;
     }
 
     state_ = Base::State::kWaitingToStop;
   }
+  cv_.notify_all();
+  wake();
 
-  wait(Base::State::kStopped, 10);
+  wait(Base::State::kStopped);
   thread_.join();
 
   return true;
@@ -147,39 +261,68 @@ bool Base::stop() {
 void Base::wrapper() { 
 
   while (1) {
-    {
-      std::unique_lock<std::mutex> lck(lock_);
-      if (state_ == Base::State::kWaitingToRun) {
+    State state = state_;
+    if (state == Base::State::kWaitingToRun) {
 
-        if (!waitingToRun()) { return; }
-        state_ = Base::State::kRunning;
+      bool warm;
+      {
+        std::unique_lock<std::mutex> lck(lock_);
+        warm = warm_;
+      }
+      phase(warm ? "resume" : "run");
+      if (!(warm ? waitingToResume() : waitingToRun())) { return; }
+      settle(state, Base::State::kRunning);
 
-      } else if (state_ == Base::State::kRunning) {
+    } else if (state == Base::State::kRunning) {
 
+      if (!loop_) {
+        phase("running", Base::Phase::kIdle);
+      } else {
+        if (kind_ != Base::Phase::kPending) { phase("running"); }
         if (!running()) { return; }
+      }
 
-      } else if (state_ == Base::State::kWaitingToPause) {
+    } else if (state == Base::State::kWaitingToPause) {
 
-        if (!waitingToHalt()) { return; }
-        state_ = Base::State::kPaused;
+      bool warm;
+      {
+        std::unique_lock<std::mutex> lck(lock_);
+        warm = warm_;
+      }
+      phase(warm ? "pause" : "halt");
+      if (!(warm ? waitingToPause() : waitingToHalt())) { return; }
+      settle(state, Base::State::kPaused);
 
-      } else if (state_ == Base::State::kPaused) {
+    } else if (state == Base::State::kPaused) {
 
+      if (!loop_) {
+        phase("paused", Base::Phase::kIdle);
+      } else {
+        phase("paused");
         if (!paused()) { return; }
+      }
 
-      } else if (state_ == Base::State::kWaitingToStop) {
+    } else if (state == Base::State::kWaitingToStop) {
 
-        if (!waitingToHalt()) { return; }
-        state_ = Base::State::kStopped;
+      phase("stop");
+      if (!waitingToHalt()) { return; }
+      settle(state, Base::State::kStopped);
 
-      } else if (state_ == Base::State::kStopped) {
+    } else if (state == Base::State::kStopped) {
 
-        break;
+      break;
 
-      }
     }
 
-    std::this_thread::sleep_for(std::chrono::microseconds(yield_time_));
+    // yield, a request ends it early.  With no loop a resting thread
+    // just waits for the request.
+    std::unique_lock<std::mutex> lck(lock_);
+    if (!loop_ && (state == Base::State::kRunning || state == Base::State::kPaused)) {
+      cv_.wait(lck, [&]() { return state_ != state; });
+    } else {
+      cv_.wait_for(lck, std::chrono::microseconds(yield_time_), 
+          [&]() { return state_ != state; });
+    }
   }
 }
 
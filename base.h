@@ -41,7 +41,26 @@
  *  threads a place to build-up or tear-down whatever the pipeline requires before the 
  *  thread falls into one of the 'resting' states ('Paused', 'Running', 'Stopped').
  *
+ *  A pause() out of 'Running' is warm: it calls waitingToPause() instead of waitingToHalt()
+ *  so the thread keeps everything it built (models, encoder, device buffers) and only stops
+ *  the data, and the next run() calls waitingToResume() instead of waitingToRun().  A stop()
+ *  always goes through waitingToHalt() and tears everything down.
+ *
+ *  The callbacks run outside the state lock.  A request sets the 'WaitingTo' state, wakes
+ *  the thread out of its yield and sleeps on a condition variable until the thread settles
+ *  in the resting state, so it waits for at most the callback in progress.  A thread whose
+ *  running() sleeps on its own condition variable overrides wake() to end that sleep too.
+ *
+ *  A thread with no run loop (created with loop=false) never has running() or paused()
+ *  called.  It sleeps in 'Running' and 'Paused' until the next request.
+ *
  *  The internal thread is created on 'start' and destroyed on 'stop'.
+ *
+ *  For the watchdog each thread carries a phase tag and the time it last made progress.
+ *  The wrapper tags the callbacks it calls and the threads tag the steps inside them.
+ *  An 'idle' phase (waiting for input) is never a stall.  A 'pending' phase (waiting on
+ *  something that has to come back, like the camera or the encoder) keeps its time across
+ *  calls until the thread tags another phase.
  */
 
 #ifndef BASE_H
@@ -49,6 +68,7 @@
 
 #include <string>
 #include <mutex>
+#include <condition_variable>
 #include <thread>
 #include <pthread.h>
 #include <vector>
@@ -61,7 +81,7 @@ namespace detector {
 class Base {
   protected:
     Base() = delete;
-    Base(unsigned int yield_time);
+    Base(unsigned int yield_time, bool loop=true);
     virtual ~Base();
 
   public:
@@ -75,7 +95,7 @@ class Base {
     };
 
     State getState();
-    void wait(State s, int usec);
+    void wait(State s);       // until the thread settles in s
 
     bool start(const char* name, int priority=50);  // creates the thread in kPaused state
     bool run();               // moves thread to kRunning state
@@ -85,17 +105,37 @@ class Base {
     unsigned int getPriority();
     bool setPriority(int priority);
 
+    // SCHED_RR unless set, either may be set before start()
+    int getPolicy();
+    bool setPolicy(int policy);
+    unsigned int getAffinity();
+    bool setAffinity(unsigned int cpus);      // bit n = cpu n, 0 = any
+
     std::string getName();
     bool setName(const char* name);
 
+    // what the thread is doing and for how long (usec), false if it
+    // is idle or stopped
+    bool getPhase(const char*& phase, unsigned int& usec);
+
     inline unsigned int getSleepTime()                { return yield_time_; }
     inline void setSleepTime(unsigned int yield_time) { yield_time_ = yield_time; }
 
   protected:
     virtual bool waitingToRun()   = 0;  // called once before entering kRunning state
-    virtual bool running()        = 0;  // called repeatedly while in kRunning state
-    virtual bool paused()         = 0;  // called repeatedly while in kPaused state
+    virtual bool running();             // called repeatedly while in kRunning state (loop only)
+    virtual bool paused();              // called repeatedly while in kPaused state (loop only)
     virtual bool waitingToHalt()  = 0;  // called once before entering kStopped or kPaused state
+    virtual bool waitingToPause();      // called once on pause() from kRunning (default: nothing)
+    virtual bool waitingToResume();     // called once on run() after waitingToPause() (default: nothing)
+    virtual void wake();                // called on each request (default: nothing)
+
+    enum class Phase {
+      kBusy,
+      kPending,
+      kIdle
+    };
+    void phase(const char* tag, Phase kind = Phase::kBusy);   // tag is a literal
 
   private:
     void wrapper();                     // wrapper around the loop callbacks
@@ -106,11 +146,20 @@ class Base {
     const unsigned int max_name_len_ = {15};
 
   private:
+    const bool loop_;
     unsigned int priority_;
+    int policy_;
+    unsigned int cpus_;
     std::string name_;
-    void setState(State s);
-    State state_;
-    std::mutex lock_;
+    bool resting();
+    void settle(State from, State to);
+    std::atomic<State> state_;
+    bool warm_;                         // paused with everything still built
+    std::mutex lock_;                   // state changes, not the callbacks
+    std::condition_variable cv_;
+    std::atomic<const char*> phase_;
+    std::atomic<Phase> kind_;
+    std::atomic<int64_t> beat_;         // steady clock usec of the last progress
     std::thread thread_;
 };
 
@@ -25,6 +25,7 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <unistd.h>
 #include <errno.h>
 #include <string>
 #include <algorithm>
@@ -36,26 +37,37 @@ namespace detector {
 
 Capturer::Capturer(unsigned int yieldtime) 
   : Base(yieldtime), 
-    framebuf_pool_(framebuf_num_) {
+    framebuf_pool_(framebuf_num_),
+    returns_(std::make_shared<Capturer::Returns>()) {
 }
 
 Capturer::~Capturer() {
 }
 
+Capturer::Mapping::~Mapping() {
+  if (addr != nullptr) {
+    int res = munmap(addr, length);
+    if (res < 0) {
+      dbgMsg("failed: unmap buffer (errno: %d)", errno);
+    }
+  }
+}
+
 std::unique_ptr<Capturer> Capturer::create(unsigned int yield_time, bool quiet, 
-    Encoder* enc, Tflow* tfl, unsigned int device, unsigned int framerate, 
-    int width, int height) {
+    Encoder* enc, Tflow* tfl, unsigned int camera, unsigned int device,
+    unsigned int framerate, int width, int height, bool yuv) {
   auto obj = std::unique_ptr<Capturer>(new Capturer(yield_time));
-  obj->init(quiet, enc, tfl, device, framerate, width, height);
+  obj->init(quiet, enc, tfl, camera, device, framerate, width, height, yuv);
   return obj;
 }
 
-bool Capturer::init(bool quiet, Encoder* enc, Tflow* tfl, unsigned int device, 
-    unsigned int framerate, int width, int height) { 
+bool Capturer::init(bool quiet, Encoder* enc, Tflow* tfl, unsigned int camera,
+    unsigned int device, unsigned int framerate, int width, int height, bool yuv) { 
 
   quiet_ = quiet;
   enc_ = enc;
   tfl_ = tfl;
+  camera_ = camera;
   device_ = device;
   framerate_ = framerate;
 
@@ -64,6 +76,12 @@ bool Capturer::init(bool quiet, Encoder* enc, Tflow* tfl, unsigned int device,
   width_ = std::abs(width);
   height_ = std::abs(height);
 
+  yuv_ = yuv;
+  if (yuv_) {
+    formats_ = yuv_formats_;
+  }
+  yuv_direct_ = false;
+
   fd_video_ = -1;
 
   frame_cnt_ = 0;
@@ -109,7 +127,7 @@ bool Capturer::waitingToRun() {
     dbgMsg("  streaming: %s\n", (cap.capabilities & V4L2_CAP_STREAMING) ? "yes" : "no");
 #endif
 
-    pix_fmt_ = V4L2_PIX_FMT_RGB24;
+    pix_fmt_ = formats_[0];
 
     dbgMsg("v4l2 formats\n");
     struct v4l2_fmtdesc fmtdesc;
@@ -252,6 +270,20 @@ bool Capturer::waitingToRun() {
     }
     pix_width_ = fmt.fmt.pix.width;
     pix_height_ = fmt.fmt.pix.height;
+
+    // I420 frames for the encoder and tflow
+    if (yuv_) {
+      unsigned int w = ALIGN_16B(width_);
+      unsigned int h = ALIGN_16B(height_);
+      yuv_direct_ = pix_fmt_ == V4L2_PIX_FMT_YUV420 && pix_width_ == w && pix_height_ == h;
+      if (!yuv_direct_) {
+        for (unsigned int i = 0; i < yuv_num_; i++) {
+          yuv_pool_.push_back(std::make_shared<std::vector<unsigned char>>(w * h * 3 / 2));
+          yuv_free_.push_back(i);
+        }
+      }
+      dbgMsg("  yuv420 %s\n", yuv_direct_ ? "direct" : "converted");
+    }
 #ifdef OUTPUT_VARIOUS_BITS_OF_INFO
     dbgMsg("  format: %s\n", PixelFormatToStr(fmt.fmt.pix.pixelformat));
     dbgMsg("  width:  %d\n", fmt.fmt.pix.width);
@@ -271,6 +303,7 @@ bool Capturer::waitingToRun() {
       return false;
     }
     dbgMsg("  buffer count: %d\n", rb.count);
+    queued_.assign(framebuf_num_, false);
     for (unsigned int i = 0; i < framebuf_num_; i++) {
       struct v4l2_buffer buf;
       memset(&buf, 0, sizeof(buf));
@@ -290,27 +323,17 @@ bool Capturer::waitingToRun() {
         return false;
       }
       framebuf_pool_[i].length = buf.length;
+      mappings_.push_back(std::make_shared<Capturer::Mapping>(
+            framebuf_pool_[i].addr, framebuf_pool_[i].length));
     }
     for (unsigned int i = 0; i < framebuf_num_; i++) {
-      struct v4l2_buffer buf;
-      memset(&buf, 0, sizeof(buf));
-      buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-      buf.memory = V4L2_MEMORY_MMAP;
-      buf.index = i;
-      res = xioctl(fd_video_, VIDIOC_QBUF, &buf);
-      if (res < 0) {
-        dbgMsg("  failed: queue buffer %d\n", i);
+      if (!queueBuffer(i)) {
         return false;
       }
-      dbgMsg("  buffer %d queued.  size: %zu\n", i, buf.length);
+      dbgMsg("  buffer %d queued.  size: %u\n", i, framebuf_pool_[i].length);
     }
 
-    // v4l2 stream on
-    dbgMsg("v4l2 stream on\n");
-    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    res = xioctl(fd_video_, VIDIOC_STREAMON, &type);
-    if (res < 0) {
-      dbgMsg("failed: stream on (errno: %d)\n", errno);
+    if (!streamOn()) {
       return false;
     }
 
@@ -343,6 +366,8 @@ bool Capturer::running() {
     timeout.tv_sec = 2;
     timeout.tv_usec = 0;
 
+    // a camera that stops delivering is a stall
+    phase("select", Base::Phase::kPending);
     int res = select(fd_video_+1, &fd_Set, NULL, NULL, &timeout);
 
     if (res < 0 && errno != EINTR) {
@@ -352,6 +377,7 @@ bool Capturer::running() {
     } else if (FD_ISSET(fd_video_, &fd_Set)) {
 
       // dequeue buffer
+      phase("dequeue");
       struct v4l2_buffer buf;
       memset(&buf, 0, sizeof(struct v4l2_buffer));
       buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -361,9 +387,49 @@ bool Capturer::running() {
         dbgMsg("failed: dequeue (errno: %d)\n", errno);
         return false;
       }
+      queued_[buf.index] = false;
 
       framebuf_pool_[buf.index].id = frame_cnt_++;
 
+      // pick the buffer that goes downstream
+      FrameBuf fbuf = framebuf_pool_[buf.index];
+      bool requeue = false;
+
+      // the driver's stamp when it is on the monotonic (steady) clock
+      if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC &&
+          (buf.timestamp.tv_sec != 0 || buf.timestamp.tv_usec != 0)) {
+        fbuf.stamp = std::chrono::steady_clock::time_point(
+            std::chrono::seconds(buf.timestamp.tv_sec) + 
+            std::chrono::microseconds(buf.timestamp.tv_usec));
+      } else {
+        fbuf.stamp = std::chrono::steady_clock::now();
+      }
+      if (yuv_) {
+        fbuf.length = ALIGN_16B(width_) * ALIGN_16B(height_) * 3 / 2;
+        fbuf.format = V4L2_PIX_FMT_YUV420;
+      }
+      if (yuv_ && !yuv_direct_) {
+
+        // convert into a free yuv buffer, the capture buffer can go right back
+        requeue = true;
+        if (yuv_free_.size() == 0) {
+          dbgMsg("no yuv buffers available\n");
+          fbuf.addr = nullptr;
+        } else {
+          unsigned int idx = yuv_free_.back();
+          yuv_free_.pop_back();
+          phase("convert");
+          differ_cvt_.begin();
+          convert_to_yuv420(pix_fmt_, framebuf_pool_[buf.index].addr, pix_width_, pix_height_,
+              yuv_pool_[idx]->data(), ALIGN_16B(width_), ALIGN_16B(height_));
+          differ_cvt_.end();
+          fbuf.addr = yuv_pool_[idx]->data();
+          fbuf.ref = makeRef(true, idx);
+        }
+      } else {
+        fbuf.ref = makeRef(false, buf.index);
+      }
+
 #ifdef CAPTURE_ONE_RAW_FRAME
       // write frames
       if (frame_cnt_ == capture_cnt_) {
@@ -371,31 +437,103 @@ bool Capturer::running() {
             framebuf_pool_[buf.index].addr);
       }
 #endif
-      // send frame to tflow
-      if (tfl_) {
-        differ_tfl_.begin();
-        if (!tfl_->addMessage(framebuf_pool_[buf.index])) {
-//          dbgMsg("warning: tflow is busy\n");
+      if (fbuf.addr != nullptr) {
+
+        // send frame to tflow
+        if (tfl_) {
+          phase("tflow");
+          differ_tfl_.begin();
+          if (!tfl_->addMessage(camera_, fbuf)) {
+//            dbgMsg("warning: tflow is busy\n");
+          }
+          differ_tfl_.end();
         }
-        differ_tfl_.end();
-      }
 
-      // send frame to encoder
-      if (enc_) {
-        differ_enc_.begin();
-        if (!enc_->addMessage(framebuf_pool_[buf.index])) {
-//          dbgMsg("warning: encoder is busy\n");
+        // send frame to encoder
+        if (enc_) {
+          phase("encoder");
+          differ_enc_.begin();
+          if (!enc_->addMessage(fbuf)) {
+//            dbgMsg("warning: encoder is busy\n");
+          }
+          differ_enc_.end();
         }
-        differ_enc_.end();
       }
 
-      // enqueue buffer
-      res = xioctl(fd_video_, VIDIOC_QBUF, &buf);
-      if (res < 0) {
-        dbgMsg("failed: enqueue (errno: %d)\n", errno);
+      // drop our reference, the buffer comes back once the listeners drop theirs
+      fbuf.ref.reset();
+      if (requeue && !queueBuffer(buf.index)) {
         return false;
       }
     }
+
+    // enqueue returned buffers
+    phase("requeue");
+    if (!requeueBuffers()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::shared_ptr<void> Capturer::makeRef(bool yuv, unsigned int idx) {
+
+  // the deleter keeps the memory alive and files the index for requeueing
+  std::shared_ptr<void> mem = yuv ? 
+    std::static_pointer_cast<void>(yuv_pool_[idx]) :
+    std::static_pointer_cast<void>(mappings_[idx]);
+  auto returns = returns_;
+  return std::shared_ptr<void>(nullptr, 
+      [mem, returns, yuv, idx](void*) {
+        std::unique_lock<std::mutex> lck(returns->lock);
+        if (yuv) {
+          returns->yuvs.push_back(idx);
+        } else {
+          returns->bufs.push_back(idx);
+        }
+      });
+}
+
+bool Capturer::queueBuffer(unsigned int idx) {
+  struct v4l2_buffer buf;
+  memset(&buf, 0, sizeof(buf));
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  buf.index = idx;
+  int res = xioctl(fd_video_, VIDIOC_QBUF, &buf);
+  if (res < 0) {
+    dbgMsg("failed: enqueue %u (errno: %d)\n", idx, errno);
+    return false;
+  }
+  queued_[idx] = true;
+  return true;
+}
+
+bool Capturer::streamOn() {
+  dbgMsg("v4l2 stream on\n");
+  enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  int res = xioctl(fd_video_, VIDIOC_STREAMON, &type);
+  if (res < 0) {
+    dbgMsg("failed: stream on (errno: %d)\n", errno);
+    return false;
+  }
+  return true;
+}
+
+bool Capturer::requeueBuffers() {
+
+  std::vector<unsigned int> bufs;
+  {
+    std::unique_lock<std::mutex> lck(returns_->lock);
+    bufs.swap(returns_->bufs);
+    yuv_free_.insert(yuv_free_.end(), returns_->yuvs.begin(), returns_->yuvs.end());
+    returns_->yuvs.clear();
+  }
+
+  for (auto idx : bufs) {
+    if (!queueBuffer(idx)) {
+      return false;
+    }
   }
   return true;
 }
@@ -404,6 +542,38 @@ bool Capturer::paused() {
   return true;
 }
 
+// the device stays open with its buffers mapped, the sensor just stops
+bool Capturer::waitingToPause() {
+
+  if (stream_on_) {
+    dbgMsg("v4l2 stream off\n");
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    int res = xioctl(fd_video_, VIDIOC_STREAMOFF, &type);
+    if (res < 0) {
+      dbgMsg("failed: stream off (errno: %d)", errno);
+    }
+  }
+  return true;
+}
+
+bool Capturer::waitingToResume() {
+
+  if (stream_on_) {
+
+    // what the driver had, then what the listeners gave back meanwhile
+    for (unsigned int i = 0; i < framebuf_num_; i++) {
+      if (queued_[i] && !queueBuffer(i)) {
+        return false;
+      }
+    }
+    if (!requeueBuffers()) {
+      return false;
+    }
+    return streamOn();
+  }
+  return true;
+}
+
 bool Capturer::waitingToHalt() {
 
   if (stream_on_) {
@@ -419,17 +589,18 @@ bool Capturer::waitingToHalt() {
       dbgMsg("failed: stream off (errno: %d)", errno);
     }
 
-    // return v4l2 buffers
+    // return v4l2 buffers (unmapped once the listeners let go of them)
     dbgMsg("return v4l2 buffers\n");
     for (unsigned int i = 0; i < framebuf_num_; i++) {
-      if (framebuf_pool_[i].addr != 0) {
-        int res = munmap(framebuf_pool_[i].addr, framebuf_pool_[i].length);
-        if (res < 0) {
-          dbgMsg("failed: unmap buffer: %d (errno: %d)", i, errno);
-        }  
-        framebuf_pool_[i].addr = 0;
-      }
+      framebuf_pool_[i].addr = 0;
     }
+    mappings_.clear();
+    yuv_pool_.clear();
+    yuv_free_.clear();
+
+    // listeners still holding frames (the encoder's queue) return them 
+    // later into the old list, never into the next session's
+    returns_ = std::make_shared<Capturer::Returns>();
 
     // close video device
     dbgMsg("close video device\n");
@@ -445,8 +616,13 @@ bool Capturer::waitingToHalt() {
 
     // report
     if (!quiet_) {
-      fprintf(stderr, "\n\nCapturer Results...\n");
+      fprintf(stderr, "\n\nCapturer Results (/dev/video%u)...\n", device_);
       fprintf(stderr, "   number of frames captured: %d\n", frame_cnt_); 
+      if (yuv_) {
+        fprintf(stderr, "    yuv420 convert time (us): high:%u avg:%u low:%u cnt:%u\n", 
+            differ_cvt_.high, differ_cvt_.avg, 
+            differ_cvt_.low,  differ_cvt_.cnt);
+      }
       fprintf(stderr, "   tflow copy time (us): high:%u avg:%u low:%u cnt:%u\n", 
           differ_tfl_.high, differ_tfl_.avg, 
           differ_tfl_.low,  differ_tfl_.cnt);
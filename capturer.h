@@ -23,6 +23,7 @@
 #include <thread>
 #include <atomic>
 #include <memory>
+#include <mutex>
 
 #include "utils.h"
 #include "listener.h"
@@ -35,26 +36,29 @@ namespace detector {
 class Capturer : public Base {
   public:
     static std::unique_ptr<Capturer> create(unsigned int yield_time, bool quiet, 
-        Encoder* enc, Tflow* tfl, unsigned int device, unsigned int framerate, 
-        int width, int height);
+        Encoder* enc, Tflow* tfl, unsigned int camera, unsigned int device,
+        unsigned int framerate, int width, int height, bool yuv);
     virtual ~Capturer();
 
   protected:
     Capturer() = delete;
     Capturer(unsigned int yield_time);
-    bool init(bool quiet, Encoder* enc, Tflow* tfl, unsigned int device,
-        unsigned int framerate, int width, int height);
+    bool init(bool quiet, Encoder* enc, Tflow* tfl, unsigned int camera,
+        unsigned int device, unsigned int framerate, int width, int height, bool yuv);
 
   protected:
     virtual bool waitingToRun();
     virtual bool running();
     virtual bool paused();
     virtual bool waitingToHalt();
+    virtual bool waitingToPause();
+    virtual bool waitingToResume();
 
   private:
     bool quiet_;
     Encoder* enc_;
     Tflow* tfl_;
+    unsigned int camera_;                    // tflow camera number
     unsigned int device_;
     unsigned int framerate_;
     unsigned int width_;
@@ -71,16 +75,66 @@ class Capturer : public Base {
       V4L2_PIX_FMT_RGB24   // in order of preference
     };
 
+    // I420 pipeline: capture any of these and hand out planar yuv420
+    // at the encoder's 16 pixel aligned size.  Frames that are already
+    // I420 at that size go out without a copy.
+    bool yuv_;
+    std::vector<int> yuv_formats_ = {
+      V4L2_PIX_FMT_YUV420, // in order of preference
+      V4L2_PIX_FMT_NV12,
+      V4L2_PIX_FMT_NV21,
+      V4L2_PIX_FMT_YUYV,
+      V4L2_PIX_FMT_YVYU
+    };
+    bool yuv_direct_;
+    const unsigned int yuv_num_ = {4};
+    std::vector<std::shared_ptr<std::vector<unsigned char>>> yuv_pool_;
+    std::vector<unsigned int> yuv_free_;
+
     unsigned int frame_cnt_;
     int fd_video_;
 
-    const unsigned int framebuf_num_ = {3};
+    // frames go out by reference (FrameBuf::ref).  When the last 
+    // listener drops its copy the buffer index lands on the returns 
+    // list and the capture thread requeues it.  The mmap'd buffers stay
+    // mapped until the last reference is gone, even after halt.  Each
+    // streaming session gets its own returns list so late returns from
+    // the last one are dropped.
+    const unsigned int framebuf_num_ = {6};
     std::vector<FrameBuf> framebuf_pool_;
 
+    class Mapping {
+      public:
+        Mapping(unsigned char* a, unsigned int l) : addr(a), length(l) {}
+        ~Mapping();
+      public:
+        unsigned char* addr;
+        unsigned int length;
+    };
+    std::vector<std::shared_ptr<Capturer::Mapping>> mappings_;
+
+    class Returns {
+      public:
+        std::mutex lock;
+        std::vector<unsigned int> bufs;   // v4l2 buffer indices
+        std::vector<unsigned int> yuvs;   // yuv pool indices
+    };
+    std::shared_ptr<Capturer::Returns> returns_;
+
+    std::shared_ptr<void> makeRef(bool yuv, unsigned int idx);
+    bool requeueBuffers();
+    bool queueBuffer(unsigned int idx);
+
+    // the driver gives back every queued buffer on stream off, a warm
+    // pause requeues them before stream on
+    std::vector<bool> queued_;
+    bool streamOn();
+
     std::atomic<bool> stream_on_;
 
     int xioctl(int fd, int request, void* arg);
 
+    MicroDiffer<uint32_t> differ_cvt_;
     MicroDiffer<uint32_t> differ_enc_;
     MicroDiffer<uint32_t> differ_tfl_;
     MicroDiffer<uint32_t> differ_tot_;
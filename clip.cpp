@@ -0,0 +1,242 @@
+/*
+ * Copyright © 2019 Tyler J. Brooks <tylerjbrooks@digispeaker.com> <https://www.digispeaker.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Try './clip -?' for usage.
+ *
+ * ----------
+ *
+ *  Cuts a clip out of a segmented recording ('detector -x/-z').  Only
+ *  the '.idx' files are searched; the clip starts at the last IDR at
+ *  or before the start time and ends at the first IDR after the end
+ *  time, so nothing has to be parsed or re-encoded.  Works the same for
+ *  '.h264' and '.mp4' segments; the clip gets the segment's extension.
+ *  The mp4 fragments are renumbered as they are copied so their
+ *  sequence numbers and decode times run on across segments (and
+ *  across restarts of the recorder).
+ */
+
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "utils.h"
+#include "segmenter.h"
+#include "mp4.h"
+
+namespace detector {
+
+void usage() {
+  std::cout << "clip -?psdo"                                                 << std::endl;
+  std::cout << "version: 1.0"                                                << std::endl;
+  std::cout                                                                  << std::endl;
+  std::cout << "  where:"                                                    << std::endl;
+  std::cout << "  ?            = this screen"                                << std::endl;
+  std::cout << "  (p)refix     = recording prefix        (default = none)"   << std::endl;
+  std::cout << "  (s)tart      = seconds into recording  (default = 0)"      << std::endl;
+  std::cout << "  (d)uration   = clip length in seconds  (default = 10)"     << std::endl;
+  std::cout << "  (o)utput     = output file name        (default = clip.h264/.mp4)" << std::endl;
+}
+
+// copy [from, to) of a segment, to == 0 means to the end
+static uint64_t copyRange(const std::string& name, uint64_t from, uint64_t to, FILE* out) {
+  FILE* in = fopen(name.c_str(), "rb");
+  if (in == nullptr) {
+    fprintf(stderr, "failed: open %s\n", name.c_str());
+    return 0;
+  }
+  fseeko(in, from, SEEK_SET);
+
+  uint64_t cnt = 0;
+  std::vector<unsigned char> buf(1024 * 1024);
+  while (to == 0 || from + cnt < to) {
+    size_t num = buf.size();
+    if (to != 0) {
+      num = std::min<uint64_t>(num, to - from - cnt);
+    }
+    num = fread(buf.data(), 1, num, in);
+    if (num == 0) {
+      break;
+    }
+    cnt += fwrite(buf.data(), 1, num, out);
+  }
+  fclose(in);
+  return cnt;
+}
+
+// same for mp4 fragments, each moof gets the next sequence and decode time
+static uint64_t copyFragments(const std::string& name, uint64_t from, uint64_t to, FILE* out,
+    uint32_t& seq, uint64_t& decode_time) {
+  FILE* in = fopen(name.c_str(), "rb");
+  if (in == nullptr) {
+    fprintf(stderr, "failed: open %s\n", name.c_str());
+    return 0;
+  }
+  fseeko(in, from, SEEK_SET);
+
+  uint64_t cnt = 0;
+  std::vector<unsigned char> box;
+  while (to == 0 || from + cnt < to) {
+    unsigned char hdr[8];
+    if (fread(hdr, 1, sizeof(hdr), in) != sizeof(hdr)) {
+      break;
+    }
+    uint32_t size = (hdr[0] << 24) | (hdr[1] << 16) | (hdr[2] << 8) | hdr[3];
+    if (size < sizeof(hdr)) {
+      fprintf(stderr, "failed: bad box in %s\n", name.c_str());
+      break;
+    }
+    box.assign(hdr, hdr + sizeof(hdr));
+    box.resize(size);
+    if (fread(box.data() + sizeof(hdr), 1, size - sizeof(hdr), in) != size - sizeof(hdr)) {
+      break;
+    }
+    if (std::memcmp(hdr + 4, "moof", 4) == 0 && !Mp4::retime(box, ++seq, decode_time)) {
+      fprintf(stderr, "warning: fragment not renumbered in %s\n", name.c_str());
+    }
+    cnt += fwrite(box.data(), 1, box.size(), out);
+  }
+  fclose(in);
+  return cnt;
+}
+
+int main(int argc, char** argv) {
+
+  // defaults
+  std::string prefix;
+  double start = 0.0;
+  double duration = 10.0;
+  std::string output;
+
+  // cmd line options
+  int c;
+  while((c = getopt(argc, argv, ":p:s:d:o:")) != -1) {
+    switch (c) {
+      case 'p': prefix   = optarg;             break;
+      case 's': start    = std::stod(optarg);  break;
+      case 'd': duration = std::stod(optarg);  break;
+      case 'o': output   = optarg;             break;
+
+      case '?':
+      default:  usage(); return 0;
+    }
+  }
+  if (prefix.empty()) {
+    usage();
+    return 1;
+  }
+
+  MicroDiffer<uint32_t> differ_tot;
+  differ_tot.begin();
+
+  // first idr of each segment still on disk, older ones may be gone
+  std::vector<Segmenter::Entry> firsts;
+  std::vector<unsigned int> nums;
+  std::vector<Segmenter::Entry> idx;
+  for (auto n : Segmenter::listSegments(prefix, true)) {
+    FILE* fd = fopen(Segmenter::indexName(prefix, n).c_str(), "rb");
+    if (fd == nullptr) {
+      continue;
+    }
+    Segmenter::Entry ent;
+    fseek(fd, sizeof(Segmenter::magic_), SEEK_SET);
+    if (fread(&ent, sizeof(ent), 1, fd) != 1) {
+      fclose(fd);
+      continue;
+    }
+    fclose(fd);
+    firsts.push_back(ent);
+    nums.push_back(n);
+  }
+  if (firsts.size() == 0) {
+    fprintf(stderr, "failed: no segments for %s\n", prefix.c_str());
+    return 1;
+  }
+  const char* ext = ".h264";
+  if (access(Segmenter::segmentName(prefix, nums[0], ext).c_str(), R_OK) != 0) {
+    ext = ".mp4";
+  }
+  if (output.empty()) {
+    output = std::string("clip") + ext;
+  }
+
+  int64_t begin = firsts[0].pts + static_cast<int64_t>(start * 1000000);
+  int64_t end = begin + static_cast<int64_t>(duration * 1000000);
+  auto later = [](int64_t pts, const Segmenter::Entry& e) { return pts < e.pts; };
+
+  // segment and idr the clip starts at
+  unsigned int seg = std::upper_bound(firsts.begin(), firsts.end(), begin, later) - firsts.begin();
+  seg = (seg == 0) ? 0 : seg - 1;
+  if (!Segmenter::readIndex(Segmenter::indexName(prefix, nums[seg]), idx) || idx.size() == 0) {
+    return 1;
+  }
+  auto it = std::upper_bound(idx.begin(), idx.end(), begin, later);
+  uint64_t from = (it == idx.begin()) ? idx[0].offset : (it - 1)->offset;
+  int64_t clip_pts = (it == idx.begin()) ? idx[0].pts : (it - 1)->pts;
+
+  FILE* out = fopen(output.c_str(), "wb");
+  if (out == nullptr) {
+    fprintf(stderr, "failed: create %s\n", output.c_str());
+    return 1;
+  }
+
+  // sps/pps (or the mp4 init segment) from the top of the first
+  // segment, then whole gops
+  bool mp4 = std::string(ext) == ".mp4";
+  uint32_t seq = 0;
+  uint64_t decode_time = 0;
+  uint64_t bytes = copyRange(Segmenter::segmentName(prefix, nums[seg], ext), 0, idx[0].offset, out);
+  for (; seg < firsts.size(); seg++) {
+    if (from == 0) {
+      if (!Segmenter::readIndex(Segmenter::indexName(prefix, nums[seg]), idx) || idx.size() == 0) {
+        break;
+      }
+      from = idx[0].offset;
+    }
+    auto stop = std::upper_bound(idx.begin(), idx.end(), end, later);
+    uint64_t to = (stop == idx.end()) ? 0 : stop->offset;
+    if (mp4) {
+      bytes += copyFragments(Segmenter::segmentName(prefix, nums[seg], ext), from, to, out,
+          seq, decode_time);
+    } else {
+      bytes += copyRange(Segmenter::segmentName(prefix, nums[seg], ext), from, to, out);
+    }
+    if (to != 0) {
+      break;
+    }
+    from = 0;
+  }
+  fclose(out);
+  differ_tot.end();
+
+  fprintf(stderr, "\nClip Results...\n");
+  fprintf(stderr, "      segments: %u\n", static_cast<unsigned int>(firsts.size()));
+  fprintf(stderr, "    clip start: %.3f sec\n", (clip_pts - firsts[0].pts) / 1000000.0);
+  fprintf(stderr, " bytes written: %llu\n", static_cast<unsigned long long>(bytes));
+  fprintf(stderr, "     clip time: %u usec\n", differ_tot.avg);
+  fprintf(stderr, "\n");
+
+  return 0;
+}
+
+} // namespace detector
+
+int main(int argc, char** argv) {
+  return detector::main(argc, argv);
+}
@@ -0,0 +1,244 @@
+/*
+ * Copyright © 2019 Tyler J. Brooks <tylerjbrooks@digispeaker.com> <https://www.digispeaker.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Try './detector -h' for usage.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <iterator>
+
+#include "counter.h"
+
+namespace detector {
+
+Counter::Counter() {
+}
+
+Counter::~Counter() {
+}
+
+std::unique_ptr<Counter> Counter::create(const std::string& fname) {
+  auto obj = std::unique_ptr<Counter>(new Counter());
+  if (!obj->init(fname)) {
+    return nullptr;
+  }
+  return obj;
+}
+
+bool Counter::init(const std::string& fname) {
+
+  std::ifstream ifs(fname.c_str(), std::ifstream::in);
+  if (!ifs) {
+    fprintf(stderr, "could not open counter file %s\n", fname.c_str());
+    return false;
+  }
+
+  std::string line;
+  unsigned int num = 0;
+  while (std::getline(ifs, line)) {
+    num++;
+    std::istringstream iss(line);
+    std::vector<std::string> tokens{
+      std::istream_iterator<std::string>{iss},
+      std::istream_iterator<std::string>{}
+    };
+    if (tokens.size() == 0 || tokens[0][0] == '#') {
+      continue;
+    }
+
+    std::vector<double> vals;
+    try {
+      std::transform(tokens.begin() + std::min<size_t>(2, tokens.size()), tokens.end(),
+          std::back_inserter(vals), [](const std::string& s) { return std::stod(s); });
+    } catch (...) {
+      fprintf(stderr, "%s:%u: bad coordinate\n", fname.c_str(), num);
+      return false;
+    }
+
+    if (tokens[0] == "line" && tokens.size() == 6) {
+      Counter::Line l;
+      l.name = tokens[1];
+      l.a = Counter::Point{vals[0], vals[1]};
+      l.b = Counter::Point{vals[2], vals[3]};
+      lines_.push_back(l);
+    } else if (tokens[0] == "zone" && tokens.size() >= 8 && vals.size() % 2 == 0) {
+      if (zones_.size() == zone_max_) {
+        fprintf(stderr, "%s:%u: more than %u zones\n", fname.c_str(), num, zone_max_);
+        return false;
+      }
+      Counter::Zone z;
+      z.name = tokens[1];
+      for (unsigned int i = 0; i < vals.size(); i += 2) {
+        z.pts.push_back(Counter::Point{vals[i], vals[i + 1]});
+      }
+      z.min_x = z.max_x = z.pts[0].x;
+      z.min_y = z.max_y = z.pts[0].y;
+      std::for_each(z.pts.begin(), z.pts.end(),
+          [&](const Counter::Point& p) {
+            z.min_x = std::min(z.min_x, p.x);
+            z.min_y = std::min(z.min_y, p.y);
+            z.max_x = std::max(z.max_x, p.x);
+            z.max_y = std::max(z.max_y, p.y);
+          });
+      zones_.push_back(z);
+    } else {
+      fprintf(stderr, "%s:%u: expected 'line <name> x1 y1 x2 y2' "
+          "or 'zone <name> x1 y1 x2 y2 x3 y3 ...'\n", fname.c_str(), num);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// > 0 when (x,y) is right of a->b (image coordinates, y down)
+double Counter::side(const Counter::Point& a, const Counter::Point& b, double x, double y) {
+  return (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+}
+
+// even-odd rule
+bool Counter::inside(const Counter::Zone& zone, double x, double y) {
+
+  if (x < zone.min_x || x > zone.max_x || y < zone.min_y || y > zone.max_y) {
+    return false;
+  }
+
+  bool in = false;
+  const auto& pts = zone.pts;
+  for (unsigned int i = 0, j = pts.size() - 1; i < pts.size(); j = i++) {
+    if ((pts[i].y > y) != (pts[j].y > y) &&
+        x < (pts[j].x - pts[i].x) * (y - pts[i].y) / (pts[j].y - pts[i].y) + pts[i].x) {
+      in = !in;
+    }
+  }
+  return in;
+}
+
+void Counter::update(Counter::State& state, BoxBuf::Type type, double x, double y) {
+
+  unsigned int t = static_cast<unsigned int>(type);
+
+  // line crossings between the last and current position
+  if (state.valid) {
+    Counter::Point prev{state.x, state.y};
+    Counter::Point cur{x, y};
+    std::for_each(lines_.begin(), lines_.end(),
+        [&](Counter::Line& l) {
+          bool s0 = side(l.a, l.b, prev.x, prev.y) >= 0.0;
+          bool s1 = side(l.a, l.b, cur.x, cur.y) >= 0.0;
+          if (s0 == s1) {
+            return;
+          }
+          double e0 = side(prev, cur, l.a.x, l.a.y);
+          double e1 = side(prev, cur, l.b.x, l.b.y);
+          if ((e0 > 0.0 && e1 > 0.0) || (e0 < 0.0 && e1 < 0.0)) {
+            return;
+          }
+          if (s1) {
+            l.fwd[t]++;
+          } else {
+            l.rev[t]++;
+          }
+        });
+  }
+
+  // zone entries and exits
+  uint32_t zones = 0;
+  for (unsigned int i = 0; i < zones_.size(); i++) {
+    if (inside(zones_[i], x, y)) {
+      zones |= 1u << i;
+    }
+  }
+  uint32_t changed = zones ^ state.zones;
+  for (unsigned int i = 0; changed && i < zones_.size(); i++) {
+    uint32_t bit = 1u << i;
+    if (changed & bit) {
+      if (zones & bit) {
+        zones_[i].occupancy[t]++;
+        zones_[i].entries[t]++;
+      } else {
+        zones_[i].occupancy[t]--;
+      }
+    }
+  }
+
+  state.valid = true;
+  state.x = x;
+  state.y = y;
+  state.zones = zones;
+}
+
+void Counter::remove(Counter::State& state, BoxBuf::Type type) {
+
+  unsigned int t = static_cast<unsigned int>(type);
+
+  for (unsigned int i = 0; state.zones && i < zones_.size(); i++) {
+    if (state.zones & (1u << i)) {
+      zones_[i].occupancy[t]--;
+    }
+  }
+  state.zones = 0;
+  state.valid = false;
+}
+
+unsigned int Counter::getLineCount(unsigned int idx, BoxBuf::Type type, Counter::Dir dir) {
+  unsigned int t = static_cast<unsigned int>(type);
+  return (dir == Counter::Dir::kForward) ? lines_[idx].fwd[t].load() : lines_[idx].rev[t].load();
+}
+
+unsigned int Counter::getZoneOccupancy(unsigned int idx, BoxBuf::Type type) {
+  return zones_[idx].occupancy[static_cast<unsigned int>(type)].load();
+}
+
+unsigned int Counter::getZoneEntries(unsigned int idx, BoxBuf::Type type) {
+  return zones_[idx].entries[static_cast<unsigned int>(type)].load();
+}
+
+void Counter::report() {
+
+  const std::pair<BoxBuf::Type, const char*> types[] = {
+    { BoxBuf::Type::kPerson,  "person"  },
+    { BoxBuf::Type::kPet,     "pet"     },
+    { BoxBuf::Type::kVehicle, "vehicle" }
+  };
+
+  fprintf(stderr, "\nCounter Results...\n");
+  for (unsigned int i = 0; i < lines_.size(); i++) {
+    fprintf(stderr, "  line %s (fwd/rev):", lines_[i].name.c_str());
+    std::for_each(std::begin(types), std::end(types),
+        [&](const std::pair<BoxBuf::Type, const char*>& type) {
+          fprintf(stderr, " %s:%u/%u", type.second,
+              getLineCount(i, type.first, Counter::Dir::kForward),
+              getLineCount(i, type.first, Counter::Dir::kReverse));
+        });
+    fprintf(stderr, "\n");
+  }
+  for (unsigned int i = 0; i < zones_.size(); i++) {
+    fprintf(stderr, "  zone %s (now/entries):", zones_[i].name.c_str());
+    std::for_each(std::begin(types), std::end(types),
+        [&](const std::pair<BoxBuf::Type, const char*>& type) {
+          fprintf(stderr, " %s:%u/%u", type.second,
+              getZoneOccupancy(i, type.first), getZoneEntries(i, type.first));
+        });
+    fprintf(stderr, "\n");
+  }
+  fprintf(stderr, "\n");
+}
+
+} // namespace detector
@@ -0,0 +1,130 @@
+/*
+ * Copyright © 2019 Tyler J. Brooks <tylerjbrooks@digispeaker.com> <https://www.digispeaker.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Try './detector -h' for usage.
+ */
+
+#ifndef COUNTER_H
+#define COUNTER_H
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <vector>
+
+#include "utils.h"
+#include "listener.h"
+
+namespace detector {
+
+// Line crossing and zone occupancy counters.  The tracker calls
+// 'update' each time a track gets a new position and 'remove' when
+// a track is dropped.  The counters are atomics so any thread can
+// read them while the tracker is running.
+//
+// The config file has one line or zone per row (capture pixels):
+//
+//   # comment
+//   line <name> <x1> <y1> <x2> <y2>
+//   zone <name> <x1> <y1> <x2> <y2> <x3> <y3> ...
+//
+// A line crossing is 'forward' when a track moves from the left side
+// of (x1,y1)->(x2,y2) to the right side (in image coordinates).
+class Counter {
+  public:
+    // per track counter state
+    class State {
+      public:
+        State() : valid(false), x(0.0), y(0.0), zones(0) {}
+        ~State() {}
+      public:
+        bool valid;
+        double x, y;
+        uint32_t zones;
+    };
+
+    enum class Dir {
+      kForward = 0,
+      kReverse
+    };
+
+    static const unsigned int type_num_ = {4};   // BoxBuf::Type values
+    static const unsigned int zone_max_ = {32};  // bits in State::zones
+
+  public:
+    static std::unique_ptr<Counter> create(const std::string& fname);
+    virtual ~Counter();
+
+  public:
+    void update(Counter::State& state, BoxBuf::Type type, double x, double y);
+    void remove(Counter::State& state, BoxBuf::Type type);
+
+    inline unsigned int getLineNum() { return lines_.size(); }
+    inline unsigned int getZoneNum() { return zones_.size(); }
+    inline const std::string& getLineName(unsigned int idx) { return lines_[idx].name; }
+    inline const std::string& getZoneName(unsigned int idx) { return zones_[idx].name; }
+
+    unsigned int getLineCount(unsigned int idx, BoxBuf::Type type, Counter::Dir dir);
+    unsigned int getZoneOccupancy(unsigned int idx, BoxBuf::Type type);
+    unsigned int getZoneEntries(unsigned int idx, BoxBuf::Type type);
+
+    void report();
+
+  protected:
+    Counter();
+    bool init(const std::string& fname);
+
+  private:
+    class Point {
+      public:
+        double x, y;
+    };
+
+    class Line {
+      public:
+        Line() = default;
+        Line(const Line& l) : name(l.name), a(l.a), b(l.b) {}
+        ~Line() {}
+      public:
+        std::string name;
+        Counter::Point a, b;
+        std::atomic<unsigned int> fwd[type_num_] = {};
+        std::atomic<unsigned int> rev[type_num_] = {};
+    };
+
+    class Zone {
+      public:
+        Zone() = default;
+        Zone(const Zone& z) : name(z.name), pts(z.pts),
+          min_x(z.min_x), min_y(z.min_y), max_x(z.max_x), max_y(z.max_y) {}
+        ~Zone() {}
+      public:
+        std::string name;
+        std::vector<Counter::Point> pts;
+        double min_x, min_y, max_x, max_y;
+        std::atomic<unsigned int> occupancy[type_num_] = {};
+        std::atomic<unsigned int> entries[type_num_] = {};
+    };
+
+    std::vector<Counter::Line> lines_;
+    std::vector<Counter::Zone> zones_;
+
+    double side(const Counter::Point& a, const Counter::Point& b, double x, double y);
+    bool inside(const Counter::Zone& zone, double x, double y);
+};
+
+} // namespace detector
+
+#endif // COUNTER_H
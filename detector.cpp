@@ -21,6 +21,12 @@
 #include <memory>
 #include <chrono>
 #include <cmath>
+#include <set>
+#include <map>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <sstream>
 #include <signal.h>
 #include <unistd.h>
 
@@ -31,17 +37,37 @@
 #include "capturer.h"
 #include "tflow.h"
 #include "tracker.h"
+#include "counter.h"
+#include "recorder.h"
+#include "writer.h"
+#include "watchdog.h"
 
 namespace detector {
 
-std::unique_ptr<Encoder>  enc(nullptr);
-std::unique_ptr<Rtsp>     rtsp(nullptr);
-std::unique_ptr<Capturer> cap(nullptr);
-std::unique_ptr<Tflow>    tfl(nullptr);
-std::unique_ptr<Tracker>  trk(nullptr);
+// one camera, the model and the rtsp server are shared
+class Pipeline {
+  public:
+    std::unique_ptr<Capturer> cap;
+    std::unique_ptr<Encoder>  enc;
+    std::unique_ptr<Rtsp>     rtsp;
+    std::unique_ptr<Encoder>  sub;
+    std::unique_ptr<Rtsp>     subrtsp;
+    std::unique_ptr<Counter>  ctr;
+    std::unique_ptr<Tracker>  trk;
+    std::unique_ptr<Recorder> rec;
+    std::unique_ptr<Writer>   wrt;
+};
+
+std::vector<std::unique_ptr<Pipeline>> pipes;
+std::unique_ptr<Tflow>      tfl(nullptr);
+std::unique_ptr<RtspServer> srv(nullptr);
+std::unique_ptr<Watchdog>   wdg(nullptr);
+
+// SIGUSR1 pauses the cameras, SIGUSR2 resumes them
+std::atomic<int> pause_request(0);
 
 void usage() {
-  std::cout << "detector -?qpkrutdfwhbyesml [output]" << std::endl;
+  std::cout << "detector -?qpkcjvgrutdfwhibyesmlxznaBNAW [output]" << std::endl;
   std::cout << "version: 1.0"                     << std::endl;
   std::cout                                       << std::endl;
   std::cout << "  where:"                         << std::endl;
@@ -50,44 +76,209 @@ void usage() {
   std::cout << "  (r)tsp       = rtsp server         (default = off)"   << std::endl;
   std::cout << "  (u)nicast    = rtsp unicast addr   (default = none)"  << std::endl;
   std::cout << "               = multicast if no address specified"     << std::endl;
+  std::cout << "  substre(a)m  = rtsp substream scale[:bitrate] (default = off)" << std::endl;
+  std::cout << "               = e.g. 4 for 1/4 size at 1/10 the bitrate" << std::endl;
   std::cout << "  (t)esttime   = test duration       (default = 30sec)" << std::endl;
   std::cout << "               = 0 to run until ctrl-c"                 << std::endl;
   std::cout << "  (d)device    = video device num    (default = 0)"     << std::endl;
+  std::cout << "               = comma list for more cameras, e.g. 0,1" << std::endl;
   std::cout << "  (f)ramerate  = capture framerate   (default = 20)"    << std::endl;
   std::cout << "  (w)idth      = capture width       (default = 640)"   << std::endl;
   std::cout << "               = negative value means flip"             << std::endl;
   std::cout << "  (h)eight     = capture height      (default = 480)"   << std::endl;
   std::cout << "               = negative value means flip"             << std::endl;
+  std::cout << "  (i)420       = yuv420 pipeline     (default = false)" << std::endl;
   std::cout << "  (b)itrate    = encoder bitrate     (default = 1000000)"  << std::endl;
+  std::cout << "  idle (B)ps   = idle bitrate[:fps]  (default = off)"   << std::endl;
+  std::cout << "               = used while there are no targets"       << std::endl;
   std::cout << "  (y)ield time = yield time          (default = 1000usec)" << std::endl;
   std::cout << "  thr(e)ads    = number of tflow threads (default = 1)"    << std::endl;
   std::cout << "  thre(s)hold  = object detect threshold (default = 0.5)"  << std::endl;
+  std::cout << "  batch (N)    = frames per invoke[:wait usec] (default = 1)" << std::endl;
+  std::cout << "               = wait defaults to half a frame"         << std::endl;
   std::cout << "  t(p)u        = use Edge TPU        (default = false)" << std::endl;
   std::cout << "  trac(k)ing   = track targets       (default = false)" << std::endl;
+  std::cout << "  (c)ounters   = line/zone counter file (default = none)"  << std::endl;
+  std::cout << "               = implies tracking"                      << std::endl;
+  std::cout << "  tra(j)ectory = track history file  (default = none)"    << std::endl;
+  std::cout << "               = implies tracking"                      << std::endl;
+  std::cout << "  e(v)ents     = event recording prefix (default = none)"  << std::endl;
+  std::cout << "  tri(g)gers   = event classes       (default = person)"  << std::endl;
+  std::cout << "               = comma list of person,pet,vehicle"      << std::endl;
   std::cout << "  (m)odel      = path to model       (default = ./models/detect.tflite)"         << std::endl;
   std::cout << "                                     (default = ./models/edgetpu_detect.tflite)" << std::endl;
   std::cout << "  (l)abels     = path to labels      (default = ./models/labels.txt)"            << std::endl;
   std::cout << "                                     (default = ./models/edgetpu_labels.txt)"    << std::endl;
   std::cout << "  (o)utput     = output file name"                      << std::endl;
   std::cout << "               = no output if testtime is 0"            << std::endl;
+  std::cout << "  segment(x)   = segment length in sec (default = 0, off)" << std::endl;
+  std::cout << "  si(z)e       = segment size in MB  (default = 0, off)"  << std::endl;
+  std::cout << "               = output is then a prefix for NNNNN.h264/.idx" << std::endl;
+  std::cout << "  sy(n)c       = output fsync period in sec (default = 0, off)" << std::endl;
+  std::cout << "  (A)ffinity   = stage:cpus[:policy] (default = any cpu, rr)" << std::endl;
+  std::cout << "               = stage is cap,tfl,tflw,trk,enc,sub,rec,wrt,rtsp" << std::endl;
+  std::cout << "               = tflw is tflite's worker threads"       << std::endl;
+  std::cout << "               = cpus e.g. 0 or 2,3 or 1-3, policy other,fifo,rr" << std::endl;
+  std::cout << "               = repeat for each stage"                 << std::endl;
+  std::cout << "  (W)atchdog   = stage stall deadline in msec (default = 0, off)" << std::endl;
+  std::cout                                       << std::endl;
+  std::cout << "  kill -USR1 pauses the cameras, kill -USR2 resumes them" << std::endl;
 }
 
-void quitHandler(int s) {
-  if (cap)  { cap->stop(); }
-  if (trk)  { trk->stop(); }
-  if (tfl)  { tfl->stop(); }
-  if (enc)  { enc->stop(); }
-  if (rtsp) { rtsp->stop(); }
-
-  cap.reset(nullptr);
-  trk.reset(nullptr);
+// camera 0 keeps the name, camera n gets n before any extension
+std::string cameraName(const std::string& name, unsigned int n) {
+  if (n == 0) {
+    return name;
+  }
+  size_t dot = name.find_last_of('.');
+  size_t slash = name.find_last_of('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    return name + std::to_string(n);
+  }
+  return name.substr(0, dot) + std::to_string(n) + name.substr(dot);
+}
+
+// capturers first so nothing is left feeding a stopped stage
+void stopAll() {
+  if (wdg) { wdg->stop(); }
+  for (auto& p : pipes) { if (p->cap) { p->cap->stop(); } }
+  if (tfl) { tfl->stop(); }
+  for (auto& p : pipes) {
+    if (p->trk) { p->trk->stop(); }
+    if (p->enc) { p->enc->stop(); }
+    if (p->sub) { p->sub->stop(); }
+    if (p->rec) { p->rec->stop(); }
+    if (p->wrt) { p->wrt->stop(); }
+    if (p->rtsp) { p->rtsp->stop(); }
+    if (p->subrtsp) { p->subrtsp->stop(); }
+  }
+  if (srv) { srv->stop(); }
+}
+
+void destroyAll() {
+  for (auto& p : pipes) { p->cap.reset(nullptr); }
   tfl.reset(nullptr);
-  enc.reset(nullptr);
-  rtsp.reset(nullptr);
+  pipes.clear();
+  srv.reset(nullptr);
+  wdg.reset(nullptr);
+}
 
+void quitHandler(int s) {
+  stopAll();
+  destroyAll();
   exit(1);
 }
 
+// cpus and policy of one stage
+class Sched {
+  public:
+    unsigned int cpus;
+    int policy;
+};
+std::map<std::string, Sched> scheds;
+
+// "stage:cpus[:policy]", cpus like "2,3" or "1-3"
+bool parseSched(const std::string& arg) {
+  std::vector<std::string> parts;
+  std::stringstream ss(arg);
+  std::string part;
+  while (std::getline(ss, part, ':')) {
+    parts.push_back(part);
+  }
+  if (parts.size() < 2 || parts.size() > 3) {
+    return false;
+  }
+  const std::set<std::string> stages = {
+    "cap", "tfl", "tflw", "trk", "enc", "sub", "rec", "wrt", "rtsp"
+  };
+  if (stages.find(parts[0]) == stages.end()) {
+    return false;
+  }
+
+  Sched sched = { 0, SCHED_RR };
+  std::stringstream cs(parts[1]);
+  std::string range;
+  while (std::getline(cs, range, ',')) {
+    size_t dash = range.find('-');
+    unsigned int first = std::stoul(range.substr(0, dash));
+    unsigned int last = (dash == std::string::npos) ? first : std::stoul(range.substr(dash + 1));
+    if (first > last || last > 31) {
+      return false;
+    }
+    for (unsigned int i = first; i <= last; i++) {
+      sched.cpus |= 1u << i;
+    }
+  }
+  if (parts.size() == 3) {
+    if (parts[2] == "other") {
+      sched.policy = SCHED_OTHER;
+    } else if (parts[2] == "fifo") {
+      sched.policy = SCHED_FIFO;
+    } else if (parts[2] == "rr") {
+      sched.policy = SCHED_RR;
+    } else {
+      return false;
+    }
+  }
+  scheds[parts[0]] = sched;
+  return true;
+}
+
+// before start()
+void schedule(Base* stage, const std::string& name) {
+  auto it = scheds.find(name);
+  if (stage != nullptr && it != scheds.end()) {
+    stage->setPolicy(it->second.policy);
+    stage->setAffinity(it->second.cpus);
+  }
+}
+
+void pauseHandler(int s) {
+  pause_request = (s == SIGUSR1) ? 1 : 2;
+}
+
+// warm: models, encoders, devices and rtsp sessions stay up
+void pauseAll() {
+  for (auto& p : pipes) { p->cap->pause(); }
+  tfl->pause();
+  for (auto& p : pipes) {
+    if (p->trk) { p->trk->pause(); }
+    p->enc->pause();
+    if (p->sub) { p->sub->pause(); }
+    if (p->rec) { p->rec->pause(); }
+    if (p->wrt) { p->wrt->pause(); }
+  }
+}
+
+void resumeAll() {
+  for (auto& p : pipes) {
+    if (p->wrt) { p->wrt->run(); }
+    if (p->rec) { p->rec->run(); }
+    if (p->sub) { p->sub->run(); }
+    p->enc->run();
+    if (p->trk) { p->trk->run(); }
+  }
+  tfl->run();
+  for (auto& p : pipes) { p->cap->run(); }
+}
+
+void checkPause(bool quiet) {
+  int req = pause_request.exchange(0);
+  if (req != 0) {
+    MicroDiffer<uint32_t> differ;
+    differ.begin();
+    if (req == 1) {
+      pauseAll();
+    } else {
+      resumeAll();
+    }
+    differ.end();
+    if (!quiet) {
+      fprintf(stderr, "\n%s in %u usec\n", (req == 1) ? "paused" : "resumed", differ.avg);
+    }
+  }
+}
+
 int main(int argc, char** argv) {
 
   // defaults
@@ -95,10 +286,15 @@ int main(int argc, char** argv) {
   bool streaming = false;
   bool tpu = false;
   bool tracking = false;
+  bool yuv = false;
   std::string  unicast;
+  std::string  counters;
+  std::string  trajectory;
+  std::string  events;
+  std::string  triggers = "person";
   unsigned int yield_time = 1000;
   unsigned int testtime = 30;
-  unsigned int device = 0;
+  std::string  device = "0";
   unsigned int framerate = 20;
            int wdth = 640;
            int hght = 480;
@@ -108,18 +304,37 @@ int main(int argc, char** argv) {
   std::string  model;
   std::string  labels;
   std::string  output;
+  unsigned int seg_time = 0;
+  unsigned int seg_size = 0;
+  unsigned int sync_time = 0;
+  std::string  substream;
+  unsigned int sub_scale = 0;
+  unsigned int sub_bitrate = 0;
+  std::string  idle;
+  unsigned int idle_bitrate = 0;
+  unsigned int idle_framerate = 0;
+  std::string  batching;
+  unsigned int batch = 1;
+  unsigned int batch_wait = 0;
+  std::vector<std::string> affinity;
+  unsigned int deadline = 0;
 
   // cmd line options
   int c;
-  while((c = getopt(argc, argv, ":qrpku:t:d:f:w:h:b:y:e:s:m:l:o:")) != -1) {
+  while((c = getopt(argc, argv, ":qrpkic:j:v:g:u:t:d:f:w:h:b:y:e:s:m:l:o:x:z:n:a:B:N:A:W:")) != -1) {
     switch (c) {
       case 'q': quiet     = true;               break;
       case 'r': streaming = true;               break;
       case 'p': tpu       = true;               break;
       case 'k': tracking  = true;               break;
+      case 'i': yuv       = true;               break;
+      case 'c': counters  = optarg;             break;
+      case 'j': trajectory= optarg;             break;
+      case 'v': events    = optarg;             break;
+      case 'g': triggers  = optarg;             break;
       case 'u': unicast   = optarg;             break;
       case 't': testtime  = std::stoul(optarg); break;
-      case 'd': device    = std::stoul(optarg); break;
+      case 'd': device    = optarg;             break;
       case 'f': framerate = std::stoul(optarg); break;
       case 'w': wdth      = std::stoi(optarg);  break;
       case 'h': hght      = std::stoi(optarg);  break;
@@ -130,12 +345,102 @@ int main(int argc, char** argv) {
       case 'm': model     = optarg;             break;
       case 'l': labels    = optarg;             break;
       case 'o': output    = optarg;             break;
+      case 'x': seg_time  = std::stoul(optarg); break;
+      case 'z': seg_size  = std::stoul(optarg); break;
+      case 'n': sync_time = std::stoul(optarg); break;
+      case 'a': substream = optarg;             break;
+      case 'B': idle      = optarg;             break;
+      case 'N': batching  = optarg;             break;
+      case 'A': affinity.push_back(optarg);     break;
+      case 'W': deadline  = std::stoul(optarg); break;
 
       case '?':
       default:  usage(); return 0;
     }
   }
 
+  // idle bitrate and frame rate
+  if (!idle.empty()) {
+    size_t sep = idle.find(':');
+    idle_bitrate = std::stoul(idle.substr(0, sep));
+    idle_framerate = (sep == std::string::npos) ? framerate :
+      std::stoul(idle.substr(sep + 1));
+  }
+
+  // per stage cpus and policy
+  for (auto& arg : affinity) {
+    if (!parseSched(arg)) {
+      fprintf(stderr, "bad affinity: %s\n", arg.c_str());
+      usage();
+      return 1;
+    }
+  }
+
+  // frames per invoke and how long a partial batch waits
+  batch_wait = 500000 / std::max(framerate, 1u);
+  if (!batching.empty()) {
+    size_t sep = batching.find(':');
+    batch = std::max(std::stoul(batching.substr(0, sep)), 1ul);
+    if (sep != std::string::npos) {
+      batch_wait = std::stoul(batching.substr(sep + 1));
+    }
+  }
+
+  // substream scale and bitrate
+  if (!substream.empty()) {
+    size_t sep = substream.find(':');
+    sub_scale = std::stoul(substream.substr(0, sep));
+    sub_bitrate = (sep == std::string::npos) ? bitrate / 10 :
+      std::stoul(substream.substr(sep + 1));
+    if (sub_scale < 2 || sub_scale > 16 ||
+        (std::abs(wdth) / sub_scale) % 2 || (std::abs(hght) / sub_scale) % 2) {
+      fprintf(stderr, "bad substream scale: %u\n", sub_scale);
+      usage();
+      return 1;
+    }
+    if (!streaming) {
+      fprintf(stderr, "substream needs rtsp (-r)\n");
+      usage();
+      return 1;
+    }
+  }
+
+  // one pipeline per camera
+  std::vector<unsigned int> devices;
+  std::stringstream ds(device);
+  std::string num;
+  while (std::getline(ds, num, ',')) {
+    devices.push_back(std::stoul(num));
+  }
+  if (devices.empty()) {
+    fprintf(stderr, "no video device\n");
+    usage();
+    return 1;
+  }
+
+  // counting and trajectories need tracks
+  if (!counters.empty() || !trajectory.empty()) {
+    tracking = true;
+  }
+
+  // event classes
+  std::set<BoxBuf::Type> trigger_types;
+  std::stringstream ss(triggers);
+  std::string name;
+  while (std::getline(ss, name, ',')) {
+    if (name == "person") {
+      trigger_types.insert(BoxBuf::Type::kPerson);
+    } else if (name == "pet") {
+      trigger_types.insert(BoxBuf::Type::kPet);
+    } else if (name == "vehicle") {
+      trigger_types.insert(BoxBuf::Type::kVehicle);
+    } else {
+      fprintf(stderr, "unknown trigger class: %s\n", name.c_str());
+      usage();
+      return 1;
+    }
+  }
+
   // pick the model and labels
   if (model.empty()) {
     model = tpu ? "./models/edgetpu_detect.tflite" : "./models/detect.tflite";
@@ -151,6 +456,14 @@ int main(int argc, char** argv) {
   sig_int.sa_flags = 0;
   sigaction(SIGINT, &sig_int, NULL);
 
+  // pause/resume handlers
+  struct sigaction sig_usr;
+  sig_usr.sa_handler = pauseHandler;
+  sigemptyset(&sig_usr.sa_mask);
+  sig_usr.sa_flags = 0;
+  sigaction(SIGUSR1, &sig_usr, NULL);
+  sigaction(SIGUSR2, &sig_usr, NULL);
+
   // test setup report
   if (!quiet) {
     fprintf(stderr, "\nTest Setup...\n");
@@ -159,56 +472,186 @@ int main(int argc, char** argv) {
     } else {
       fprintf(stderr, "   test time: run until ctrl-c\n");
     }
-    fprintf(stderr, "      device: /dev/video%d\n", device);
+    for (unsigned int i = 0; i < devices.size(); i++) {
+      fprintf(stderr, "      device: /dev/video%u\n", devices[i]);
+    }
     fprintf(stderr, "        rtsp: %s\n", streaming ? "yes" : "no");
     if (streaming) {
       fprintf(stderr, "rstp address: %s\n", unicast.empty() ? "multicast" : unicast.c_str());
     }
+    if (sub_scale != 0) {
+      fprintf(stderr, "   substream: %dx%d pix %u bps\n", std::abs(wdth) / sub_scale,
+          std::abs(hght) / sub_scale, sub_bitrate);
+    }
     fprintf(stderr, "   framerate: %d fps\n", framerate);
     fprintf(stderr, "       width: %d pix %s\n", std::abs(wdth), (wdth < 0) ? "(flipped)" : "" );
     fprintf(stderr, "      height: %d pix %s\n", std::abs(hght), (hght < 0) ? "(flipped)" : "" );
+    fprintf(stderr, "      format: %s\n", yuv ? "yuv420" : "rgb24");
     fprintf(stderr, "     bitrate: %d bps\n", bitrate);
+    if (idle_bitrate != 0) {
+      fprintf(stderr, "   idle rate: %u bps %u fps\n", idle_bitrate, idle_framerate);
+    }
     fprintf(stderr, "  yield time: %d usec\n", yield_time);
     fprintf(stderr, "     threads: %d\n", threads);
     fprintf(stderr, "   threshold: %f\n", threshold);
+    if (batch > 1) {
+      fprintf(stderr, "       batch: %u frames, wait %u usec\n", batch, batch_wait);
+    }
+    for (auto& arg : affinity) {
+      fprintf(stderr, "    affinity: %s\n", arg.c_str());
+    }
+    if (deadline != 0) {
+      fprintf(stderr, "    watchdog: %u msec\n", deadline);
+    }
     fprintf(stderr, "     use tpu: %s\n", tpu ? "yes" : "no");
     fprintf(stderr, "    tracking: %s\n", tracking ? "yes" : "no");
+    fprintf(stderr, "    counters: %s\n", counters.empty() ? "none" : counters.c_str());
+    fprintf(stderr, "  trajectory: %s\n", trajectory.empty() ? "none" : trajectory.c_str());
+    fprintf(stderr, "      events: %s\n", events.empty() ? "none" : events.c_str());
+    if (!events.empty()) {
+      fprintf(stderr, "    triggers: %s\n", triggers.c_str());
+    }
     fprintf(stderr, "       model: %s\n", model.c_str());
     fprintf(stderr, "      lables: %s\n", labels.c_str());
-    fprintf(stderr, "      output: %s\n\n", (testtime == 0) ? "none" : output.c_str());
+    fprintf(stderr, "      output: %s\n", (testtime == 0) ? "none" : output.c_str());
+    if (seg_time != 0 || seg_size != 0) {
+      fprintf(stderr, "    segments: %u sec %u MB\n", seg_time, seg_size);
+    }
+    if (sync_time != 0) {
+      fprintf(stderr, "       fsync: every %u sec\n", sync_time);
+    }
+    fprintf(stderr, "\n");
     fprintf(stderr, "         pid: top -H -p %d\n\n", getpid());
   }
 
   // create worker threads
   if (streaming) { 
-    rtsp = Rtsp::create(yield_time, quiet, bitrate, framerate, unicast); 
+    srv = RtspServer::create(yield_time, quiet, unicast, 8554);
+  }
+  tfl = Tflow::create(2*yield_time, quiet, std::abs(wdth), std::abs(hght),
+      model.c_str(), labels.c_str(), threads, threshold, tpu, batch, batch_wait);
+  for (unsigned int i = 0; i < devices.size(); i++) {
+    auto p = std::make_unique<Pipeline>();
+    std::string session = cameraName("camera", i);
+    unsigned short rtp_port = 18888 + 4 * i;
+    if (streaming) { 
+      p->rtsp = Rtsp::create(yield_time, quiet, bitrate, framerate, srv.get(),
+          session, rtp_port); 
+    }
+    if (sub_scale != 0) {
+      p->subrtsp = Rtsp::create(yield_time, quiet, sub_bitrate, framerate, srv.get(),
+          session + "_sub", rtp_port + 2);
+      p->sub = Encoder::create(yield_time, quiet, tracking, p->subrtsp.get(), nullptr, nullptr,
+          nullptr, framerate, std::abs(wdth), std::abs(hght), sub_scale, yuv, sub_bitrate,
+          static_cast<uint64_t>(sub_bitrate) * idle_bitrate / bitrate, idle_framerate);
+    }
+    if (!events.empty()) {
+      p->rec = Recorder::create(yield_time, quiet, cameraName(events, i), trigger_types,
+          bitrate, 5, 10);
+    }
+    if (testtime != 0 && !output.empty()) {
+      p->wrt = Writer::create(yield_time, quiet, cameraName(output, i), seg_time,
+          seg_size * 1024 * 1024, sync_time);
+    }
+    p->enc = Encoder::create(yield_time, quiet, tracking, p->rtsp.get(), p->rec.get(),
+        p->wrt.get(), p->sub.get(), framerate, std::abs(wdth), std::abs(hght), 1, yuv,
+        bitrate, idle_bitrate, idle_framerate);
+    if (streaming) {
+      p->rtsp->keyFrames(p->enc.get());
+    }
+    if (p->sub) {
+      p->subrtsp->keyFrames(p->sub.get());
+    }
+    if (!counters.empty()) {
+      p->ctr = Counter::create(counters);
+      if (!p->ctr) {
+        return 1;
+      }
+    }
+    if (tracking) {
+      double dist = std::sqrt(std::pow(wdth, 2) + std::pow(hght, 2)) / 5.0;
+      p->trk = Tracker::create(yield_time, quiet, p->enc.get(), p->ctr.get(), 
+          trajectory.empty() ? trajectory : cameraName(trajectory, i), dist, 2000);
+    }
+    unsigned int camera = tfl->addCamera(p->enc.get(), p->trk.get(), p->rec.get());
+    p->cap = Capturer::create(yield_time, quiet, p->enc.get(), tfl.get(), camera,
+        devices[i], framerate, wdth, hght, yuv);
+    pipes.push_back(std::move(p));
   }
-  enc = Encoder::create(yield_time, quiet, tracking, rtsp.get(), framerate, 
-      std::abs(wdth), std::abs(hght), bitrate, output, testtime);
-  if (tracking) {
-    double dist = std::sqrt(std::pow(wdth, 2) + std::pow(hght, 2)) / 5.0;
-    trk = Tracker::create(yield_time, quiet, enc.get(), dist, 2000);
+
+  // looks at every stage a few times per deadline
+  if (deadline != 0) {
+    wdg = Watchdog::create(std::min(deadline * 1000 / 4, 100000u), quiet, deadline);
+    wdg->watch(srv.get());
+    for (auto& p : pipes) {
+      wdg->watch(p->rtsp.get());
+      wdg->watch(p->subrtsp.get());
+      wdg->watch(p->rec.get());
+      wdg->watch(p->wrt.get());
+      wdg->watch(p->sub.get());
+      wdg->watch(p->enc.get());
+      wdg->watch(p->trk.get());
+    }
+    wdg->watch(tfl.get());
+    for (auto& p : pipes) {
+      wdg->watch(p->cap.get());
+    }
   }
-  tfl = Tflow::create(2*yield_time, quiet, enc.get(), trk.get(), std::abs(wdth), 
-      std::abs(hght), model.c_str(), labels.c_str(), threads, threshold, tpu);
-  cap = Capturer::create(yield_time, quiet, enc.get(), tfl.get(), 
-      device, framerate, wdth, hght);
 
-  // start
+  // start, the rtsp server has to be up before its sessions
   dbgMsg("start\n");
-  if (streaming) { rtsp->start("rtsp", 90); }
-  enc->start("enc", 50);
-  if (tracking) { trk->start("trk", 20); }
+  if (streaming) {
+    schedule(srv.get(), "rtsp");
+    srv->start("srv", 90);
+    srv->run();
+  }
+  for (unsigned int i = 0; i < pipes.size(); i++) {
+    Pipeline& p = *pipes[i];
+    schedule(p.rtsp.get(), "rtsp");
+    schedule(p.subrtsp.get(), "rtsp");
+    schedule(p.rec.get(), "rec");
+    schedule(p.wrt.get(), "wrt");
+    schedule(p.sub.get(), "sub");
+    schedule(p.enc.get(), "enc");
+    schedule(p.trk.get(), "trk");
+    schedule(p.cap.get(), "cap");
+    if (p.rtsp) { p.rtsp->start(cameraName("rtsp", i).c_str(), 90); }
+    if (p.subrtsp) { p.subrtsp->start(cameraName("subrtsp", i).c_str(), 80); }
+    if (p.rec) { p.rec->start(cameraName("rec", i).c_str(), 10); }
+    if (p.wrt) { p.wrt->start(cameraName("wrt", i).c_str(), 10); }
+    if (p.sub) { p.sub->start(cameraName("sub", i).c_str(), 40); }
+    p.enc->start(cameraName("enc", i).c_str(), 50);
+    if (p.trk) { p.trk->start(cameraName("trk", i).c_str(), 20); }
+  }
+  schedule(tfl.get(), "tfl");
+  auto it = scheds.find("tflw");
+  if (it != scheds.end()) {
+    tfl->workers(it->second.policy, it->second.cpus);
+  }
   tfl->start("tfl", 20);
-  cap->start("cap", 90);
+  for (unsigned int i = 0; i < pipes.size(); i++) {
+    pipes[i]->cap->start(cameraName("cap", i).c_str(), 90);
+  }
 
   // run
   dbgMsg("run\n");
-  if (streaming) { rtsp->run(); }
-  enc->run();
-  if (tracking) { trk->run(); }
+  for (auto& p : pipes) {
+    if (p->rtsp) { p->rtsp->run(); }
+    if (p->subrtsp) { p->subrtsp->run(); }
+    if (p->rec) { p->rec->run(); }
+    if (p->wrt) { p->wrt->run(); }
+    if (p->sub) { p->sub->run(); }
+    p->enc->run();
+    if (p->trk) { p->trk->run(); }
+  }
   tfl->run();
-  cap->run();
+  for (auto& p : pipes) {
+    p->cap->run();
+  }
+  if (wdg) {
+    wdg->start("wdg", 95);
+    wdg->run();
+  }
 
   // run test
   if (!quiet) { fprintf(stderr, "\n\n"); }
@@ -216,6 +659,7 @@ int main(int argc, char** argv) {
     for (unsigned int i = 0; i < testtime * 5; i++) {
       if (!quiet) { fprintf(stderr, "."); fflush(stdout); }
       std::this_thread::sleep_for(std::chrono::milliseconds(200));
+      checkPause(quiet);
     }
   } else {          // run forever...
     if (!quiet) {
@@ -224,24 +668,17 @@ int main(int argc, char** argv) {
     while (1) {
       if (!quiet) { fprintf(stderr, "."); fflush(stdout); }
       std::this_thread::sleep_for(std::chrono::milliseconds(200));
+      checkPause(quiet);
     }
   }
   if (!quiet) { fprintf(stderr, "\n\n"); }
 
   // stop
   dbgMsg("stop\n");
-  cap->stop();
-  tfl->stop();
-  if (tracking) { trk->stop(); }
-  enc->stop();
-  if (streaming) { rtsp->stop(); }
+  stopAll();
 
   // destroy
-  cap.reset(nullptr);
-  tfl.reset(nullptr);
-  trk.reset(nullptr);
-  enc.reset(nullptr);
-  rtsp.reset(nullptr);
+  destroyAll();
 
   // done
   dbgMsg("done\n");
@@ -33,6 +33,27 @@ namespace detector {
   (a).nVersion.s.nRevision = OMX_VERSION_REVISION; \
   (a).nVersion.s.nStep = OMX_VERSION_STEP
 
+// buffer time stamps are steady clock microseconds
+static inline void toTicks(OMX_TICKS& ticks, std::chrono::steady_clock::time_point tp) {
+  uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+      tp.time_since_epoch()).count();
+#ifdef OMX_SKIP64BIT
+  ticks.nLowPart = us & 0xffffffff;
+  ticks.nHighPart = us >> 32;
+#else
+  ticks = us;
+#endif
+}
+
+static inline std::chrono::steady_clock::time_point fromTicks(const OMX_TICKS& ticks) {
+#ifdef OMX_SKIP64BIT
+  uint64_t us = (static_cast<uint64_t>(ticks.nHighPart) << 32) | ticks.nLowPart;
+#else
+  uint64_t us = ticks;
+#endif
+  return std::chrono::steady_clock::time_point(std::chrono::microseconds(us));
+}
+
 Encoder::Encoder(unsigned int yield_time)
   : Base(yield_time) {
 }
@@ -41,30 +62,57 @@ Encoder::~Encoder() {
 }
 
 std::unique_ptr<Encoder> Encoder::create(unsigned int yield_time, bool quiet, bool tracking, 
-    Rtsp* rtsp, unsigned int framerate, unsigned int width, unsigned int height, 
-    unsigned int bitrate, std::string& output, unsigned int testtime) {
+    Listener<NalBuf>* rtsp, Listener<NalBuf>* rec, Listener<NalBuf>* wrt, Encoder* sub,
+    unsigned int framerate, unsigned int width, unsigned int height, unsigned int scale,
+    bool yuv, unsigned int bitrate, unsigned int idle_bitrate, unsigned int idle_framerate) {
   auto obj = std::unique_ptr<Encoder>(new Encoder(yield_time));
-  obj->init(quiet, tracking, rtsp, framerate, width, height, bitrate, output, testtime);
+  obj->init(quiet, tracking, rtsp, rec, wrt, sub, framerate, width, height, scale,
+      yuv, bitrate, idle_bitrate, idle_framerate);
   return obj;
 }
 
-bool Encoder::init(bool quiet, bool tracking, Rtsp* rtsp, unsigned int framerate, 
-    unsigned int width, unsigned int height, unsigned int bitrate, 
-    std::string& output, unsigned int testtime) {
+bool Encoder::init(bool quiet, bool tracking, Listener<NalBuf>* rtsp, Listener<NalBuf>* rec,
+    Listener<NalBuf>* wrt, Encoder* sub, unsigned int framerate, unsigned int width,
+    unsigned int height, unsigned int scale, bool yuv, unsigned int bitrate,
+    unsigned int idle_bitrate, unsigned int idle_framerate) {
 
   quiet_ = quiet;
   tracking_ = tracking;
   rtsp_ = rtsp;
+  rec_ = rec;
+  wrt_ = wrt;
+  sub_ = sub;
   framerate_ = framerate;
-  width_ = width;
-  height_ = height;
-  frame_len_ = ALIGN_16B(width_) * ALIGN_16B(height_) * channels_;
+  src_width_ = width;
+  src_height_ = height;
+  scale_ = std::max(scale, 1u);
+  width_ = src_width_ / scale_;
+  height_ = src_height_ / scale_;
+  yuv_ = yuv;
+  if (yuv_) {
+    src_len_ = ALIGN_16B(src_width_) * ALIGN_16B(src_height_) * 3 / 2;
+    frame_len_ = ALIGN_16B(width_) * ALIGN_16B(height_) * 3 / 2;
+  } else {
+    src_len_ = ALIGN_16B(src_width_) * ALIGN_16B(src_height_) * channels_;
+    frame_len_ = ALIGN_16B(width_) * ALIGN_16B(height_) * channels_;
+  }
 
   bitrate_ = bitrate;
-  output_ = output;
-  testtime_ = testtime;
 
-  fd_enc_ = nullptr;
+  idle_bitrate_ = idle_bitrate;
+  idle_framerate_ = std::min(std::max(idle_framerate, 1u), framerate_);
+  idle_ = false;
+  idle_acc_ = 0;
+  idle_total_ = std::chrono::microseconds(0);
+  rate_changes_ = 0;
+  frames_skipped_ = 0;
+
+  idr_request_ = 0;
+  idr_pending_ = 0;
+  idr_requests_ = 0;
+
+  omx_in_busy_ = 0;
+  omx_in_flight_ = 0;
 
   encode_on_ = false;
 
@@ -73,6 +121,13 @@ bool Encoder::init(bool quiet, bool tracking, Rtsp* rtsp, unsigned int framerate
 
 bool Encoder::addMessage(FrameBuf& fbuf) {
 
+  // the substream holds its own reference to the same capture buffer
+  if (sub_) {
+    if (!sub_->addMessage(fbuf)) {
+      dbgMsg("warning: substream is busy\n");
+    }
+  }
+
   std::unique_lock<std::timed_mutex> lck(frame_lock_, std::defer_lock);
 
   if (!lck.try_lock_for(std::chrono::microseconds(Listener<FrameBuf>::timeout_))) {
@@ -80,30 +135,33 @@ bool Encoder::addMessage(FrameBuf& fbuf) {
     return false;
   }
 
-  if (frame_pool_.size() == 0) {
-    dbgMsg("no encoder buffers available\n");
+  if (!encode_on_) {
     return false;
   }
 
-  if (frame_len_ != fbuf.length) {
+  if (src_len_ != fbuf.length ||
+      fbuf.format != (yuv_ ? V4L2_PIX_FMT_YUV420 : V4L2_PIX_FMT_RGB24)) {
     dbgMsg("encoder buffer size mismatch\n");
     return false;
   }
 
-  differ_copy_.begin();
-  auto frame = frame_pool_.front();
-  frame_pool_.pop();
-  frame->id = fbuf.id;
-  frame->length = fbuf.length;
-  std::memcpy(frame->buf.data(), fbuf.addr, fbuf.length);
-  frame_work_.push(frame);
-  differ_copy_.end();
+  if (frame_work_.size() >= frame_num_) {
+    dbgMsg("no encoder buffers available\n");
+    return false;
+  }
+
+  // just hold on to the frame, the copy happens on the encoder thread
+  frame_work_.push(fbuf);
 
   return true;
 }
 
 bool Encoder::addMessage(std::shared_ptr<std::vector<BoxBuf>>& targets) {
 
+  if (sub_) {
+    sub_->addMessage(targets);
+  }
+
   std::unique_lock<std::timed_mutex> lck(targets_lock_, std::defer_lock);
 
   if (!lck.try_lock_for(
@@ -119,6 +177,10 @@ bool Encoder::addMessage(std::shared_ptr<std::vector<BoxBuf>>& targets) {
 
 bool Encoder::addMessage(std::shared_ptr<std::vector<TrackBuf>>& tracks) {
 
+  if (sub_) {
+    sub_->addMessage(tracks);
+  }
+
   std::unique_lock<std::timed_mutex> lck(tracks_lock_, std::defer_lock);
 
   if (!lck.try_lock_for(
@@ -132,6 +194,13 @@ bool Encoder::addMessage(std::shared_ptr<std::vector<TrackBuf>>& tracks) {
   return true;
 }
 
+void Encoder::requestKeyFrame() {
+  int64_t none = 0;
+  int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  idr_request_.compare_exchange_strong(none, now);
+}
+
 #ifdef OUTPUT_VARIOUS_BITS_OF_INFO
 void Encoder::printDef(OMX_PARAM_PORTDEFINITIONTYPE def) {
   const char* dir;
@@ -179,14 +248,17 @@ OMX_ERRORTYPE Encoder::eventHandler(OMX_HANDLETYPE hnd, OMX_PTR self,
 OMX_ERRORTYPE Encoder::emptyHandler(OMX_HANDLETYPE hnd, OMX_PTR self,
     OMX_BUFFERHEADERTYPE* buf) {
   Encoder* enc = static_cast<Encoder*>(self);
-  enc->omx_encode_sem_.post();
+  std::unique_lock<std::mutex> lck(enc->omx_lock_);
+  enc->omx_in_free_.push(buf);
+  enc->omx_in_busy_--;
   return OMX_ErrorNone;
 }
 
 OMX_ERRORTYPE Encoder::fillHandler(OMX_HANDLETYPE hnd, OMX_PTR self,
     OMX_BUFFERHEADERTYPE* buf) {
   Encoder* enc = static_cast<Encoder*>(self);
-  enc->omx_encode_sem_.post();
+  std::unique_lock<std::mutex> lck(enc->omx_lock_);
+  enc->omx_out_done_.push(buf);
   return OMX_ErrorNone;
 }
 
@@ -222,24 +294,6 @@ bool Encoder::waitingToRun() {
 
   if (!encode_on_) {
 
-    // create encoded file
-    if (testtime_ != 0) {
-      dbgMsg("create output file\n");
-      if (!output_.empty()) {
-        fd_enc_ = fopen(output_.c_str(), "wb");
-        if (fd_enc_ == nullptr) {
-          dbgMsg("failed: create outputfile\n");
-          return false;
-        }
-      }
-    }
-
-    // create frame pool
-    dbgMsg("create frame pool\n");
-    for (unsigned int i = 0; i < frame_num_; i++) {
-      frame_pool_.push(std::shared_ptr<Encoder::Frame>(new Encoder::Frame(frame_len_)));
-    }
-
     // init bcm
     dbgMsg("int bcm\n");
     bcm_host_init();
@@ -307,7 +361,9 @@ bool Encoder::waitingToRun() {
     port_def.format.video.xFramerate = framerate_ << 16;
     port_def.format.video.nSliceHeight = ALIGN_16B(port_def.format.video.nFrameHeight);
     port_def.format.video.nStride = ALIGN_16B(port_def.format.video.nFrameWidth);
-    port_def.format.video.eColorFormat = OMX_COLOR_Format24bitBGR888;
+    port_def.format.video.eColorFormat = yuv_ ? 
+      OMX_COLOR_FormatYUV420PackedPlanar : OMX_COLOR_Format24bitBGR888;
+    port_def.nBufferCountActual = std::max<OMX_U32>(port_def.nBufferCountMin, omx_buf_num_);
     err = OMX_SetParameter(omx_hnd_, OMX_IndexParamPortDefinition, &port_def);
     if (err != OMX_ErrorNone) {
       dbgMsg("failed: set omx paramter port 200\n");
@@ -352,6 +408,22 @@ bool Encoder::waitingToRun() {
     }
     dbgMsg("current bitrate:%u\n", bitrate_type.nTargetBitrate);
 
+    // set output buffer count port 201
+    dbgMsg("set output buffer count port 201\n");
+    OMX_INIT_STRUCTURE(port_def);
+    port_def.nPortIndex = 201;
+    err = OMX_GetParameter(omx_hnd_, OMX_IndexParamPortDefinition, &port_def);
+    if (err != OMX_ErrorNone) {
+      dbgMsg("failed: get omx paramter port 201\n");
+      return false;
+    }
+    port_def.nBufferCountActual = std::max<OMX_U32>(port_def.nBufferCountMin, omx_buf_num_);
+    err = OMX_SetParameter(omx_hnd_, OMX_IndexParamPortDefinition, &port_def);
+    if (err != OMX_ErrorNone) {
+      dbgMsg("failed: set omx paramter port 201\n");
+      return false;
+    }
+
     // idle omx
     dbgMsg("idle omx\n");
     err = OMX_SendCommand(omx_hnd_, OMX_CommandStateSet, OMX_StateIdle, NULL);
@@ -378,32 +450,19 @@ bool Encoder::waitingToRun() {
 
     // allocate buffers
     dbgMsg("allocate buffers\n");
-    OMX_INIT_STRUCTURE(port_def);
-    port_def.nPortIndex = 200;
-    err = OMX_GetParameter(omx_hnd_, OMX_IndexParamPortDefinition, &port_def);
-    if (err != OMX_ErrorNone) {
-      dbgMsg("failed: allocate port 200 buffers get param\n");
-      return false;
-    }
-    dbgMsg("port 200 allocate size: %d\n", port_def.nBufferSize);
-    err = OMX_AllocateBuffer(omx_hnd_, &omx_buf_in_, 200, NULL, port_def.nBufferSize);
-    if (err != OMX_ErrorNone) {
-      dbgMsg("failed: allocate port 200 buffers\n");
+    if (!allocateBuffers(200, omx_bufs_in_)) {
       return false;
     }
-    OMX_INIT_STRUCTURE(port_def);
-    port_def.nPortIndex = 201;
-    err = OMX_GetParameter(omx_hnd_, OMX_IndexParamPortDefinition, &port_def);
-    if (err != OMX_ErrorNone) {
-      dbgMsg("failed: allocate port 201 buffers get param\n");
+    if (!allocateBuffers(201, omx_bufs_out_)) {
       return false;
     }
-    dbgMsg("port 201 allocate size: %d\n", port_def.nBufferSize);
-    err = OMX_AllocateBuffer(omx_hnd_, &omx_buf_out_, 201, NULL, port_def.nBufferSize);
-    if (err != OMX_ErrorNone) {
-      dbgMsg("failed: allocate port 201 buffers\n");
+    if (omx_bufs_in_[0]->nAllocLen < frame_len_) {
+      dbgMsg("failed: input buffers too small: %u < %u\n", 
+          omx_bufs_in_[0]->nAllocLen, frame_len_);
       return false;
     }
+    std::for_each(omx_bufs_in_.begin(), omx_bufs_in_.end(),
+        [&](OMX_BUFFERHEADERTYPE* buf) { omx_in_free_.push(buf); });
 
     // execute omx
     dbgMsg("execute omx\n");
@@ -414,6 +473,21 @@ bool Encoder::waitingToRun() {
     }
     blockOnStateChange(OMX_StateExecuting);
 
+    // hand all the output buffers to the encoder
+    dbgMsg("prime output buffers\n");
+    for (auto buf : omx_bufs_out_) {
+      buf->nFilledLen = 0;
+      err = OMX_FillThisBuffer(omx_hnd_, buf);
+      if (err != OMX_ErrorNone) {
+        dbgMsg("failed: omx fill buffer\n");
+        return false;
+      }
+    }
+
+    active_stamp_ = std::chrono::steady_clock::now();
+    idle_ = false;
+    nal_carry_.clear();
+
     differ_tot_.begin();
     encode_on_ = true;
   }
@@ -421,95 +495,380 @@ bool Encoder::waitingToRun() {
   return true;
 }
 
-void Encoder::overlay(std::shared_ptr<Encoder::Frame>& frame) {
+bool Encoder::allocateBuffers(OMX_U32 port, std::vector<OMX_BUFFERHEADERTYPE*>& bufs) {
 
-  // targets
-  {
+  OMX_PARAM_PORTDEFINITIONTYPE port_def;
+  OMX_INIT_STRUCTURE(port_def);
+  port_def.nPortIndex = port;
+  OMX_ERRORTYPE err = OMX_GetParameter(omx_hnd_, OMX_IndexParamPortDefinition, &port_def);
+  if (err != OMX_ErrorNone) {
+    dbgMsg("failed: allocate port %u buffers get param\n", port);
+    return false;
+  }
+
+  dbgMsg("port %u allocate %u x size: %d\n", 
+      port, port_def.nBufferCountActual, port_def.nBufferSize);
+  for (unsigned int i = 0; i < port_def.nBufferCountActual; i++) {
+    OMX_BUFFERHEADERTYPE* buf;
+    err = OMX_AllocateBuffer(omx_hnd_, &buf, port, NULL, port_def.nBufferSize);
+    if (err != OMX_ErrorNone) {
+      dbgMsg("failed: allocate port %u buffers\n", port);
+      return false;
+    }
+    bufs.push_back(buf);
+  }
+
+  return true;
+}
+
+void Encoder::overlay(unsigned char* data) {
+
+  // take a reference under the lock and draw without it (the 
+  // senders never touch a vector once it has been posted)
+  std::shared_ptr<std::vector<BoxBuf>> targets;
+  std::shared_ptr<std::vector<TrackBuf>> tracks;
+  if (!tracking_) {
     std::unique_lock<std::timed_mutex> lck(targets_lock_);
-    if (!tracking_) {
-      if (targets_ != nullptr) {
-        if (targets_->size() != 0) {
-          drawBoxes<std::shared_ptr<std::vector<BoxBuf>>>(
-              false, thickness_, width_, height_, frame->buf.data(), targets_);
-        }
-      }
+    targets = targets_;
+  } else {
+    std::unique_lock<std::timed_mutex> lck(tracks_lock_);
+    tracks = tracks_;
+  }
+
+  // lines stay thin on a substream, but yuv chroma is drawn at half
+  // the thickness and would vanish (with the class colour) below 2
+  unsigned int thickness = std::max(thickness_ / scale_, yuv_ ? 2u : 1u);
+
+  // targets
+  if (targets != nullptr) {
+    if (targets->size() != 0) {
+      drawBoxes<std::shared_ptr<std::vector<BoxBuf>>>(
+          false, thickness, width_, height_, data, targets);
     }
   }
 
   // tracks
+  if (tracks != nullptr) {
+    if (tracks->size() != 0) {
+      drawBoxes<std::shared_ptr<std::vector<TrackBuf>>>(
+          true, thickness, width_, height_, data, tracks);
+    }
+  }
+}
+
+bool Encoder::active() {
   {
-    std::unique_lock<std::timed_mutex> lck(tracks_lock_);
-    if (tracking_) {
-      if (tracks_ != nullptr) {
-        if (tracks_->size() != 0) {
-          drawBoxes<std::shared_ptr<std::vector<TrackBuf>>>(
-              true, thickness_, width_, height_, frame->buf.data(), tracks_);
-        }
-      }
+    std::unique_lock<std::timed_mutex> lck(targets_lock_);
+    if (targets_ != nullptr && targets_->size() != 0) {
+      return true;
     }
   }
+  std::unique_lock<std::timed_mutex> lck(tracks_lock_);
+  return tracks_ != nullptr && tracks_->size() != 0;
 }
 
-bool Encoder::running() {
+// runtime rate change, the component keeps running
+bool Encoder::setRate(unsigned int bitrate, unsigned int framerate) {
 
-  if (encode_on_) {
+  OMX_VIDEO_CONFIG_BITRATETYPE bitrate_type;
+  OMX_INIT_STRUCTURE(bitrate_type);
+  bitrate_type.nPortIndex = 201;
+  bitrate_type.nEncodeBitrate = bitrate;
+  OMX_ERRORTYPE err = OMX_SetConfig(omx_hnd_, OMX_IndexConfigVideoBitrate, &bitrate_type);
+  if (err != OMX_ErrorNone) {
+    dbgMsg("failed: set bitrate config: 0x%x\n", err);
+    return false;
+  }
+
+  OMX_CONFIG_FRAMERATETYPE framerate_type;
+  OMX_INIT_STRUCTURE(framerate_type);
+  framerate_type.nPortIndex = 201;
+  framerate_type.xEncodeFramerate = framerate << 16;
+  err = OMX_SetConfig(omx_hnd_, OMX_IndexConfigVideoFramerate, &framerate_type);
+  if (err != OMX_ErrorNone) {
+    dbgMsg("failed: set framerate config: 0x%x\n", err);
+    return false;
+  }
+
+  rate_changes_++;
+  return true;
+}
+
+// go idle after idle_hold_ without targets, active on the first one
+bool Encoder::skipFrame() {
+
+  auto now = std::chrono::steady_clock::now();
+  if (active()) {
+    active_stamp_ = now;
+  }
+  bool idle = (now - active_stamp_ > idle_hold_);
+  if (idle != idle_) {
+    if (idle) {
+      setRate(idle_bitrate_, idle_framerate_);
+      idle_stamp_ = now;
+      idle_acc_ = 0;
+    } else {
+      setRate(bitrate_, framerate_);
+      idle_total_ += std::chrono::duration_cast<std::chrono::microseconds>(now - idle_stamp_);
+    }
+    idle_ = idle;
+  }
+  if (!idle_) {
+    return false;
+  }
+
+  // keep idle_framerate_ of every framerate_ frames
+  idle_acc_ += idle_framerate_;
+  if (idle_acc_ >= framerate_) {
+    idle_acc_ -= framerate_;
+    return false;
+  }
+  frames_skipped_++;
+  return true;
+}
+
+bool Encoder::submitFrames() {
+
+  // feed frames while the encoder has free input buffers
+  while (true) {
+    OMX_BUFFERHEADERTYPE* buf = nullptr;
+    {
+      std::unique_lock<std::mutex> omx_lck(omx_lock_);
+      if (omx_in_free_.size() == 0) {
+        break;
+      }
+      buf = omx_in_free_.front();
+    }
+
+    // the locks only cover the queue, not the copy
+    FrameBuf fbuf;
     {
       std::unique_lock<std::timed_mutex> lck(frame_lock_);
+      if (frame_work_.size() == 0) {
+        break;
+      }
+      fbuf = frame_work_.front();
+      frame_work_.pop();
+    }
+    if (idle_bitrate_ != 0 && skipFrame()) {
+      continue;
+    }
+    {
+      std::unique_lock<std::mutex> omx_lck(omx_lock_);
+      omx_in_free_.pop();
+      omx_in_busy_++;
+      omx_in_flight_ = std::max(omx_in_flight_, omx_in_busy_);
+    }
 
-      // a frame is ready
-      if (frame_work_.size() != 0) {
-        auto frame = frame_work_.front();
+    // copy (or scale) straight into the omx input buffer and 
+    // let the capture buffer go as soon as we are done with it
+    phase("copy");
+    differ_copy_.begin();
+    if (scale_ > 1) {
+      if (yuv_) {
+        scale_yuv420_box(fbuf.addr, src_width_, src_height_, buf->pBuffer, scale_);
+      } else {
+        scale_rgb24_box(fbuf.addr, src_width_, src_height_, buf->pBuffer, scale_);
+      }
+    } else {
+      std::memcpy(buf->pBuffer, fbuf.addr, fbuf.length);
+    }
+    buf->nOffset = 0;
+    buf->nFilledLen = frame_len_;
+    fbuf.ref.reset();
+    differ_copy_.end();
+
+    // overlay target boxes in place
+    differ_submit_.begin();
+    overlay(buf->pBuffer);
+    buf->nFlags = OMX_BUFFERFLAG_ENDOFFRAME;
+    // the capture time rides through the encoder as the pts
+    auto now = std::chrono::steady_clock::now();
+    toTicks(buf->nTimeStamp, 
+        fbuf.stamp.time_since_epoch().count() != 0 ? fbuf.stamp : now);
+    frame_ids_.push(fbuf.id);
+    frame_submits_.push(now);
+    differ_submit_.end();
+
+    // the next frame becomes an idr
+    if (idr_pending_ == 0 && idr_request_ != 0) {
+      OMX_CONFIG_PORTBOOLEANTYPE idr;
+      OMX_INIT_STRUCTURE(idr);
+      idr.nPortIndex = 201;
+      idr.bEnabled = OMX_TRUE;
+      if (OMX_SetConfig(omx_hnd_, OMX_IndexConfigBrcmVideoRequestIFrame, &idr) == OMX_ErrorNone) {
+        idr_pending_ = idr_request_.exchange(0);
+        idr_requests_++;
+      } else {
+        dbgMsg("failed: request idr\n");
+        idr_request_ = 0;
+      }
+    }
 
-        // overlay target boxes
-        overlay(frame);
+    phase("empty");
+    OMX_ERRORTYPE err = OMX_EmptyThisBuffer(omx_hnd_, buf);
+    if (err != OMX_ErrorNone) {
+      dbgMsg("failed: omx empty buffer\n");
+      return false;
+    }
+  }
 
-        // fill the input buffer
-        std::memcpy(omx_buf_in_->pBuffer, frame->buf.data(), frame->length);
-        omx_buf_in_->nOffset = 0;
-        omx_buf_in_->nFilledLen = frame->length;
+  return true;
+}
 
-        // return the frame to the queue
-        frame_work_.pop();
-        frame_pool_.push(frame);
+bool Encoder::streamNals(NalBuf& chunk) {
+
+  bool res = true;
+  auto send = [&](const unsigned char* addr, unsigned int len) {
+    NalBuf unit(len, const_cast<unsigned char*>(addr), chunk.flags, chunk.stamp, chunk.id);
+    res = rtsp_->addMessage(unit) && res;
+  };
+
+  // the bytes ahead of the first start code finish the carried nal
+  H264::split(chunk.addr, chunk.length, nal_units_);
+  if (nal_carry_.size() != 0) {
+    const unsigned char* end = chunk.addr + chunk.length;
+    if (nal_units_.size() != 0) {
+      end = nal_units_[0].first - 3;
+      while (end > chunk.addr && end[-1] == 0) {
+        end--;
+      }
+    }
+    nal_carry_.insert(nal_carry_.end(), static_cast<const unsigned char*>(chunk.addr), end);
+    if (nal_units_.size() == 0 && !(chunk.flags & (NalBuf::kEndOfFrame | NalBuf::kConfig))) {
+      return true;
+    }
+    send(nal_carry_.data(), nal_carry_.size());
+    nal_carry_.clear();
+  }
 
-        // let capture fill another buffer while we wait
-        lck.unlock();
+  // the last nal is only whole at the end of a frame
+  for (unsigned int i = 0; i < nal_units_.size(); i++) {
+    auto& nal = nal_units_[i];
+    if (nal.second == 0) {
+      continue;
+    }
+    if (i + 1 == nal_units_.size() &&
+        !(chunk.flags & (NalBuf::kEndOfFrame | NalBuf::kConfig))) {
+      nal_carry_.assign(nal.first, nal.first + nal.second);
+      break;
+    }
+    send(nal.first, nal.second);
+  }
 
-        // start encoding...
-        differ_encode_.begin();
-        OMX_ERRORTYPE err = OMX_EmptyThisBuffer(omx_hnd_, omx_buf_in_);
-        if (err != OMX_ErrorNone) {
-          dbgMsg("failed: omx empty buffer\n");
-          return false;
-        }
-        omx_encode_sem_.wait();
+  return res;
+}
 
-        // ... wait for result
-        err = OMX_FillThisBuffer(omx_hnd_, omx_buf_out_);
-        if (err != OMX_ErrorNone) {
-          dbgMsg("failed: omx fill buffer\n");
-          return false;
-        }
-        omx_encode_sem_.wait();
-        differ_encode_.end();
+bool Encoder::drainOutput() {
 
-        // record the h264
-        if (testtime_ != 0 && fd_enc_ != nullptr) {
-          fwrite(omx_buf_out_->pBuffer, 1, omx_buf_out_->nFilledLen, fd_enc_);
-        }
+  while (true) {
+    OMX_BUFFERHEADERTYPE* buf = nullptr;
+    {
+      std::unique_lock<std::mutex> omx_lck(omx_lock_);
+      if (omx_out_done_.size() == 0) {
+        break;
+      }
+      buf = omx_out_done_.front();
+      omx_out_done_.pop();
+    }
 
-        // stream the h264
-        if (rtsp_) {
-          NalBuf nal(omx_buf_out_->nFilledLen, omx_buf_out_->pBuffer);
-          if (!rtsp_->addMessage(nal)) {
-            dbgMsg("warning: rtsp is busy\n");
-          }
+    if (buf->nFilledLen != 0) {
+
+      // stream and record the h264
+      unsigned int flags = 0;
+      if (buf->nFlags & OMX_BUFFERFLAG_ENDOFFRAME) {
+        flags |= NalBuf::kEndOfFrame;
+      }
+      if (buf->nFlags & OMX_BUFFERFLAG_SYNCFRAME) {
+        flags |= NalBuf::kKeyFrame;
+      }
+      if (buf->nFlags & OMX_BUFFERFLAG_CODECCONFIG) {
+        flags |= NalBuf::kConfig;
+      }
+
+      // the encoder does not reorder so frames come out in the order they went in
+      unsigned int id = frame_ids_.size() ? frame_ids_.front() : 0;
+      auto submitted = frame_submits_.size() ? frame_submits_.front() : 
+        std::chrono::steady_clock::now();
+      if ((flags & NalBuf::kEndOfFrame) && !(flags & NalBuf::kConfig) && frame_ids_.size()) {
+        frame_ids_.pop();
+        frame_submits_.pop();
+      }
+      NalBuf nal(buf->nFilledLen, buf->pBuffer + buf->nOffset,
+          flags, fromTicks(buf->nTimeStamp), id);
+
+      if (idr_pending_ != 0 && (flags & NalBuf::kKeyFrame)) {
+        differ_idr_.begin(std::chrono::steady_clock::time_point(
+              std::chrono::microseconds(idr_pending_)));
+        differ_idr_.end();
+        idr_pending_ = 0;
+      }
+
+      // the writer thread does the file io
+      phase("write");
+      if (wrt_) {
+        if (!wrt_->addMessage(nal)) {
+          dbgMsg("warning: writer is busy\n");
+        }
+      }
+      if (rtsp_) {
+        if (!streamNals(nal)) {
+          dbgMsg("warning: rtsp is busy\n");
         }
+      }
+      if (rec_) {
+        if (!rec_->addMessage(nal)) {
+          dbgMsg("warning: recorder is busy\n");
+        }
+      }
 
-        // omx buffer used;
-        omx_buf_out_->nFilledLen = 0;
+      // the last buffer of each frame ends its encode time
+      if ((buf->nFlags & OMX_BUFFERFLAG_ENDOFFRAME) && 
+          !(buf->nFlags & OMX_BUFFERFLAG_CODECCONFIG)) {
+        differ_encode_.begin(submitted);
+        differ_encode_.end();
       }
     }
+
+    // give the buffer back to the encoder
+    phase("fill");
+    buf->nFilledLen = 0;
+    buf->nFlags = 0;
+    OMX_ERRORTYPE err = OMX_FillThisBuffer(omx_hnd_, buf);
+    if (err != OMX_ErrorNone) {
+      dbgMsg("failed: omx fill buffer\n");
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool Encoder::running() {
+
+  if (encode_on_) {
+
+    // write out what the encoder has finished...
+    if (!drainOutput()) {
+      return false;
+    }
+
+    // ... and keep its input buffers busy
+    if (!submitFrames()) {
+      return false;
+    }
+
+    // frames in flight have to come back, no frames is just idle
+    bool busy;
+    {
+      std::unique_lock<std::mutex> omx_lck(omx_lock_);
+      busy = omx_in_busy_ != 0;
+    }
+    if (busy) {
+      phase("encode", Base::Phase::kPending);
+    } else {
+      phase("frames", Base::Phase::kIdle);
+    }
   }
 
   return true;
@@ -519,11 +878,58 @@ bool Encoder::paused() {
   return true;
 }
 
+// drop the frames that were never submitted and let the ones in flight finish
+void Encoder::finishFrames() {
+  {
+    std::unique_lock<std::timed_mutex> lck(frame_lock_);
+    frame_work_ = std::queue<FrameBuf>();
+  }
+
+  dbgMsg("drain the frames in flight\n");
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(drain_time_);
+  while (1) {
+    drainOutput();
+    {
+      std::unique_lock<std::mutex> omx_lck(omx_lock_);
+      if (omx_in_busy_ == 0) {
+        break;
+      }
+    }
+    if (std::chrono::steady_clock::now() >= deadline) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(yield_time_));
+  }
+  drainOutput();
+}
+
+// the component stays in executing with its buffers, only the frames stop
+bool Encoder::waitingToPause() {
+  if (encode_on_) {
+    finishFrames();
+  }
+  return true;
+}
+
+// a viewer or segment picks up again at an idr
+bool Encoder::waitingToResume() {
+  if (encode_on_) {
+    requestKeyFrame();
+  }
+  return true;
+}
+
 bool Encoder::waitingToHalt() {
 
   if (encode_on_) {
     encode_on_ = false;
+
+    finishFrames();
     differ_tot_.end();
+    if (idle_) {
+      idle_total_ += std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - idle_stamp_);
+    }
 
     // flush the port buffers
     dbgMsg("flush the port buffers\n");
@@ -557,16 +963,25 @@ bool Encoder::waitingToHalt() {
 
     // free all buffers
     dbgMsg("free all buffers\n");
-    err = OMX_FreeBuffer(omx_hnd_, 200, omx_buf_in_);
-    if (err != OMX_ErrorNone) {
-      dbgMsg("failed:  free port 200 buffer\n");
-      return false;
+    for (auto buf : omx_bufs_in_) {
+      err = OMX_FreeBuffer(omx_hnd_, 200, buf);
+      if (err != OMX_ErrorNone) {
+        dbgMsg("failed:  free port 200 buffer\n");
+        return false;
+      }
     }
-    err = OMX_FreeBuffer(omx_hnd_, 201, omx_buf_out_);
-    if (err != OMX_ErrorNone) {
-      dbgMsg("failed:  free port 201 buffer\n");
-      return false;
+    for (auto buf : omx_bufs_out_) {
+      err = OMX_FreeBuffer(omx_hnd_, 201, buf);
+      if (err != OMX_ErrorNone) {
+        dbgMsg("failed:  free port 201 buffer\n");
+        return false;
+      }
     }
+    omx_bufs_in_.clear();
+    omx_bufs_out_.clear();
+    omx_in_free_ = std::queue<OMX_BUFFERHEADERTYPE*>();
+    omx_in_busy_ = 0;
+    omx_out_done_ = std::queue<OMX_BUFFERHEADERTYPE*>();
 
     // transition to idle state
     dbgMsg("transition to loaded state\n");
@@ -594,21 +1009,37 @@ bool Encoder::waitingToHalt() {
     OMX_Deinit();
     bcm_host_deinit();
 
-    if (testtime_ != 0) {
-      if (fd_enc_ != nullptr) {
-        fclose(fd_enc_);
-      }
-    }
-
     // report
     if (!quiet_) {
-      fprintf(stderr, "\nEncoder Results...\n");
-      fprintf(stderr, "  image copy   time (us): high:%u avg:%u low:%u cnt:%u\n", 
+      if (scale_ > 1) {
+        fprintf(stderr, "\nSubstream Encoder Results (%ux%u)...\n", width_, height_);
+      } else {
+        fprintf(stderr, "\nEncoder Results...\n");
+      }
+      fprintf(stderr, "  image %stime (us): high:%u avg:%u low:%u cnt:%u\n", 
+          scale_ > 1 ? "scale  " : "copy   ",
           differ_copy_.high, differ_copy_.avg, 
           differ_copy_.low,differ_copy_.cnt);
+      fprintf(stderr, "  image submit time (us): high:%u avg:%u low:%u cnt:%u\n", 
+          differ_submit_.high, differ_submit_.avg, 
+          differ_submit_.low,differ_submit_.cnt);
       fprintf(stderr, "  image encode time (us): high:%u avg:%u low:%u cnt:%u\n", 
           differ_encode_.high, differ_encode_.avg, 
           differ_encode_.low,differ_encode_.cnt);
+      fprintf(stderr, "    max frames in flight: %u\n", omx_in_flight_);
+      if (idr_requests_ != 0) {
+        fprintf(stderr, "            idr requests: %u\n", idr_requests_);
+        fprintf(stderr, "     request to idr (us): high:%u avg:%u low:%u cnt:%u\n",
+            differ_idr_.high, differ_idr_.avg,
+            differ_idr_.low, differ_idr_.cnt);
+      }
+      if (idle_bitrate_ != 0) {
+        fprintf(stderr, "               idle rate: %u bps %u fps\n",
+            idle_bitrate_, idle_framerate_);
+        fprintf(stderr, "               idle time: %f sec\n", idle_total_.count() / 1000000.f);
+        fprintf(stderr, "            rate changes: %u\n", rate_changes_);
+        fprintf(stderr, "          frames skipped: %u\n", frames_skipped_);
+      }
       fprintf(stderr, "         total test time: %f sec\n", 
           differ_tot_.avg / 1000000.f);
       fprintf(stderr, "       frames per second: %f fps\n", 
@@ -26,11 +26,12 @@
 #include <thread>
 #include <mutex>
 #include <vector>
+#include <algorithm>
 
 #include "utils.h"
 #include "listener.h"
 #include "base.h"
-#include "rtsp.h"
+#include "h264.h"
 
 extern "C" {
 #include <IL/OMX_Core.h>
@@ -45,14 +46,25 @@ extern "C" {
 
 namespace detector {
 
+// h264 encoder thread.  A substream encoder (scale > 1) is fed by the
+// main encoder: it gets the same frame references and overlays, box
+// filters each frame down into its own input buffers and draws the
+// overlay at its own scale.
+//
+// With an idle bitrate the scene activity (any target or track in the
+// overlay) sets the rate: the encoder switches to the idle bitrate and
+// frame rate once nothing has been seen for idle_hold_ and back as soon
+// as something shows up.  Both go through OMX_SetConfig on the running
+// component; the idle frame rate is met by skipping input frames.
 class Encoder : public Base, 
-  Listener<FrameBuf>, 
-  Listener<std::shared_ptr<std::vector<BoxBuf>>>,
-  Listener<std::shared_ptr<std::vector<TrackBuf>>> {
+  public Listener<FrameBuf>, 
+  public Listener<std::shared_ptr<std::vector<BoxBuf>>>,
+  public Listener<std::shared_ptr<std::vector<TrackBuf>>> {
   public:
     static std::unique_ptr<Encoder> create(unsigned int yield_time, bool quiet, bool tracking,
-        Rtsp* rtsp, unsigned int framerate, unsigned int width, unsigned int height, 
-        unsigned int bitrate, std::string& output, unsigned int testtime);
+        Listener<NalBuf>* rtsp, Listener<NalBuf>* rec, Listener<NalBuf>* wrt, Encoder* sub,
+        unsigned int framerate, unsigned int width, unsigned int height, unsigned int scale,
+        bool yuv, unsigned int bitrate, unsigned int idle_bitrate, unsigned int idle_framerate);
     virtual ~Encoder();
 
   public:
@@ -60,31 +72,56 @@ class Encoder : public Base,
     virtual bool addMessage(std::shared_ptr<std::vector<BoxBuf>>& targets);
     virtual bool addMessage(std::shared_ptr<std::vector<TrackBuf>>& tracks);
 
-    
+    // an idr as soon as possible (a new viewer), safe from any thread
+    void requestKeyFrame();
+
   protected:
     Encoder() = delete;
     Encoder(unsigned int yield_time);
-    bool init(bool quiet, bool tracking, Rtsp* rtsp, unsigned int framerate, unsigned int width,
-        unsigned int height, unsigned int bitrate, std::string& output, 
-        unsigned int testtime);
+    bool init(bool quiet, bool tracking, Listener<NalBuf>* rtsp, Listener<NalBuf>* rec,
+        Listener<NalBuf>* wrt, Encoder* sub, unsigned int framerate, unsigned int width,
+        unsigned int height, unsigned int scale, bool yuv, unsigned int bitrate,
+        unsigned int idle_bitrate, unsigned int idle_framerate);
 
   protected:
     virtual bool waitingToRun();
     virtual bool running();
     virtual bool paused();
     virtual bool waitingToHalt();
+    virtual bool waitingToPause();
+    virtual bool waitingToResume();
 
   private:
     bool quiet_;
     bool tracking_;
-    Rtsp* rtsp_;
+    Listener<NalBuf>* rtsp_;
+    Listener<NalBuf>* rec_;
+    Listener<NalBuf>* wrt_;
+    Encoder* sub_;                           // substream, gets frames and overlays
     unsigned int framerate_;
-    unsigned int width_;
+    unsigned int src_width_;                 // capture size
+    unsigned int src_height_;
+    unsigned int scale_;                     // capture size / encoded size
+    unsigned int width_;                     // encoded size
     unsigned int height_;
     const unsigned int channels_ = {3};
+    bool yuv_;                               // I420 frames instead of RGB24
     unsigned int bitrate_;
-    std::string output_;
-    unsigned int testtime_;
+
+    // activity driven rate, off if idle_bitrate_ is 0
+    unsigned int idle_bitrate_;
+    unsigned int idle_framerate_;
+    const std::chrono::milliseconds idle_hold_ = std::chrono::milliseconds(3000);
+    bool idle_;
+    unsigned int idle_acc_;                  // frame rate divider
+    std::chrono::steady_clock::time_point active_stamp_;
+    std::chrono::steady_clock::time_point idle_stamp_;
+    std::chrono::microseconds idle_total_;
+    unsigned int rate_changes_;
+    unsigned int frames_skipped_;
+    bool active();
+    bool setRate(unsigned int bitrate, unsigned int framerate);
+    bool skipFrame();
 
     class RGB {
       public:
@@ -105,13 +142,55 @@ class Encoder : public Base,
     const Encoder::RGB gray_rgb_ { 128, 128, 128 };
     const Encoder::RGB white_rgb_{ 255, 255, 255 };
 
-    FILE* fd_enc_;
+    // bt.601 studio swing
+    class YUV {
+      public:
+        YUV(Encoder::RGB const& rgb)
+          : y((( 66 * rgb.r + 129 * rgb.g +  25 * rgb.b + 128) >> 8) +  16),
+            u(((-38 * rgb.r -  74 * rgb.g + 112 * rgb.b + 128) >> 8) + 128),
+            v(((112 * rgb.r -  94 * rgb.g -  18 * rgb.b + 128) >> 8) + 128) {}
+        ~YUV() {}
+      public:
+        unsigned char y;
+        unsigned char u;
+        unsigned char v;
+    };
+    const Encoder::YUV white_yuv_{ white_rgb_ };
+
+    std::queue<unsigned int> frame_ids_;     // ids of the frames in the encoder, oldest first
+    std::queue<std::chrono::steady_clock::time_point> frame_submits_;   // and when they went in
 
-    Semaphore omx_encode_sem_;
     Semaphore omx_flush_sem_;
     OMX_HANDLETYPE omx_hnd_;
-    OMX_BUFFERHEADERTYPE* omx_buf_in_;
-    OMX_BUFFERHEADERTYPE* omx_buf_out_;
+
+    // several frames in flight: the callbacks hand empty input buffers
+    // and filled output buffers back on separate queues
+    const unsigned int omx_buf_num_ = {3};   // min buffers per port
+    std::mutex omx_lock_;
+    std::vector<OMX_BUFFERHEADERTYPE*> omx_bufs_in_;
+    std::vector<OMX_BUFFERHEADERTYPE*> omx_bufs_out_;
+    std::queue<OMX_BUFFERHEADERTYPE*> omx_in_free_;
+    std::queue<OMX_BUFFERHEADERTYPE*> omx_out_done_;
+    unsigned int omx_in_busy_;
+    unsigned int omx_in_flight_;
+    const unsigned int drain_time_ = {500};  // max wait for frames in flight (ms)
+    bool allocateBuffers(OMX_U32 port, std::vector<OMX_BUFFERHEADERTYPE*>& bufs);
+    bool submitFrames();
+    bool drainOutput();
+    void finishFrames();
+
+    // the rtsp listener gets one nal (no start code) per message.  A nal
+    // cut by the end of an output buffer is carried to the next one.
+    std::vector<H264::Unit> nal_units_;
+    std::vector<unsigned char> nal_carry_;
+    bool streamNals(NalBuf& chunk);
+
+    // requested idrs, steady clock usec of the request (0 for none)
+    std::atomic<int64_t> idr_request_;
+    int64_t idr_pending_;
+    unsigned int idr_requests_;
+    MicroDiffer<uint32_t> differ_idr_;       // request to idr out
+
     static OMX_ERRORTYPE eventHandler(OMX_HANDLETYPE hnd, OMX_PTR self,
         OMX_EVENTTYPE evt, OMX_U32 d1, OMX_U32 d2, OMX_PTR data);
     static OMX_ERRORTYPE emptyHandler(OMX_HANDLETYPE hnd, OMX_PTR self,
@@ -121,38 +200,41 @@ class Encoder : public Base,
     void blockOnPortChange(OMX_U32 idx, OMX_BOOL enable);
     void blockOnStateChange(OMX_STATETYPE state);
 
-    class Frame {
-      public:
-        Frame() = delete;
-        Frame(unsigned int len) 
-          : id(0), length(len), buf(len) {}
-        ~Frame() {}
-      public:
-        unsigned int id;
-        unsigned int length;
-        std::vector<unsigned char> buf;
-    };
-
+    // capture only queues a reference to its buffer (up to frame_num_);
+    // the encoder thread copies it straight into a free port 200 buffer 
+    // and draws the overlay in place
     std::timed_mutex frame_lock_;
     const unsigned int frame_num_ = {3};
-    unsigned int frame_len_;
-    std::queue<std::shared_ptr<Encoder::Frame>> frame_pool_;
-    std::queue<std::shared_ptr<Encoder::Frame>> frame_work_;
+    unsigned int src_len_;                   // capture buffer
+    unsigned int frame_len_;                 // encoder input buffer
+    std::queue<FrameBuf> frame_work_;
 
-    void overlay(std::shared_ptr<Encoder::Frame>& frame);
+    void overlay(unsigned char* data);
 
     std::atomic<bool> encode_on_;
 
-    MicroDiffer<uint32_t> differ_copy_;
+    MicroDiffer<uint32_t> differ_copy_;      // copy or scale
+    MicroDiffer<uint32_t> differ_submit_;
     MicroDiffer<uint32_t> differ_encode_;
     MicroDiffer<uint32_t> differ_tot_;
 
+    // boxes are in capture coordinates
     template<typename T>
     void drawBoxes(bool show_id, unsigned int thickness, 
         unsigned int width, unsigned int height, 
         unsigned char* data, T& vec) {
       std::for_each(vec->begin(), vec->end(),
-          [&](const BoxBuf& box) {
+          [&](const BoxBuf& src) {
+            BoxBuf box = src;
+            if (scale_ > 1) {
+              box.x /= scale_;
+              box.y /= scale_;
+              box.w /= scale_;
+              box.h /= scale_;
+              if (box.w < 2 * thickness || box.h < 2 * thickness) {
+                return;
+              }
+            }
             Encoder::RGB rgb = gray_rgb_;
             if (box.type == BoxBuf::Type::kPerson) {
               rgb = red_rgb_;
@@ -161,6 +243,25 @@ class Encoder : public Base,
             } else if (box.type == BoxBuf::Type::kVehicle) {
               rgb = blue_rgb_;
             }
+            if (yuv_) {
+              Encoder::YUV yuv(rgb);
+              unsigned int stride = ALIGN_16B(width);
+              unsigned char* u = data + stride * ALIGN_16B(height);
+              unsigned char* v = u + stride * ALIGN_16B(height) / 4;
+              drawYUVBox(thickness, 
+                  data, stride, u, stride / 2, v, stride / 2,
+                  box.x, box.y, box.w, box.h,
+                  yuv.y, yuv.u, yuv.v);
+              if (show_id) {
+                std::string str;
+                str += "ID: " + std::to_string(box.id);
+                drawYUVText(data, stride, u, stride / 2, v, stride / 2,
+                    box.x + thickness, box.y + thickness, str.c_str(),
+                    white_yuv_.y, white_yuv_.u, white_yuv_.v,
+                    yuv.y, yuv.u, yuv.v);
+              }
+              return;
+            }
             drawRGBBox(thickness, data, 
                 width, height,
                 box.x, box.y, box.w, box.h,
@@ -0,0 +1,332 @@
+/*
+ * Copyright © 2019 Tyler J. Brooks <tylerjbrooks@digispeaker.com> <https://www.digispeaker.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Try './encoder_bench -?' for usage.
+ *
+ * ----------
+ *
+ *  Standalone encoder benchmark.  Feeds synthetic frames (and a few
+ *  moving boxes) to the Encoder thread at a fixed frame rate and reports
+ *  how many frames made it through.  Built against mock_omx.cpp it runs
+ *  off target; set the mock encode latency with '-l'.
+ */
+
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "listener.h"
+#include "encoder.h"
+#include "writer.h"
+#include "watchdog.h"
+
+namespace detector {
+
+std::unique_ptr<Encoder> enc(nullptr);
+std::unique_ptr<Encoder> sub(nullptr);
+std::unique_ptr<Writer>  wrt(nullptr);
+std::unique_ptr<Watchdog> wdg(nullptr);
+
+void usage() {
+  std::cout << "encoder_bench -?qnfwhiblyoxsauBkpW"                           << std::endl;
+  std::cout << "version: 1.0"                                                << std::endl;
+  std::cout                                                                  << std::endl;
+  std::cout << "  where:"                                                    << std::endl;
+  std::cout << "  ?            = this screen"                                << std::endl;
+  std::cout << "  (q)uiet      = suppress encoder report (default = false)"  << std::endl;
+  std::cout << "  (n)umber     = number of frames        (default = 300)"    << std::endl;
+  std::cout << "  (f)ramerate  = frames per second       (default = 30)"     << std::endl;
+  std::cout << "  (w)idth      = frame width             (default = 640)"    << std::endl;
+  std::cout << "  (h)eight     = frame height            (default = 480)"    << std::endl;
+  std::cout << "  (i)420       = yuv420 frames           (default = rgb24)"  << std::endl;
+  std::cout << "  (b)itrate    = encoder bitrate         (default = 1000000)" << std::endl;
+  std::cout << "  (l)atency    = mock encode latency     (default = 20000usec)" << std::endl;
+  std::cout << "  (y)ield time = yield time              (default = 1000usec)" << std::endl;
+  std::cout << "  (o)utput     = output file name        (default = none)"   << std::endl;
+  std::cout << "  segment(x)   = segment length in sec   (default = 0, off)" << std::endl;
+  std::cout << "  (s)ync       = fsync period in sec     (default = 0, off)" << std::endl;
+  std::cout << "  st(a)ll      = storage stall per second (default = 0usec)" << std::endl;
+  std::cout << "               = output must not exist, it is made a fifo" << std::endl;
+  std::cout << "  s(u)bstream  = substream scale         (default = 0, off)" << std::endl;
+  std::cout << "  idle (B)ps   = idle bitrate[:fps]      (default = off)"    << std::endl;
+  std::cout << "               = boxes are then only sent 2 sec of every 10" << std::endl;
+  std::cout << "  (k)ey frames = client join every sec   (default = 0, off)" << std::endl;
+  std::cout << "  (p)ause      = pause/resume every sec  (default = 0, off)" << std::endl;
+  std::cout << "  (W)atchdog   = stall deadline in msec  (default = 0, off)" << std::endl;
+}
+
+int main(int argc, char** argv) {
+
+  // defaults
+  bool quiet = false;
+  unsigned int frames = 300;
+  unsigned int framerate = 30;
+  unsigned int width = 640;
+  unsigned int height = 480;
+  bool yuv = false;
+  unsigned int bitrate = 1000000;
+  unsigned int latency = 20000;
+  unsigned int yield_time = 1000;
+  std::string output;
+  unsigned int seg_time = 0;
+  unsigned int sync_time = 0;
+  unsigned int stall = 0;
+  unsigned int scale = 0;
+  std::string idle;
+  unsigned int idle_bitrate = 0;
+  unsigned int idle_framerate = 0;
+  unsigned int join = 0;
+  unsigned int cycle = 0;
+  unsigned int deadline = 0;
+
+  // cmd line options
+  int c;
+  while((c = getopt(argc, argv, ":qn:f:w:h:ib:l:y:o:x:s:a:u:B:k:p:W:")) != -1) {
+    switch (c) {
+      case 'q': quiet      = true;               break;
+      case 'n': frames     = std::stoul(optarg); break;
+      case 'f': framerate  = std::stoul(optarg); break;
+      case 'w': width      = std::stoul(optarg); break;
+      case 'h': height     = std::stoul(optarg); break;
+      case 'i': yuv        = true;               break;
+      case 'b': bitrate    = std::stoul(optarg); break;
+      case 'l': latency    = std::stoul(optarg); break;
+      case 'y': yield_time = std::stoul(optarg); break;
+      case 'o': output     = optarg;             break;
+      case 'x': seg_time   = std::stoul(optarg); break;
+      case 's': sync_time  = std::stoul(optarg); break;
+      case 'a': stall      = std::stoul(optarg); break;
+      case 'u': scale      = std::stoul(optarg); break;
+      case 'B': idle       = optarg;             break;
+      case 'k': join       = std::stoul(optarg); break;
+      case 'p': cycle      = std::stoul(optarg); break;
+      case 'W': deadline   = std::stoul(optarg); break;
+
+      case '?':
+      default:  usage(); return 0;
+    }
+  }
+  framerate = std::max(framerate, 1u);
+  if (!idle.empty()) {
+    size_t sep = idle.find(':');
+    idle_bitrate = std::stoul(idle.substr(0, sep));
+    idle_framerate = (sep == std::string::npos) ? framerate :
+      std::stoul(idle.substr(sep + 1));
+  }
+
+  // the mock reads its latency from the environment
+  setenv("MOCK_OMX_LATENCY_US", std::to_string(latency).c_str(), 1);
+
+  fprintf(stderr, "\nBench Setup...\n");
+  fprintf(stderr, "      frames: %u\n", frames);
+  fprintf(stderr, "   framerate: %u fps\n", framerate);
+  fprintf(stderr, "       width: %u pix\n", width);
+  fprintf(stderr, "      height: %u pix\n", height);
+  fprintf(stderr, "      format: %s\n", yuv ? "yuv420" : "rgb24");
+  fprintf(stderr, "     bitrate: %u bps\n", bitrate);
+  fprintf(stderr, "mock latency: %u usec\n", latency);
+  fprintf(stderr, "      output: %s\n", output.empty() ? "none" : output.c_str());
+  fprintf(stderr, "writer stall: %u usec/sec\n", stall);
+  if (idle_bitrate != 0) {
+    fprintf(stderr, "   idle rate: %u bps %u fps\n", idle_bitrate, idle_framerate);
+  }
+  if (join != 0) {
+    fprintf(stderr, " client join: every %u sec\n", join);
+  }
+  if (cycle != 0) {
+    fprintf(stderr, " pause cycle: every %u sec\n", cycle);
+  }
+  if (scale > 1) {
+    fprintf(stderr, "   substream: %ux%u %u bps\n", width / scale, height / scale, bitrate / 10);
+  }
+
+  // a fifo whose reader stops every second stands in for a slow sd card
+  std::atomic<bool> done(false);
+  std::thread staller;
+  if (!output.empty() && stall != 0) {
+    if (mkfifo(output.c_str(), 0600) != 0) {
+      fprintf(stderr, "failed: mkfifo %s\n", output.c_str());
+      return 1;
+    }
+    staller = std::thread([&]() {
+      int fd = open(output.c_str(), O_RDONLY);
+      std::vector<unsigned char> buf(65536);
+      auto next = std::chrono::steady_clock::now();
+      while (fd >= 0 && read(fd, buf.data(), buf.size()) > 0) {
+        if (!done && std::chrono::steady_clock::now() >= next) {
+          std::this_thread::sleep_for(std::chrono::microseconds(std::min(stall, 999999u)));
+          next += std::chrono::seconds(1);
+        }
+      }
+      if (fd >= 0) {
+        close(fd);
+      }
+    });
+  }
+
+  if (!output.empty()) {
+    wrt = Writer::create(yield_time, quiet, output, seg_time, 0, sync_time);
+    wrt->start("wrt", 10);
+    wrt->run();
+  }
+  if (scale > 1) {
+    sub = Encoder::create(yield_time, quiet, false, nullptr, nullptr, nullptr, nullptr,
+        framerate, width, height, scale, yuv, bitrate / 10, idle_bitrate / 10, idle_framerate);
+    sub->start("sub", 40);
+    sub->run();
+  }
+  enc = Encoder::create(yield_time, quiet, false, nullptr, nullptr, wrt.get(), sub.get(),
+      framerate, width, height, 1, yuv, bitrate, idle_bitrate, idle_framerate);
+  MicroDiffer<uint32_t> differ_cold;
+  differ_cold.begin();
+  enc->start("enc", 50);
+  enc->run();
+  differ_cold.end();
+  if (deadline != 0) {
+    wdg = Watchdog::create(std::min(deadline * 1000 / 4, 100000u), quiet, deadline);
+    wdg->watch(wrt.get());
+    wdg->watch(sub.get());
+    wdg->watch(enc.get());
+    wdg->start("wdg", 95);
+    wdg->run();
+  }
+  MicroDiffer<uint32_t> differ_pause;
+  MicroDiffer<uint32_t> differ_resume;
+
+  // synthetic frames, handed out by reference like the capturer does
+  unsigned int len = ALIGN_16B(width) * ALIGN_16B(height) * 3;
+  if (yuv) {
+    len = ALIGN_16B(width) * ALIGN_16B(height) * 3 / 2;
+  }
+  const unsigned int pool_num = 6;
+  std::vector<std::shared_ptr<std::vector<unsigned char>>> pool;
+  for (unsigned int i = 0; i < pool_num; i++) {
+    pool.push_back(std::make_shared<std::vector<unsigned char>>(len));
+  }
+  unsigned int sent = 0;
+  unsigned int dropped = 0;
+  MicroDiffer<uint32_t> differ_add;
+
+  MicroDiffer<uint32_t> differ_tot;
+  differ_tot.begin();
+  auto next = std::chrono::steady_clock::now();
+  for (unsigned int i = 0; i < frames; i++) {
+    auto it = std::find_if(pool.begin(), pool.end(),
+        [](const std::shared_ptr<std::vector<unsigned char>>& p) { return p.use_count() == 1; });
+
+    // bursts of activity when the rate follows it
+    auto boxes = std::make_shared<std::vector<BoxBuf>>();
+    if (idle_bitrate == 0 || (i / framerate) % 10 < 2) {
+      boxes->push_back(BoxBuf(BoxBuf::Type::kPerson, i,
+            (i * 4) % (width / 2), height / 4, width / 8, height / 4));
+      boxes->push_back(BoxBuf(BoxBuf::Type::kVehicle, i,
+            width / 2, (i * 2) % (height / 2), width / 4, height / 8));
+    }
+    enc->addMessage(boxes);
+
+    // a warm pause and resume, the encoder keeps its component
+    if (cycle != 0 && i != 0 && i % (cycle * framerate) == 0) {
+      differ_pause.begin();
+      enc->pause();
+      differ_pause.end();
+      differ_resume.begin();
+      enc->run();
+      differ_resume.end();
+    }
+
+    // what an rtsp client joining mid gop asks for
+    if (join != 0 && i % (join * framerate) == join * framerate / 2) {
+      enc->requestKeyFrame();
+    }
+
+    if (it == pool.end()) {
+      dropped++;
+    } else {
+      std::fill((*it)->begin(), (*it)->end(), static_cast<unsigned char>(i));
+      FrameBuf fbuf;
+      fbuf.id = i;
+      fbuf.length = len;
+      fbuf.addr = (*it)->data();
+      fbuf.format = yuv ? V4L2_PIX_FMT_YUV420 : V4L2_PIX_FMT_RGB24;
+      fbuf.stamp = std::chrono::steady_clock::now();
+      fbuf.ref = *it;
+      differ_add.begin();
+      bool res = enc->addMessage(fbuf);
+      differ_add.end();
+      if (res) {
+        sent++;
+      } else {
+        dropped++;
+      }
+    }
+
+    next += std::chrono::microseconds(1000000 / framerate);
+    std::this_thread::sleep_until(next);
+  }
+  differ_tot.end();
+  done = true;
+
+  if (wdg) {
+    wdg->stop();
+    wdg.reset(nullptr);
+  }
+  enc->stop();
+  enc.reset(nullptr);
+  if (sub) {
+    sub->stop();
+    sub.reset(nullptr);
+  }
+  if (wrt) {
+    wrt->stop();
+    wrt.reset(nullptr);
+  }
+  if (staller.joinable()) {
+    staller.join();
+    unlink(output.c_str());
+  }
+
+  fprintf(stderr, "\nBench Results...\n");
+  fprintf(stderr, "     frames sent: %u\n", sent);
+  fprintf(stderr, "  frames dropped: %u\n", dropped);
+  fprintf(stderr, "  addMessage time (us): high:%u avg:%u low:%u cnt:%u\n",
+      differ_add.high, differ_add.avg, differ_add.low, differ_add.cnt);
+  fprintf(stderr, " encoder start time: %u usec\n", differ_cold.avg);
+  if (cycle != 0) {
+    fprintf(stderr, "  pause time (us): high:%u avg:%u low:%u cnt:%u\n",
+        differ_pause.high, differ_pause.avg, differ_pause.low, differ_pause.cnt);
+    fprintf(stderr, " resume time (us): high:%u avg:%u low:%u cnt:%u\n",
+        differ_resume.high, differ_resume.avg, differ_resume.low, differ_resume.cnt);
+  }
+  fprintf(stderr, " total test time: %f sec\n", differ_tot.avg / 1000000.f);
+  fprintf(stderr, "\n");
+
+  return 0;
+}
+
+} // namespace detector
+
+int main(int argc, char** argv) {
+  return detector::main(argc, argv);
+}
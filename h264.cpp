@@ -0,0 +1,208 @@
+/*
+ * Copyright © 2019 Tyler J. Brooks <tylerjbrooks@digispeaker.com> <https://www.digispeaker.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Try './detector -h' for usage.
+ */
+
+#include <cstddef>
+
+#include "h264.h"
+
+namespace detector {
+
+const unsigned char H264::start_code_[4] = { 0x00, 0x00, 0x00, 0x01 };
+
+// exp-golomb reader over an rbsp (emulation prevention bytes removed)
+class Bits {
+  public:
+    Bits(const std::vector<unsigned char>& rbsp) : rbsp_(rbsp), pos_(0), bad_(false) {}
+    ~Bits() {}
+
+    bool ok() { return !bad_ && pos_ <= rbsp_.size() * 8; }
+    unsigned int u(unsigned int n) {
+      unsigned int val = 0;
+      for (unsigned int i = 0; i < n; i++, pos_++) {
+        unsigned int bit = 0;
+        if (pos_ < rbsp_.size() * 8) {
+          bit = (rbsp_[pos_ / 8] >> (7 - pos_ % 8)) & 1;
+        }
+        val = (val << 1) | bit;
+      }
+      return val;
+    }
+    unsigned int ue() {
+      unsigned int zeros = 0;
+      while (u(1) == 0) {
+        // more than 31 leading zeros does not fit, the rbsp is corrupt
+        if (++zeros > 31 || !ok()) {
+          bad_ = true;
+          return 0;
+        }
+      }
+      return ((1u << zeros) - 1) + u(zeros);
+    }
+    int se() {
+      unsigned int val = ue();
+      return (val & 1) ? static_cast<int>((val + 1) / 2) : -static_cast<int>(val / 2);
+    }
+
+  private:
+    const std::vector<unsigned char>& rbsp_;
+    size_t pos_;
+    bool bad_;
+};
+
+unsigned int H264::split(const unsigned char* data, unsigned int len,
+    std::vector<H264::Unit>& nals) {
+
+  nals.clear();
+
+  // find the 00 00 01 of each start code, a 4 byte start code
+  // leaves its leading zero as trailing zero of the previous nal
+  const unsigned char* nal = nullptr;
+  unsigned int i = 0;
+  while (i + 2 < len) {
+    if (data[i + 2] > 1) {
+      i += 3;
+    } else if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+      if (nal) {
+        const unsigned char* end = data + i;
+        while (end > nal && end[-1] == 0) {
+          end--;
+        }
+        nals.push_back(H264::Unit(nal, end - nal));
+      }
+      i += 3;
+      nal = data + i;
+    } else {
+      i++;
+    }
+  }
+  if (nal && nal < data + len) {
+    nals.push_back(H264::Unit(nal, data + len - nal));
+  }
+
+  return nals.size();
+}
+
+bool H264::contains(const unsigned char* data, unsigned int len, H264::Nal type) {
+  std::vector<H264::Unit> nals;
+  split(data, len, nals);
+  for (auto& nal : nals) {
+    if (nal.second != 0 && H264::type(nal.first) == type) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool H264::parseSps(const unsigned char* nal, unsigned int len, H264::Sps& sps) {
+
+  if (len < 4 || H264::type(nal) != H264::Nal::kSps) {
+    return false;
+  }
+
+  // drop the emulation prevention bytes (00 00 03)
+  std::vector<unsigned char> rbsp;
+  rbsp.reserve(len);
+  for (unsigned int i = 1; i < len; i++) {
+    if (i + 2 < len && nal[i] == 0 && nal[i + 1] == 0 && nal[i + 2] == 3) {
+      rbsp.push_back(0);
+      rbsp.push_back(0);
+      i += 2;
+    } else {
+      rbsp.push_back(nal[i]);
+    }
+  }
+
+  Bits bits(rbsp);
+  sps.profile = bits.u(8);
+  sps.compat = bits.u(8);
+  sps.level = bits.u(8);
+  bits.ue();                                      // seq_parameter_set_id
+
+  unsigned int chroma_format = 1;
+  switch (sps.profile) {
+    case 100: case 110: case 122: case 244: case 44:
+    case 83: case 86: case 118: case 128: case 138:
+    case 139: case 134: case 135:
+      chroma_format = bits.ue();
+      if (chroma_format == 3) {
+        bits.u(1);                                // separate_colour_plane_flag
+      }
+      bits.ue();                                  // bit_depth_luma_minus8
+      bits.ue();                                  // bit_depth_chroma_minus8
+      bits.u(1);                                  // qpprime_y_zero_transform_bypass_flag
+      if (bits.u(1)) {                            // seq_scaling_matrix_present_flag
+        for (unsigned int i = 0; i < ((chroma_format != 3) ? 8u : 12u); i++) {
+          if (bits.u(1)) {
+            int last = 8;
+            int next = 8;
+            for (unsigned int j = 0; j < (i < 6 ? 16u : 64u) && next != 0; j++) {
+              next = (last + bits.se() + 256) % 256;
+              last = (next == 0) ? last : next;
+            }
+          }
+        }
+      }
+      break;
+    default:
+      break;
+  }
+
+  bits.ue();                                      // log2_max_frame_num_minus4
+  unsigned int poc_type = bits.ue();
+  if (poc_type == 0) {
+    bits.ue();                                    // log2_max_pic_order_cnt_lsb_minus4
+  } else if (poc_type == 1) {
+    bits.u(1);                                    // delta_pic_order_always_zero_flag
+    bits.se();                                    // offset_for_non_ref_pic
+    bits.se();                                    // offset_for_top_to_bottom_field
+    unsigned int cycle = bits.ue();
+    for (unsigned int i = 0; i < cycle && bits.ok(); i++) {
+      bits.se();
+    }
+  }
+  bits.ue();                                      // max_num_ref_frames
+  bits.u(1);                                      // gaps_in_frame_num_value_allowed_flag
+  unsigned int width_mbs = bits.ue() + 1;
+  unsigned int height_units = bits.ue() + 1;
+  unsigned int frame_mbs_only = bits.u(1);
+  if (!frame_mbs_only) {
+    bits.u(1);                                    // mb_adaptive_frame_field_flag
+  }
+  bits.u(1);                                      // direct_8x8_inference_flag
+
+  unsigned int crop_left = 0, crop_right = 0, crop_top = 0, crop_bottom = 0;
+  if (bits.u(1)) {
+    crop_left = bits.ue();
+    crop_right = bits.ue();
+    crop_top = bits.ue();
+    crop_bottom = bits.ue();
+  }
+  if (!bits.ok()) {
+    return false;
+  }
+
+  unsigned int crop_x = (chroma_format == 1 || chroma_format == 2) ? 2 : 1;
+  unsigned int crop_y = (chroma_format == 1) ? 2 : 1;
+  crop_y *= 2 - frame_mbs_only;
+  sps.width = width_mbs * 16 - crop_x * (crop_left + crop_right);
+  sps.height = (2 - frame_mbs_only) * height_units * 16 - crop_y * (crop_top + crop_bottom);
+
+  return true;
+}
+
+} // namespace detector
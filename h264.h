@@ -0,0 +1,72 @@
+/*
+ * Copyright © 2019 Tyler J. Brooks <tylerjbrooks@digispeaker.com> <https://www.digispeaker.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Try './detector -h' for usage.
+ */
+
+#ifndef H264_H
+#define H264_H
+
+#include <vector>
+#include <utility>
+
+namespace detector {
+
+// Annex-B h264 helpers
+class H264 {
+  public:
+    enum class Nal {
+      kSlice = 1,
+      kIdr   = 5,
+      kSei   = 6,
+      kSps   = 7,
+      kPps   = 8,
+      kAud   = 9
+    };
+
+    // a nal without its start code
+    using Unit = std::pair<const unsigned char*, unsigned int>;
+
+    // the parts of a sequence parameter set a container needs
+    class Sps {
+      public:
+        unsigned int profile;
+        unsigned int compat;
+        unsigned int level;
+        unsigned int width;
+        unsigned int height;
+    };
+
+  public:
+    static inline H264::Nal type(const unsigned char* nal) { 
+      return static_cast<H264::Nal>(nal[0] & 0x1f); 
+    }
+
+    // split a byte stream at its start codes, returns the number of nals
+    static unsigned int split(const unsigned char* data, unsigned int len,
+        std::vector<H264::Unit>& nals);
+
+    // true if the byte stream holds a nal of this type
+    static bool contains(const unsigned char* data, unsigned int len, H264::Nal nal);
+
+    // decode an sps nal (no start code), false if it is malformed
+    static bool parseSps(const unsigned char* nal, unsigned int len, H264::Sps& sps);
+
+    static const unsigned char start_code_[4];
+};
+
+} // namespace detector
+
+#endif // H264_H
@@ -26,20 +26,30 @@
 #include <pthread.h>
 #include <vector>
 #include <atomic>
+#include <memory>
+#include <chrono>
 
 #include "utils.h"
 
 namespace detector {
 
 // encapsulate a frame buffer
+//   format is V4L2_PIX_FMT_RGB24 or V4L2_PIX_FMT_YUV420 (planar I420)
+//   ref keeps addr valid: a listener may hold on to a copy of the 
+//   FrameBuf and the sender gets its buffer back when the last copy
+//   drops the ref.  Listeners that copy the data right away can ignore it.
+//   stamp is the capture time (steady clock).
 class FrameBuf {
   public:
-    FrameBuf() : id(0), length(0), addr(nullptr) {}
+    FrameBuf() : id(0), length(0), addr(nullptr), format(V4L2_PIX_FMT_RGB24), stamp() {}
     ~FrameBuf() {}
   public:
     unsigned int id;
     unsigned int length;
     unsigned char* addr;
+    unsigned int format;
+    std::chrono::steady_clock::time_point stamp;
+    std::shared_ptr<void> ref;
 };
 
 // encapsulate box
@@ -74,16 +84,29 @@ class TrackBuf : public BoxBuf {
 };
 
 // encapsulate NAL
+//   a chunk of annex-b h264 from the encoder.  An access unit may span
+//   several chunks, the last one has kEndOfFrame set.  stamp is when the
+//   frame went into the encoder and id is its capture frame id.
 class NalBuf {
+  public:
+    static const unsigned int kEndOfFrame = {0x01};
+    static const unsigned int kKeyFrame   = {0x02};  // idr access unit
+    static const unsigned int kConfig     = {0x04};  // sps/pps only
   public:
     NalBuf() = delete;
     NalBuf(unsigned int l, unsigned char* a) 
-      : length(l), addr(a) {}
+      : length(l), addr(a), flags(kEndOfFrame), stamp(), id(0) {}
+    NalBuf(unsigned int l, unsigned char* a, unsigned int f,
+        std::chrono::steady_clock::time_point s, unsigned int i = 0) 
+      : length(l), addr(a), flags(f), stamp(s), id(i) {}
     NalBuf(NalBuf const & n) = delete;
     ~NalBuf() {}
   public:
     unsigned int length;
     unsigned char* addr;
+    unsigned int flags;
+    std::chrono::steady_clock::time_point stamp;
+    unsigned int id;
 };
 
 
@@ -0,0 +1,556 @@
+/*
+ * Copyright © 2019 Tyler J. Brooks <tylerjbrooks@digispeaker.com> <https://www.digispeaker.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Try './detector -h' for usage.
+ *
+ * ----------
+ *
+ *  Mock of the Broadcom 'video_encode' OMX component (plus OMX_Init and
+ *  friends and bcm_host_init) so the encoder can be exercised off target.
+ *  Link it in place of libopenmaxil and libbcm_host.
+ *
+ *  The mock encodes the input buffers in order as a pipeline: each frame
+ *  is due MOCK_OMX_LATENCY_US microseconds (default 20000) after it was
+ *  submitted, its input buffer is held until then and returned when it
+ *  is done. Each frame is written as a fake H264 access unit
+ *  (bitrate / framerate bytes, both can be changed with OMX_SetConfig)
+ *  across as many output buffers as it needs.  The first output buffer
+ *  is a codec config buffer (SPS and PPS).
+ */
+
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+extern "C" {
+#include <IL/OMX_Core.h>
+#include <IL/OMX_Component.h>
+#include <IL/OMX_Video.h>
+}
+
+extern "C" {
+#include <bcm_host.h>
+#include <IL/OMX_Broadcom.h>
+}
+
+namespace detector {
+
+class MockEncoder {
+  public:
+    MockEncoder(OMX_PTR app, OMX_CALLBACKTYPE* callbacks);
+    ~MockEncoder();
+
+  public:
+    OMX_COMPONENTTYPE comp;
+
+  private:
+    static MockEncoder* self(OMX_HANDLETYPE hnd) {
+      return static_cast<MockEncoder*>(static_cast<OMX_COMPONENTTYPE*>(hnd)->pComponentPrivate);
+    }
+
+    static OMX_ERRORTYPE sendCommand(OMX_HANDLETYPE hnd, OMX_COMMANDTYPE cmd,
+        OMX_U32 param, OMX_PTR data);
+    static OMX_ERRORTYPE getParameter(OMX_HANDLETYPE hnd, OMX_INDEXTYPE idx, OMX_PTR param);
+    static OMX_ERRORTYPE setParameter(OMX_HANDLETYPE hnd, OMX_INDEXTYPE idx, OMX_PTR param);
+    static OMX_ERRORTYPE getConfig(OMX_HANDLETYPE hnd, OMX_INDEXTYPE idx, OMX_PTR config);
+    static OMX_ERRORTYPE setConfig(OMX_HANDLETYPE hnd, OMX_INDEXTYPE idx, OMX_PTR config);
+    static OMX_ERRORTYPE getState(OMX_HANDLETYPE hnd, OMX_STATETYPE* state);
+    static OMX_ERRORTYPE allocateBuffer(OMX_HANDLETYPE hnd, OMX_BUFFERHEADERTYPE** buf,
+        OMX_U32 port, OMX_PTR app, OMX_U32 size);
+    static OMX_ERRORTYPE freeBuffer(OMX_HANDLETYPE hnd, OMX_U32 port, OMX_BUFFERHEADERTYPE* buf);
+    static OMX_ERRORTYPE emptyThisBuffer(OMX_HANDLETYPE hnd, OMX_BUFFERHEADERTYPE* buf);
+    static OMX_ERRORTYPE fillThisBuffer(OMX_HANDLETYPE hnd, OMX_BUFFERHEADERTYPE* buf);
+
+    OMX_PARAM_PORTDEFINITIONTYPE* findPort(OMX_U32 port);
+    void updateBufferSize();
+    void event(OMX_EVENTTYPE evt, OMX_U32 d1, OMX_U32 d2);
+    void flush(OMX_U32 port);
+    bool writeOutput(const unsigned char* data, unsigned int len,
+        OMX_TICKS stamp, OMX_U32 flags, std::unique_lock<std::mutex>& lck);
+    void worker();
+
+  private:
+    OMX_PTR app_;
+    OMX_CALLBACKTYPE callbacks_;
+
+    std::mutex lock_;
+    std::condition_variable cv_;
+    OMX_STATETYPE state_;
+    bool quit_;
+    std::thread thread_;
+
+    OMX_PARAM_PORTDEFINITIONTYPE port_in_;
+    OMX_PARAM_PORTDEFINITIONTYPE port_out_;
+    OMX_U32 bitrate_;
+
+    // frames are 'encoded' in a pipeline: each one is due latency_
+    // after it was submitted, independent of the frames ahead of it
+    std::deque<std::pair<OMX_BUFFERHEADERTYPE*, std::chrono::steady_clock::time_point>> in_work_;
+    std::deque<OMX_BUFFERHEADERTYPE*> out_free_;
+
+    unsigned int latency_;
+    unsigned int frame_cnt_;
+    bool config_sent_;
+    bool idr_request_;
+
+    const unsigned int out_size_ = {65536};
+    const unsigned int buf_min_ = {1};
+};
+
+#define OMX_INIT_STRUCTURE(a) \
+  std::memset(&(a), 0, sizeof(a)); \
+  (a).nSize = sizeof(a); \
+  (a).nVersion.nVersion = OMX_VERSION; \
+  (a).nVersion.s.nVersionMajor = OMX_VERSION_MAJOR; \
+  (a).nVersion.s.nVersionMinor = OMX_VERSION_MINOR; \
+  (a).nVersion.s.nRevision = OMX_VERSION_REVISION; \
+  (a).nVersion.s.nStep = OMX_VERSION_STEP
+
+MockEncoder::MockEncoder(OMX_PTR app, OMX_CALLBACKTYPE* callbacks)
+  : app_(app), callbacks_(*callbacks),
+    state_(OMX_StateLoaded), quit_(false),
+    bitrate_(1000000), frame_cnt_(0), config_sent_(false), idr_request_(false) {
+
+  const char* latency = std::getenv("MOCK_OMX_LATENCY_US");
+  latency_ = latency ? std::strtoul(latency, nullptr, 10) : 20000;
+
+  std::memset(&comp, 0, sizeof(comp));
+  comp.nSize = sizeof(comp);
+  comp.pComponentPrivate = this;
+  comp.pApplicationPrivate = app;
+  comp.SendCommand     = sendCommand;
+  comp.GetParameter    = getParameter;
+  comp.SetParameter    = setParameter;
+  comp.GetConfig       = getConfig;
+  comp.SetConfig       = setConfig;
+  comp.GetState        = getState;
+  comp.AllocateBuffer  = allocateBuffer;
+  comp.FreeBuffer      = freeBuffer;
+  comp.EmptyThisBuffer = emptyThisBuffer;
+  comp.FillThisBuffer  = fillThisBuffer;
+
+  OMX_INIT_STRUCTURE(port_in_);
+  port_in_.nPortIndex = 200;
+  port_in_.eDir = OMX_DirInput;
+  port_in_.nBufferCountMin = buf_min_;
+  port_in_.nBufferCountActual = buf_min_;
+  port_in_.eDomain = OMX_PortDomainVideo;
+  port_in_.nBufferAlignment = 16;
+  port_in_.format.video.nFrameWidth = 320;
+  port_in_.format.video.nFrameHeight = 240;
+  port_in_.format.video.nStride = 320;
+  port_in_.format.video.nSliceHeight = 240;
+  port_in_.format.video.xFramerate = 30 << 16;
+  port_in_.format.video.eColorFormat = OMX_COLOR_FormatYUV420PackedPlanar;
+
+  OMX_INIT_STRUCTURE(port_out_);
+  port_out_.nPortIndex = 201;
+  port_out_.eDir = OMX_DirOutput;
+  port_out_.nBufferCountMin = buf_min_;
+  port_out_.nBufferCountActual = buf_min_;
+  port_out_.nBufferSize = out_size_;
+  port_out_.eDomain = OMX_PortDomainVideo;
+  port_out_.nBufferAlignment = 16;
+  port_out_.format.video.eCompressionFormat = OMX_VIDEO_CodingAVC;
+
+  updateBufferSize();
+
+  thread_ = std::thread(&MockEncoder::worker, this);
+}
+
+MockEncoder::~MockEncoder() {
+  {
+    std::unique_lock<std::mutex> lck(lock_);
+    quit_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+OMX_PARAM_PORTDEFINITIONTYPE* MockEncoder::findPort(OMX_U32 port) {
+  if (port == 200) {
+    return &port_in_;
+  } else if (port == 201) {
+    return &port_out_;
+  }
+  return nullptr;
+}
+
+void MockEncoder::updateBufferSize() {
+  auto& video = port_in_.format.video;
+  unsigned int pixels = video.nStride * video.nSliceHeight;
+  if (video.eColorFormat == OMX_COLOR_FormatYUV420PackedPlanar) {
+    port_in_.nBufferSize = pixels * 3 / 2;
+  } else {
+    port_in_.nBufferSize = pixels * 3;
+  }
+}
+
+void MockEncoder::event(OMX_EVENTTYPE evt, OMX_U32 d1, OMX_U32 d2) {
+  if (callbacks_.EventHandler) {
+    callbacks_.EventHandler(&comp, app_, evt, d1, d2, nullptr);
+  }
+}
+
+void MockEncoder::flush(OMX_U32 port) {
+
+  // hand back every buffer we are holding on that port
+  std::deque<OMX_BUFFERHEADERTYPE*> in;
+  std::deque<OMX_BUFFERHEADERTYPE*> out;
+  {
+    std::unique_lock<std::mutex> lck(lock_);
+    if (port == 200 || port == OMX_ALL) {
+      std::for_each(in_work_.begin(), in_work_.end(),
+          [&](const std::pair<OMX_BUFFERHEADERTYPE*, std::chrono::steady_clock::time_point>& w) {
+            in.push_back(w.first);
+          });
+      in_work_.clear();
+    }
+    if (port == 201 || port == OMX_ALL) {
+      out.swap(out_free_);
+    }
+  }
+  std::for_each(in.begin(), in.end(),
+      [&](OMX_BUFFERHEADERTYPE* buf) {
+        callbacks_.EmptyBufferDone(&comp, app_, buf);
+      });
+  std::for_each(out.begin(), out.end(),
+      [&](OMX_BUFFERHEADERTYPE* buf) {
+        buf->nFilledLen = 0;
+        callbacks_.FillBufferDone(&comp, app_, buf);
+      });
+}
+
+OMX_ERRORTYPE MockEncoder::sendCommand(OMX_HANDLETYPE hnd, OMX_COMMANDTYPE cmd,
+    OMX_U32 param, OMX_PTR data) {
+  MockEncoder* enc = self(hnd);
+  switch (cmd) {
+    case OMX_CommandStateSet:
+      {
+        std::unique_lock<std::mutex> lck(enc->lock_);
+        enc->state_ = static_cast<OMX_STATETYPE>(param);
+      }
+      enc->cv_.notify_all();
+      break;
+    case OMX_CommandFlush:
+      enc->flush(param);
+      break;
+    case OMX_CommandPortDisable:
+    case OMX_CommandPortEnable:
+      {
+        std::unique_lock<std::mutex> lck(enc->lock_);
+        OMX_BOOL enable = (cmd == OMX_CommandPortEnable) ? OMX_TRUE : OMX_FALSE;
+        if (param == 200 || param == OMX_ALL) {
+          enc->port_in_.bEnabled = enable;
+        }
+        if (param == 201 || param == OMX_ALL) {
+          enc->port_out_.bEnabled = enable;
+        }
+      }
+      break;
+    default:
+      return OMX_ErrorNotImplemented;
+  }
+  enc->event(OMX_EventCmdComplete, cmd, param);
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE MockEncoder::getParameter(OMX_HANDLETYPE hnd, OMX_INDEXTYPE idx, OMX_PTR param) {
+  MockEncoder* enc = self(hnd);
+  std::unique_lock<std::mutex> lck(enc->lock_);
+  switch (idx) {
+    case OMX_IndexParamVideoInit:
+      {
+        auto ports = static_cast<OMX_PORT_PARAM_TYPE*>(param);
+        ports->nStartPortNumber = 200;
+        ports->nPorts = 2;
+      }
+      break;
+    case OMX_IndexParamAudioInit:
+    case OMX_IndexParamImageInit:
+    case OMX_IndexParamOtherInit:
+      {
+        auto ports = static_cast<OMX_PORT_PARAM_TYPE*>(param);
+        ports->nStartPortNumber = 0;
+        ports->nPorts = 0;
+      }
+      break;
+    case OMX_IndexParamPortDefinition:
+      {
+        auto def = static_cast<OMX_PARAM_PORTDEFINITIONTYPE*>(param);
+        auto port = enc->findPort(def->nPortIndex);
+        if (port == nullptr) {
+          return OMX_ErrorBadParameter;
+        }
+        *def = *port;
+      }
+      break;
+    case OMX_IndexParamVideoBitrate:
+      {
+        auto rate = static_cast<OMX_VIDEO_PARAM_BITRATETYPE*>(param);
+        rate->eControlRate = OMX_Video_ControlRateVariable;
+        rate->nTargetBitrate = enc->bitrate_;
+      }
+      break;
+    default:
+      return OMX_ErrorUnsupportedIndex;
+  }
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE MockEncoder::setParameter(OMX_HANDLETYPE hnd, OMX_INDEXTYPE idx, OMX_PTR param) {
+  MockEncoder* enc = self(hnd);
+  std::unique_lock<std::mutex> lck(enc->lock_);
+  switch (idx) {
+    case OMX_IndexParamPortDefinition:
+      {
+        auto def = static_cast<OMX_PARAM_PORTDEFINITIONTYPE*>(param);
+        auto port = enc->findPort(def->nPortIndex);
+        if (port == nullptr) {
+          return OMX_ErrorBadParameter;
+        }
+        port->nBufferCountActual = std::max(def->nBufferCountActual, port->nBufferCountMin);
+        if (port == &enc->port_in_) {
+          port->format.video = def->format.video;
+          enc->updateBufferSize();
+        }
+      }
+      break;
+    case OMX_IndexParamVideoPortFormat:
+      break;
+    case OMX_IndexParamVideoBitrate:
+      enc->bitrate_ = static_cast<OMX_VIDEO_PARAM_BITRATETYPE*>(param)->nTargetBitrate;
+      break;
+    default:
+      return OMX_ErrorUnsupportedIndex;
+  }
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE MockEncoder::getConfig(OMX_HANDLETYPE hnd, OMX_INDEXTYPE idx, OMX_PTR config) {
+  return OMX_ErrorUnsupportedIndex;
+}
+
+// runtime rate changes, picked up from the next frame
+OMX_ERRORTYPE MockEncoder::setConfig(OMX_HANDLETYPE hnd, OMX_INDEXTYPE idx, OMX_PTR config) {
+  MockEncoder* enc = self(hnd);
+  std::unique_lock<std::mutex> lck(enc->lock_);
+  switch (idx) {
+    case OMX_IndexConfigVideoBitrate:
+      enc->bitrate_ = static_cast<OMX_VIDEO_CONFIG_BITRATETYPE*>(config)->nEncodeBitrate;
+      break;
+    case OMX_IndexConfigVideoFramerate:
+      enc->port_in_.format.video.xFramerate =
+        static_cast<OMX_CONFIG_FRAMERATETYPE*>(config)->xEncodeFramerate;
+      break;
+    case OMX_IndexConfigBrcmVideoRequestIFrame:
+      enc->idr_request_ = true;
+      break;
+    default:
+      return OMX_ErrorUnsupportedIndex;
+  }
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE MockEncoder::getState(OMX_HANDLETYPE hnd, OMX_STATETYPE* state) {
+  MockEncoder* enc = self(hnd);
+  std::unique_lock<std::mutex> lck(enc->lock_);
+  *state = enc->state_;
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE MockEncoder::allocateBuffer(OMX_HANDLETYPE hnd, OMX_BUFFERHEADERTYPE** buf,
+    OMX_U32 port, OMX_PTR app, OMX_U32 size) {
+  MockEncoder* enc = self(hnd);
+  if (enc->findPort(port) == nullptr) {
+    return OMX_ErrorBadParameter;
+  }
+  auto hdr = new OMX_BUFFERHEADERTYPE;
+  OMX_INIT_STRUCTURE(*hdr);
+  hdr->pBuffer = new OMX_U8[size];
+  hdr->nAllocLen = size;
+  hdr->pAppPrivate = app;
+  hdr->nInputPortIndex = (port == 200) ? port : 0;
+  hdr->nOutputPortIndex = (port == 201) ? port : 0;
+  *buf = hdr;
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE MockEncoder::freeBuffer(OMX_HANDLETYPE hnd, OMX_U32 port, OMX_BUFFERHEADERTYPE* buf) {
+  delete [] buf->pBuffer;
+  delete buf;
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE MockEncoder::emptyThisBuffer(OMX_HANDLETYPE hnd, OMX_BUFFERHEADERTYPE* buf) {
+  MockEncoder* enc = self(hnd);
+  {
+    std::unique_lock<std::mutex> lck(enc->lock_);
+    if (enc->state_ != OMX_StateExecuting) {
+      return OMX_ErrorIncorrectStateOperation;
+    }
+    enc->in_work_.push_back(std::make_pair(buf,
+          std::chrono::steady_clock::now() + std::chrono::microseconds(enc->latency_)));
+  }
+  enc->cv_.notify_all();
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE MockEncoder::fillThisBuffer(OMX_HANDLETYPE hnd, OMX_BUFFERHEADERTYPE* buf) {
+  MockEncoder* enc = self(hnd);
+  {
+    std::unique_lock<std::mutex> lck(enc->lock_);
+    if (enc->state_ != OMX_StateExecuting) {
+      return OMX_ErrorIncorrectStateOperation;
+    }
+    enc->out_free_.push_back(buf);
+  }
+  enc->cv_.notify_all();
+  return OMX_ErrorNone;
+}
+
+// spread 'len' bytes over free output buffers (called with lock_ held)
+bool MockEncoder::writeOutput(const unsigned char* data, unsigned int len,
+    OMX_TICKS stamp, OMX_U32 flags, std::unique_lock<std::mutex>& lck) {
+
+  unsigned int off = 0;
+  while (off < len) {
+    cv_.wait(lck, [&]() {
+        return quit_ || state_ != OMX_StateExecuting || out_free_.size() != 0; });
+    if (quit_ || state_ != OMX_StateExecuting) {
+      return false;
+    }
+
+    auto buf = out_free_.front();
+    out_free_.pop_front();
+    unsigned int num = std::min(len - off, buf->nAllocLen);
+    if (data) {
+      std::memcpy(buf->pBuffer, data + off, num);
+    } else {
+      std::memset(buf->pBuffer, 0xaa, num);
+    }
+    off += num;
+    buf->nOffset = 0;
+    buf->nFilledLen = num;
+    buf->nTimeStamp = stamp;
+    buf->nFlags = (off == len) ? flags : 0;
+
+    lck.unlock();
+    callbacks_.FillBufferDone(&comp, app_, buf);
+    lck.lock();
+  }
+  return true;
+}
+
+void MockEncoder::worker() {
+
+  const unsigned char config[] = {
+    0x00, 0x00, 0x00, 0x01, 0x27, 0x64, 0x00, 0x28, 0xac, 0x2b, 0x40, 0x50, 0x1e, 0xd0, 0x0f,
+    0x12, 0x26, 0xa0,
+    0x00, 0x00, 0x00, 0x01, 0x28, 0xee, 0x02, 0x5c, 0xb0
+  };
+
+  std::unique_lock<std::mutex> lck(lock_);
+  while (!quit_) {
+
+    cv_.wait(lck, [&]() {
+        return quit_ || (state_ == OMX_StateExecuting && in_work_.size() != 0); });
+    if (quit_) {
+      break;
+    }
+
+    // take the next frame, the input buffer is held until it is 'encoded'
+    auto in = in_work_.front().first;
+    auto due = in_work_.front().second;
+    in_work_.pop_front();
+    OMX_TICKS stamp = in->nTimeStamp;
+    unsigned int fps = std::max<unsigned int>(port_in_.format.video.xFramerate >> 16, 1);
+    unsigned int size = std::max<unsigned int>(bitrate_ / 8 / fps, 64);
+    // a requested idr restarts the gop
+    if (idr_request_) {
+      idr_request_ = false;
+      frame_cnt_ = 0;
+    }
+    bool idr = (frame_cnt_ % fps == 0);
+    frame_cnt_++;
+    lck.unlock();
+
+    // 'encode'
+    std::this_thread::sleep_until(due);
+    callbacks_.EmptyBufferDone(&comp, app_, in);
+    lck.lock();
+
+    // sps and pps once
+    if (!config_sent_) {
+      if (!writeOutput(config, sizeof(config), stamp,
+            OMX_BUFFERFLAG_CODECCONFIG | OMX_BUFFERFLAG_ENDOFFRAME, lck)) {
+        continue;
+      }
+      config_sent_ = true;
+    }
+
+    // one slice nal per frame
+    std::vector<unsigned char> au(size, 0xaa);
+    au[0] = 0x00;
+    au[1] = 0x00;
+    au[2] = 0x00;
+    au[3] = 0x01;
+    au[4] = idr ? 0x25 : 0x21;
+    writeOutput(au.data(), au.size(), stamp,
+        OMX_BUFFERFLAG_ENDOFFRAME | (idr ? OMX_BUFFERFLAG_SYNCFRAME : 0), lck);
+  }
+}
+
+} // namespace detector
+
+extern "C" {
+
+void bcm_host_init(void) {
+}
+
+void bcm_host_deinit(void) {
+}
+
+OMX_ERRORTYPE OMX_Init(void) {
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_Deinit(void) {
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_GetHandle(OMX_HANDLETYPE* pHandle, OMX_STRING cComponentName,
+    OMX_PTR pAppData, OMX_CALLBACKTYPE* pCallBacks) {
+  if (std::strcmp(cComponentName, "OMX.broadcom.video_encode") != 0) {
+    return OMX_ErrorComponentNotFound;
+  }
+  auto enc = new detector::MockEncoder(pAppData, pCallBacks);
+  *pHandle = &enc->comp;
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_FreeHandle(OMX_HANDLETYPE hComponent) {
+  auto comp = static_cast<OMX_COMPONENTTYPE*>(hComponent);
+  delete static_cast<detector::MockEncoder*>(comp->pComponentPrivate);
+  return OMX_ErrorNone;
+}
+
+} // extern "C"
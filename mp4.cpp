@@ -0,0 +1,354 @@
+/*
+ * Copyright © 2019 Tyler J. Brooks <tylerjbrooks@digispeaker.com> <https://www.digispeaker.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Try './detector -h' for usage.
+ */
+
+#include <cstring>
+
+#include "mp4.h"
+
+namespace detector {
+
+void Mp4::u8(std::vector<unsigned char>& out, uint8_t val) {
+  out.push_back(val);
+}
+
+void Mp4::u16(std::vector<unsigned char>& out, uint16_t val) {
+  out.push_back(val >> 8);
+  out.push_back(val);
+}
+
+void Mp4::u32(std::vector<unsigned char>& out, uint32_t val) {
+  out.push_back(val >> 24);
+  out.push_back(val >> 16);
+  out.push_back(val >> 8);
+  out.push_back(val);
+}
+
+void Mp4::u64(std::vector<unsigned char>& out, uint64_t val) {
+  u32(out, val >> 32);
+  u32(out, val);
+}
+
+void Mp4::zeros(std::vector<unsigned char>& out, unsigned int num) {
+  out.insert(out.end(), num, 0);
+}
+
+// unity transform
+void Mp4::matrix(std::vector<unsigned char>& out) {
+  const uint32_t unity[9] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+  for (auto val : unity) {
+    u32(out, val);
+  }
+}
+
+size_t Mp4::open(std::vector<unsigned char>& out, const char* type) {
+  size_t box = out.size();
+  u32(out, 0);
+  out.insert(out.end(), type, type + 4);
+  return box;
+}
+
+size_t Mp4::open(std::vector<unsigned char>& out, const char* type,
+    uint8_t version, uint32_t flags) {
+  size_t box = open(out, type);
+  u32(out, (static_cast<uint32_t>(version) << 24) | (flags & 0xffffff));
+  return box;
+}
+
+void Mp4::close(std::vector<unsigned char>& out, size_t box) {
+  uint32_t size = out.size() - box;
+  out[box + 0] = size >> 24;
+  out[box + 1] = size >> 16;
+  out[box + 2] = size >> 8;
+  out[box + 3] = size;
+}
+
+bool Mp4::init(const std::vector<unsigned char>& config, std::vector<unsigned char>& out) {
+
+  std::vector<H264::Unit> nals;
+  H264::split(config.data(), config.size(), nals);
+  H264::Unit sps(nullptr, 0);
+  H264::Unit pps(nullptr, 0);
+  for (auto& nal : nals) {
+    if (nal.second != 0 && H264::type(nal.first) == H264::Nal::kSps) {
+      sps = nal;
+    } else if (nal.second != 0 && H264::type(nal.first) == H264::Nal::kPps) {
+      pps = nal;
+    }
+  }
+  H264::Sps info;
+  if (sps.first == nullptr || pps.first == nullptr ||
+      !H264::parseSps(sps.first, sps.second, info)) {
+    return false;
+  }
+
+  out.clear();
+
+  size_t ftyp = open(out, "ftyp");
+  out.insert(out.end(), { 'i', 's', 'o', '5' });
+  u32(out, 512);
+  out.insert(out.end(), { 'i', 's', 'o', '5', 'i', 's', 'o', '6', 'a', 'v', 'c', '1', 'm', 'p', '4', '1' });
+  close(out, ftyp);
+
+  size_t moov = open(out, "moov");
+
+  size_t mvhd = open(out, "mvhd", 0, 0);
+  u32(out, 0);                                    // creation_time
+  u32(out, 0);                                    // modification_time
+  u32(out, 1000);                                 // timescale
+  u32(out, 0);                                    // duration, fragmented
+  u32(out, 0x00010000);                           // rate
+  u16(out, 0x0100);                               // volume
+  zeros(out, 10);
+  matrix(out);
+  zeros(out, 24);                                 // pre_defined
+  u32(out, 2);                                    // next_track_ID
+  close(out, mvhd);
+
+  size_t trak = open(out, "trak");
+
+  size_t tkhd = open(out, "tkhd", 0, 0x000003);   // enabled, in movie
+  u32(out, 0);
+  u32(out, 0);
+  u32(out, 1);                                    // track_ID
+  u32(out, 0);
+  u32(out, 0);                                    // duration
+  zeros(out, 8);
+  u16(out, 0);                                    // layer
+  u16(out, 0);                                    // alternate_group
+  u16(out, 0);                                    // volume
+  u16(out, 0);
+  matrix(out);
+  u32(out, info.width << 16);
+  u32(out, info.height << 16);
+  close(out, tkhd);
+
+  size_t mdia = open(out, "mdia");
+
+  size_t mdhd = open(out, "mdhd", 0, 0);
+  u32(out, 0);
+  u32(out, 0);
+  u32(out, Mp4::timescale_);
+  u32(out, 0);
+  u16(out, 0x55c4);                               // 'und'
+  u16(out, 0);
+  close(out, mdhd);
+
+  size_t hdlr = open(out, "hdlr", 0, 0);
+  u32(out, 0);
+  out.insert(out.end(), { 'v', 'i', 'd', 'e' });
+  zeros(out, 12);
+  const char name[] = "VideoHandler";
+  out.insert(out.end(), name, name + sizeof(name));
+  close(out, hdlr);
+
+  size_t minf = open(out, "minf");
+
+  size_t vmhd = open(out, "vmhd", 0, 0x000001);
+  zeros(out, 8);
+  close(out, vmhd);
+
+  size_t dinf = open(out, "dinf");
+  size_t dref = open(out, "dref", 0, 0);
+  u32(out, 1);
+  size_t url = open(out, "url ", 0, 0x000001);    // media is in this file
+  close(out, url);
+  close(out, dref);
+  close(out, dinf);
+
+  size_t stbl = open(out, "stbl");
+
+  size_t stsd = open(out, "stsd", 0, 0);
+  u32(out, 1);
+  size_t avc1 = open(out, "avc1");
+  zeros(out, 6);
+  u16(out, 1);                                    // data_reference_index
+  zeros(out, 16);
+  u16(out, info.width);
+  u16(out, info.height);
+  u32(out, 0x00480000);                           // 72 dpi
+  u32(out, 0x00480000);
+  u32(out, 0);
+  u16(out, 1);                                    // frame_count
+  zeros(out, 32);                                 // compressorname
+  u16(out, 0x0018);                               // depth
+  u16(out, 0xffff);
+  size_t avcc = open(out, "avcC");
+  u8(out, 1);                                     // configurationVersion
+  u8(out, info.profile);
+  u8(out, info.compat);
+  u8(out, info.level);
+  u8(out, 0xff);                                  // 4 byte nal lengths
+  u8(out, 0xe1);                                  // one sps
+  u16(out, sps.second);
+  out.insert(out.end(), sps.first, sps.first + sps.second);
+  u8(out, 1);                                     // one pps
+  u16(out, pps.second);
+  out.insert(out.end(), pps.first, pps.first + pps.second);
+  close(out, avcc);
+  close(out, avc1);
+  close(out, stsd);
+
+  // the samples are all in the fragments
+  size_t stts = open(out, "stts", 0, 0);
+  u32(out, 0);
+  close(out, stts);
+  size_t stsc = open(out, "stsc", 0, 0);
+  u32(out, 0);
+  close(out, stsc);
+  size_t stsz = open(out, "stsz", 0, 0);
+  u32(out, 0);
+  u32(out, 0);
+  close(out, stsz);
+  size_t stco = open(out, "stco", 0, 0);
+  u32(out, 0);
+  close(out, stco);
+
+  close(out, stbl);
+  close(out, minf);
+  close(out, mdia);
+  close(out, trak);
+
+  size_t mvex = open(out, "mvex");
+  size_t trex = open(out, "trex", 0, 0);
+  u32(out, 1);                                    // track_ID
+  u32(out, 1);                                    // default_sample_description_index
+  u32(out, 0);
+  u32(out, 0);
+  u32(out, 0);
+  close(out, trex);
+  close(out, mvex);
+
+  close(out, moov);
+
+  return true;
+}
+
+void Mp4::fragment(uint32_t seq, uint64_t decode_time, uint32_t duration, bool key,
+    const unsigned char* au, unsigned int len, std::vector<unsigned char>& out) {
+
+  // parameter sets live in the avcC, delimiters are not needed
+  std::vector<H264::Unit> nals;
+  H264::split(au, len, nals);
+  uint32_t sample_size = 0;
+  for (auto& nal : nals) {
+    H264::Nal type = H264::type(nal.first);
+    if (nal.second != 0 && type != H264::Nal::kSps &&
+        type != H264::Nal::kPps && type != H264::Nal::kAud) {
+      sample_size += 4 + nal.second;
+    }
+  }
+
+  out.clear();
+
+  size_t moof = open(out, "moof");
+
+  size_t mfhd = open(out, "mfhd", 0, 0);
+  u32(out, seq);
+  close(out, mfhd);
+
+  size_t traf = open(out, "traf");
+  size_t tfhd = open(out, "tfhd", 0, 0x020000);   // default-base-is-moof
+  u32(out, 1);
+  close(out, tfhd);
+  size_t tfdt = open(out, "tfdt", 1, 0);
+  u64(out, decode_time);
+  close(out, tfdt);
+  size_t trun = open(out, "trun", 0, 0x000701);   // offset, duration, size, flags
+  u32(out, 1);                                    // sample_count
+  size_t data_offset = out.size();
+  u32(out, 0);
+  u32(out, duration);
+  u32(out, sample_size);
+  u32(out, key ? 0x02000000 : 0x01010000);        // sync / depends on others, non sync
+  close(out, trun);
+  close(out, traf);
+
+  close(out, moof);
+
+  // data offset is from the start of the moof to the first sample byte
+  uint32_t offset = out.size() - moof + 8;
+  out[data_offset + 0] = offset >> 24;
+  out[data_offset + 1] = offset >> 16;
+  out[data_offset + 2] = offset >> 8;
+  out[data_offset + 3] = offset;
+
+  size_t mdat = open(out, "mdat");
+  for (auto& nal : nals) {
+    H264::Nal type = H264::type(nal.first);
+    if (nal.second != 0 && type != H264::Nal::kSps &&
+        type != H264::Nal::kPps && type != H264::Nal::kAud) {
+      u32(out, nal.second);
+      out.insert(out.end(), nal.first, nal.first + nal.second);
+    }
+  }
+  close(out, mdat);
+}
+
+uint32_t Mp4::get32(const unsigned char* in) {
+  return (in[0] << 24) | (in[1] << 16) | (in[2] << 8) | in[3];
+}
+
+void Mp4::put32(unsigned char* out, uint32_t val) {
+  out[0] = val >> 24;
+  out[1] = val >> 16;
+  out[2] = val >> 8;
+  out[3] = val;
+}
+
+bool Mp4::retime(std::vector<unsigned char>& moof, uint32_t seq, uint64_t& decode_time) {
+
+  // walk the boxes under moof and traf
+  bool seq_set = false, time_set = false;
+  uint32_t duration = 0;
+  size_t pos = 8;
+  size_t end = moof.size();
+  while (pos + 8 <= end) {
+    uint32_t size = Mp4::get32(&moof[pos]);
+    const unsigned char* type = &moof[pos + 4];
+    if (size < 8 || pos + size > end) {
+      return false;
+    }
+    if (std::memcmp(type, "traf", 4) == 0) {
+      end = pos + size;                           // descend
+      pos += 8;
+      continue;
+    }
+    if (std::memcmp(type, "mfhd", 4) == 0 && size >= 16) {
+      Mp4::put32(&moof[pos + 12], seq);
+      seq_set = true;
+    } else if (std::memcmp(type, "tfdt", 4) == 0 && size >= 20 && moof[pos + 8] == 1) {
+      Mp4::put32(&moof[pos + 12], decode_time >> 32);
+      Mp4::put32(&moof[pos + 16], decode_time);
+      time_set = true;
+    } else if (std::memcmp(type, "trun", 4) == 0 && size >= 24 &&
+        Mp4::get32(&moof[pos + 12]) == 1 && (moof[pos + 10] & 0x01)) {
+      unsigned int off = pos + 16;                // sample_count, then the optional fields
+      off += (moof[pos + 11] & 0x01) ? 4 : 0;     // data offset
+      off += (moof[pos + 11] & 0x04) ? 4 : 0;     // first sample flags
+      if (off + 4 <= pos + size) {
+        duration = Mp4::get32(&moof[off]);
+      }
+    }
+    pos += size;
+  }
+  decode_time += duration;
+
+  return seq_set && time_set;
+}
+
+} // namespace detector
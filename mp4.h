@@ -0,0 +1,68 @@
+/*
+ * Copyright © 2019 Tyler J. Brooks <tylerjbrooks@digispeaker.com> <https://www.digispeaker.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Try './detector -h' for usage.
+ */
+
+#ifndef MP4_H
+#define MP4_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <string>
+
+#include "h264.h"
+
+namespace detector {
+
+// Fragmented mp4 (ISO BMFF) boxes for a single h264 track.  A file is
+// an init segment (ftyp + moov with an empty sample table) followed by
+// one moof + mdat fragment per access unit.  Samples are stored with 4
+// byte nal lengths instead of start codes, times are in 'timescale_'.
+class Mp4 {
+  public:
+    static const uint32_t timescale_ = {90000};
+
+    // ftyp + moov from the annex-b sps/pps, false if there is no usable sps
+    static bool init(const std::vector<unsigned char>& config, std::vector<unsigned char>& out);
+
+    // moof + mdat holding one access unit (annex-b)
+    static void fragment(uint32_t seq, uint64_t decode_time, uint32_t duration, bool key,
+        const unsigned char* au, unsigned int len, std::vector<unsigned char>& out);
+
+    // a moof (as made by fragment()) copied into another file: set its
+    // sequence and decode time, decode_time then moves on by its duration
+    static bool retime(std::vector<unsigned char>& moof, uint32_t seq, uint64_t& decode_time);
+
+  private:
+    static uint32_t get32(const unsigned char* in);
+    static void put32(unsigned char* out, uint32_t val);
+    // big endian box writing, open() returns the offset to close()
+    static void u8(std::vector<unsigned char>& out, uint8_t val);
+    static void u16(std::vector<unsigned char>& out, uint16_t val);
+    static void u32(std::vector<unsigned char>& out, uint32_t val);
+    static void u64(std::vector<unsigned char>& out, uint64_t val);
+    static void zeros(std::vector<unsigned char>& out, unsigned int num);
+    static void matrix(std::vector<unsigned char>& out);
+    static size_t open(std::vector<unsigned char>& out, const char* type);
+    static size_t open(std::vector<unsigned char>& out, const char* type,
+        uint8_t version, uint32_t flags);
+    static void close(std::vector<unsigned char>& out, size_t box);
+};
+
+} // namespace detector
+
+#endif // MP4_H
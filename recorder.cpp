@@ -0,0 +1,366 @@
+/*
+ * Copyright © 2019 Tyler J. Brooks <tylerjbrooks@digispeaker.com> <https://www.digispeaker.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Try './detector -h' for usage.
+ */
+
+#include <time.h>
+#include <algorithm>
+
+#include "recorder.h"
+
+namespace detector {
+
+Recorder::Recorder(unsigned int yield_time)
+  : Base(yield_time) {
+}
+
+Recorder::~Recorder() {
+}
+
+std::unique_ptr<Recorder> Recorder::create(unsigned int yield_time, bool quiet,
+    const std::string& prefix, const std::set<BoxBuf::Type>& triggers,
+    unsigned int bitrate, unsigned int preroll, unsigned int postroll) {
+  auto obj = std::unique_ptr<Recorder>(new Recorder(yield_time));
+  obj->init(quiet, prefix, triggers, bitrate, preroll, postroll);
+  return obj;
+}
+
+bool Recorder::init(bool quiet, const std::string& prefix,
+    const std::set<BoxBuf::Type>& triggers, unsigned int bitrate,
+    unsigned int preroll, unsigned int postroll) {
+
+  quiet_ = quiet;
+  prefix_ = prefix;
+  triggers_ = triggers;
+  preroll_ = std::chrono::milliseconds(preroll * 1000);
+  postroll_ = std::chrono::milliseconds(postroll * 1000);
+
+  // room for the pre-roll plus a couple of gops at twice the bitrate
+  ring_.resize(std::max<uint64_t>(min_ring_,
+        static_cast<uint64_t>(bitrate) / 8 * 2 * (preroll + 4)));
+  ring_head_ = 0;
+  unit_begin_ = 0;
+  unit_skip_ = false;
+  unit_key_ = false;
+  need_key_ = true;
+  resync_ = false;
+
+  last_seen_ = std::numeric_limits<int64_t>::min() / 2;
+  fd_rec_ = nullptr;
+  next_pos_ = 0;
+
+  event_cnt_ = 0;
+  bytes_in_ = 0;
+  bytes_out_ = 0;
+  units_dropped_ = 0;
+
+  recorder_on_ = false;
+
+  return true;
+}
+
+bool Recorder::addMessage(std::shared_ptr<std::vector<BoxBuf>>& boxes) {
+
+  auto it = std::find_if(boxes->begin(), boxes->end(),
+      [&](const BoxBuf& box) { return triggers_.find(box.type) != triggers_.end(); });
+  if (it != boxes->end()) {
+    last_seen_ = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+  return true;
+}
+
+bool Recorder::addMessage(NalBuf& nal) {
+
+  std::unique_lock<std::timed_mutex> lck(ring_lock_, std::defer_lock);
+
+  if (!lck.try_lock_for(std::chrono::microseconds(Listener<NalBuf>::timeout_))) {
+    dbgMsg("recorder ring lock busy\n");
+    resync_ = true;
+    return false;
+  }
+
+  differ_copy_.begin();
+  bytes_in_ += nal.length;
+  bool eof = nal.flags & NalBuf::kEndOfFrame;
+
+  // lost a chunk: drop the partial unit and wait for an idr
+  if (resync_.exchange(false)) {
+    ring_head_ = unit_begin_;
+    unit_skip_ = true;
+    need_key_ = true;
+    units_dropped_++;
+  }
+  if (unit_skip_) {
+    unit_skip_ = !eof;
+    differ_copy_.end();
+    return true;
+  }
+
+  // sps/pps are kept aside and written at the top of each file
+  if (nal.flags & NalBuf::kConfig) {
+    config_part_.insert(config_part_.end(), nal.addr, nal.addr + nal.length);
+    if (eof) {
+      config_.swap(config_part_);
+      config_part_.clear();
+    }
+    differ_copy_.end();
+    return true;
+  }
+
+  if (ring_head_ == unit_begin_) {
+    unit_key_ = (nal.flags & NalBuf::kKeyFrame) ||
+      H264::contains(nal.addr, nal.length, H264::Nal::kIdr);
+  }
+  if (need_key_ && !unit_key_) {
+    unit_skip_ = !eof;
+    differ_copy_.end();
+    return true;
+  }
+  need_key_ = false;
+
+  // a unit that takes more than half the ring can't be pre-rolled
+  if (ring_head_ + nal.length - unit_begin_ > ring_.size() / 2) {
+    ring_head_ = unit_begin_;
+    unit_skip_ = !eof;
+    need_key_ = true;
+    units_dropped_++;
+    differ_copy_.end();
+    return true;
+  }
+
+  evict(ring_head_ + nal.length);
+  ringWrite(nal.addr, nal.length);
+
+  if (eof) {
+    units_.push_back(Recorder::Unit(unit_begin_, ring_head_ - unit_begin_,
+          unit_key_, nal.stamp));
+    unit_begin_ = ring_head_;
+  }
+  differ_copy_.end();
+
+  return true;
+}
+
+// drop the units that the next write up to 'upto' would overwrite
+void Recorder::evict(uint64_t upto) {
+  if (upto <= ring_.size()) {
+    return;
+  }
+  uint64_t limit = upto - ring_.size();
+  while (units_.size() != 0 && units_.front().pos < limit) {
+    units_.pop_front();
+  }
+}
+
+void Recorder::ringWrite(const unsigned char* data, unsigned int len) {
+  unsigned int off = ring_head_ % ring_.size();
+  unsigned int num = std::min<unsigned int>(len, ring_.size() - off);
+  std::memcpy(ring_.data() + off, data, num);
+  std::memcpy(ring_.data(), data + num, len - num);
+  ring_head_ += len;
+}
+
+void Recorder::ringRead(uint64_t pos, unsigned int len, unsigned char* dst) {
+  unsigned int off = pos % ring_.size();
+  unsigned int num = std::min<unsigned int>(len, ring_.size() - off);
+  std::memcpy(dst, ring_.data() + off, num);
+  std::memcpy(dst + num, ring_.data(), len - num);
+}
+
+// start the file at the pre-roll idr (ring lock held)
+bool Recorder::preroll() {
+
+  auto target = std::chrono::steady_clock::now() - preroll_;
+  auto start = units_.end();
+  for (auto u = units_.begin(); u != units_.end(); u++) {
+    if (u->key && (start == units_.end() || u->stamp <= target)) {
+      start = u;
+    }
+  }
+  if (start == units_.end()) {
+    return false;
+  }
+  next_pos_ = start->pos;
+  return true;
+}
+
+// copy the units from next_pos_ on to out_, up to about piece_len_
+// bytes (ring lock held)
+unsigned int Recorder::collect() {
+
+  auto it = std::find_if(units_.begin(), units_.end(),
+      [&](const Recorder::Unit& u) { return u.pos >= next_pos_; });
+  if (it != units_.end() && it->pos != next_pos_) {
+
+    // fell behind the ring, pick up again at the next idr
+    dbgMsg("recorder fell behind\n");
+    units_dropped_++;
+    it = std::find_if(it, units_.end(),
+        [](const Recorder::Unit& u) { return u.key; });
+  }
+
+  unsigned int len = 0;
+  auto end = it;
+  for (; end != units_.end() && (len == 0 || len + end->len <= piece_len_); end++) {
+    len += end->len;
+  }
+  out_.resize(len);
+  len = 0;
+  for (; it != end; it++) {
+    ringRead(it->pos, it->len, out_.data() + len);
+    len += it->len;
+    next_pos_ = it->pos + it->len;
+  }
+  return len;
+}
+
+bool Recorder::openFile() {
+
+  // sps/pps go first
+  {
+    std::unique_lock<std::timed_mutex> lck(ring_lock_);
+    if (!preroll()) {
+      return false;
+    }
+    out_.assign(config_.begin(), config_.end());
+  }
+
+  char stamp[32];
+  time_t t = time(nullptr);
+  strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", localtime(&t));
+  std::string fname = prefix_ + "_" + stamp + ".h264";
+  fd_rec_ = fopen(fname.c_str(), "wb");
+  if (fd_rec_ == nullptr) {
+    dbgMsg("failed: create recording %s\n", fname.c_str());
+    return false;
+  }
+  if (!quiet_) {
+    fprintf(stderr, "\nrecording %s\n", fname.c_str());
+  }
+  event_cnt_++;
+
+  // then the pre-roll, a piece at a time
+  differ_write_.begin();
+  bytes_out_ += fwrite(out_.data(), 1, out_.size(), fd_rec_);
+  unsigned int len = 0;
+  do {
+    {
+      std::unique_lock<std::timed_mutex> lck(ring_lock_);
+      len = collect();
+    }
+    bytes_out_ += fwrite(out_.data(), 1, len, fd_rec_);
+  } while (len != 0);
+  differ_write_.end();
+
+  return true;
+}
+
+bool Recorder::closeFile() {
+  if (fd_rec_ != nullptr) {
+    fclose(fd_rec_);
+    fd_rec_ = nullptr;
+  }
+  return true;
+}
+
+bool Recorder::waitingToRun() {
+
+  if (!recorder_on_) {
+    differ_tot_.begin();
+    recorder_on_ = true;
+  }
+
+  return true;
+}
+
+bool Recorder::running() {
+
+  if (recorder_on_) {
+
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    bool active = now - last_seen_ < postroll_.count();
+
+    if (fd_rec_ == nullptr) {
+      if (active) {
+        phase("open");
+        openFile();
+      }
+    } else {
+
+      // keep the file up to date...
+      unsigned int len = 0;
+      {
+        std::unique_lock<std::timed_mutex> lck(ring_lock_);
+        len = collect();
+      }
+      if (len != 0) {
+        phase("write");
+        differ_write_.begin();
+        bytes_out_ += fwrite(out_.data(), 1, len, fd_rec_);
+        differ_write_.end();
+      }
+
+      // ... until the post-roll runs out
+      if (!active) {
+        phase("close");
+        closeFile();
+      }
+    }
+  }
+
+  return true;
+}
+
+bool Recorder::paused() {
+  return true;
+}
+
+bool Recorder::waitingToHalt() {
+
+  if (recorder_on_) {
+    recorder_on_ = false;
+    differ_tot_.end();
+
+    closeFile();
+
+    // report
+    if (!quiet_) {
+      fprintf(stderr, "\nRecorder Results...\n");
+      fprintf(stderr, "           events recorded: %u\n", event_cnt_);
+      fprintf(stderr, "             bytes encoded: %llu\n",
+          static_cast<unsigned long long>(bytes_in_));
+      fprintf(stderr, "             bytes written: %llu (%.1f%%)\n",
+          static_cast<unsigned long long>(bytes_out_),
+          bytes_in_ ? 100.0 * bytes_out_ / bytes_in_ : 0.0);
+      fprintf(stderr, "      access units dropped: %u\n", units_dropped_);
+      fprintf(stderr, "   ring copy time (us): high:%u avg:%u low:%u cnt:%u\n",
+          differ_copy_.high, differ_copy_.avg,
+          differ_copy_.low,  differ_copy_.cnt);
+      fprintf(stderr, "  file write time (us): high:%u avg:%u low:%u cnt:%u\n",
+          differ_write_.high, differ_write_.avg,
+          differ_write_.low,  differ_write_.cnt);
+      fprintf(stderr, "       total test time: %f sec\n",
+          differ_tot_.avg / 1000000.f);
+      fprintf(stderr, "\n");
+    }
+  }
+
+  return true;
+}
+
+} // namespace detector
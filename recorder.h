@@ -0,0 +1,142 @@
+/*
+ * Copyright © 2019 Tyler J. Brooks <tylerjbrooks@digispeaker.com> <https://www.digispeaker.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Try './detector -h' for usage.
+ */
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <set>
+#include <chrono>
+
+#include "utils.h"
+#include "listener.h"
+#include "base.h"
+#include "h264.h"
+
+namespace detector {
+
+// Event recorder.  The encoder's access units go into a fixed size
+// byte ring that holds at least 'preroll' seconds of video.  When a
+// box of one of the trigger types shows up the recorder opens a new
+// file, starting at the newest IDR that is at least 'preroll' old,
+// and keeps writing until no trigger box has been seen for 'postroll'
+// seconds.  Files are named '<prefix>_YYYYMMDD_HHMMSS.h264'.
+class Recorder : public Base,
+  public Listener<NalBuf>,
+  public Listener<std::shared_ptr<std::vector<BoxBuf>>> {
+  public:
+    static std::unique_ptr<Recorder> create(unsigned int yield_time, bool quiet,
+        const std::string& prefix, const std::set<BoxBuf::Type>& triggers,
+        unsigned int bitrate, unsigned int preroll, unsigned int postroll);
+    virtual ~Recorder();
+
+  public:
+    virtual bool addMessage(NalBuf& nal);
+    virtual bool addMessage(std::shared_ptr<std::vector<BoxBuf>>& boxes);
+
+  protected:
+    Recorder() = delete;
+    Recorder(unsigned int yield_time);
+    bool init(bool quiet, const std::string& prefix,
+        const std::set<BoxBuf::Type>& triggers, unsigned int bitrate,
+        unsigned int preroll, unsigned int postroll);
+
+  protected:
+    virtual bool waitingToRun();
+    virtual bool running();
+    virtual bool paused();
+    virtual bool waitingToHalt();
+
+  private:
+    bool quiet_;
+    std::string prefix_;
+    std::set<BoxBuf::Type> triggers_;
+    std::chrono::milliseconds preroll_;
+    std::chrono::milliseconds postroll_;
+
+    // access units live in ring_ at [pos, pos + len) modulo its size,
+    // positions only ever grow so a stale reader is easy to spot
+    class Unit {
+      public:
+        Unit() = default;
+        Unit(uint64_t p, unsigned int l, bool k, std::chrono::steady_clock::time_point s)
+          : pos(p), len(l), key(k), stamp(s) {}
+        ~Unit() {}
+      public:
+        uint64_t pos;
+        unsigned int len;
+        bool key;
+        std::chrono::steady_clock::time_point stamp;
+    };
+
+    std::timed_mutex ring_lock_;
+    std::vector<unsigned char> ring_;
+    uint64_t ring_head_;                   // write position
+    uint64_t unit_begin_;                  // start of the access unit being written
+    bool unit_skip_;                       // current access unit did not fit
+    bool unit_key_;                        // current access unit is an idr
+    bool need_key_;                        // ring restarts at the next idr
+    std::deque<Recorder::Unit> units_;     // oldest first
+    std::vector<unsigned char> config_;    // latest sps/pps
+    std::vector<unsigned char> config_part_;
+    std::atomic<bool> resync_;             // dropped a chunk, wait for the next idr
+
+    void ringWrite(const unsigned char* data, unsigned int len);
+    void ringRead(uint64_t pos, unsigned int len, unsigned char* dst);
+    void evict(uint64_t upto);
+
+    // recording
+    std::atomic<int64_t> last_seen_;       // ms since epoch of the last trigger box
+    const unsigned int min_ring_ = {4 * 1024 * 1024};
+    FILE* fd_rec_;
+    uint64_t next_pos_;                    // next unit to write
+    std::vector<unsigned char> out_;
+
+    // the ring lock is only held for a piece at a time, the encoder
+    // gives up on it after Listener::timeout_
+    const unsigned int piece_len_ = {256 * 1024};
+
+    bool openFile();
+    bool closeFile();
+    bool preroll();
+    unsigned int collect();
+
+    unsigned int event_cnt_;
+    uint64_t bytes_in_;
+    uint64_t bytes_out_;
+    unsigned int units_dropped_;
+
+    std::atomic<bool> recorder_on_;
+
+    MicroDiffer<uint32_t> differ_copy_;
+    MicroDiffer<uint32_t> differ_write_;
+    MicroDiffer<uint32_t> differ_tot_;
+};
+
+} // namespace detector
+
+#endif // RECORDER_H
@@ -20,12 +20,14 @@
 #include <cstring>
 #include <algorithm>
 
+#include "h264.h"
+#include "encoder.h"
 #include "rtsp.h"
 
 namespace detector {
 
 LiveSource::LiveSource(UsageEnvironment* env, Rtsp* owner) 
-  : FramedSource(*env), env_(env), owner_(owner) {
+  : FramedSource(*env), evt_id_(0), env_(env), owner_(owner) {
 
   if (evt_id_ == 0) {
     evt_id_ = env_->taskScheduler().createEventTrigger(deliverFrame0);
@@ -40,7 +42,7 @@ LiveSource::~LiveSource() {
 }
 
 void LiveSource::doGetNextFrame() {
-  if (owner_->live_watch_) {
+  if (owner_->liveClosing()) {
     dbgMsg("doGetNextFrame: shutting down\n");
     handleClosure();
     return;
@@ -62,33 +64,108 @@ void LiveSource::deliverFrame() {
   }
 }
 
+LiveSubsession::LiveSubsession(RTPSink& sink, RTCPInstance* rtcp, Rtsp* owner)
+  : PassiveServerMediaSubsession(sink, rtcp), owner_(owner) {
+}
+
+void LiveSubsession::startStream(unsigned client_session_id, void* stream_token,
+    TaskFunc* rtcp_rr_handler, void* rtcp_rr_handler_data,
+    unsigned short& rtp_seq_num, unsigned& rtp_timestamp,
+    ServerRequestAlternativeByteHandler* alt_byte_handler,
+    void* alt_byte_handler_data) {
+  PassiveServerMediaSubsession::startStream(client_session_id, stream_token,
+      rtcp_rr_handler, rtcp_rr_handler_data, rtp_seq_num, rtp_timestamp,
+      alt_byte_handler, alt_byte_handler_data);
+  owner_->newSession();
+}
+
 
 Rtsp::Rtsp(unsigned int yield_time)
-  : Base(yield_time) {
+  : Base(yield_time, false) {
 }
 
 Rtsp::~Rtsp() {
 }
 
 std::unique_ptr<Rtsp> Rtsp::create(unsigned int yield_time, bool quiet, 
-    unsigned int bitrate, unsigned int framerate, std::string& unicast) {
+    unsigned int bitrate, unsigned int framerate, RtspServer* server,
+    const std::string& session, unsigned short rtp_port) {
   auto obj = std::unique_ptr<Rtsp>(new Rtsp(yield_time));
-  obj->init(quiet, bitrate, framerate, unicast);
+  obj->init(quiet, bitrate, framerate, server, session, rtp_port);
   return obj;
 }
 
 bool Rtsp::init(bool quiet, unsigned int bitrate, unsigned int framerate, 
-    std::string& unicast) {
+    RtspServer* server, const std::string& session, unsigned short rtp_port) {
 
   quiet_ = quiet;
   bitrate_ = bitrate;
   framerate_ = framerate;
-  unicast_ = unicast;
+  server_ = server;
+  session_ = session;
+  rtp_port_ = rtp_port;
+  env_ = nullptr;
+  live_src_ = nullptr;
+  video_snk_ = nullptr;
+  rtcp_ = nullptr;
+  video_src_ = nullptr;
+  enc_ = nullptr;
   rtsp_on_ = false;
 
-  return true; 
+  return server_->addStream(this);
+}
+
+// at most two pieces around the end of the ring
+void Rtsp::ringWrite(const void* src, unsigned int len) {
+  const unsigned char* data = static_cast<const unsigned char*>(src);
+  unsigned int pos = ring_head_ % ring_len_;
+  unsigned int cnt = std::min(len, ring_len_ - pos);
+  std::memcpy(ring_.data() + pos, data, cnt);
+  std::memcpy(ring_.data(), data + cnt, len - cnt);
+  ring_head_ += len;
+}
+
+void Rtsp::ringRead(void* dst, unsigned int len) {
+  unsigned char* data = static_cast<unsigned char*>(dst);
+  unsigned int pos = ring_tail_ % ring_len_;
+  unsigned int cnt = std::min(len, ring_len_ - pos);
+  std::memcpy(data, ring_.data() + pos, cnt);
+  std::memcpy(data + cnt, ring_.data(), len - cnt);
+  ring_tail_ += len;
+}
+
+void Rtsp::keyFrames(Encoder* enc) {
+  enc_ = enc;
+}
+
+// live thread, a new client can't decode anything before an idr
+void Rtsp::newSession() {
+  sessions_++;
+  if (enc_ != nullptr) {
+    enc_->requestKeyFrame();
+  }
+}
+
+bool Rtsp::paramSets(std::vector<unsigned char>& sps, std::vector<unsigned char>& pps) {
+  std::unique_lock<std::timed_mutex> lck(nal_lock_);
+  sps = sps_;
+  pps = pps_;
+  return sps.size() != 0 && pps.size() != 0;
 }
 
+// called locked, space already checked
+bool Rtsp::ringNal(const void* nal, unsigned int len, int64_t pts) {
+  Rtsp::Record rec;
+  rec.length = len;
+  rec.pad = 0;
+  rec.pts = pts;
+  ringWrite(&rec, sizeof(rec));
+  ringWrite(nal, len);
+  nals_queued_++;
+  return true;
+}
+
+// one nal per message
 bool Rtsp::addMessage(NalBuf& nal) {
 
   std::unique_lock<std::timed_mutex> lck(nal_lock_, std::defer_lock);
@@ -98,73 +175,90 @@ bool Rtsp::addMessage(NalBuf& nal) {
     return false;
   }
 
-  // drop a queued frame if the pool is empty
-  std::shared_ptr<Rtsp::RtspNal> rtsp_nal;
-  if (nal_pool_.size() == 0) {
-    dbgMsg("dropping back.  queue size: %d\n", nal_work_.size());
-    rtsp_nal = nal_work_.back();
-    nal_work_.pop_back();
-  } else {
-    rtsp_nal = nal_pool_.front();
-    nal_pool_.pop_front();
+  if (!rtsp_on_ || nal.length == 0) {
+    return false;
+  }
+
+  H264::Nal type = H264::type(nal.addr);
+  const unsigned char* addr = static_cast<const unsigned char*>(nal.addr);
+  if (type == H264::Nal::kSps) {
+    sps_.assign(addr, addr + nal.length);
+  } else if (type == H264::Nal::kPps) {
+    pps_.assign(addr, addr + nal.length);
   }
 
-  if (nal.length > rtsp_nal->nal.size()) {
-    dbgMsg("--------------------------resize nal: sz=%d\n", nal.length);
-    rtsp_nal->nal.resize(nal.length, 0);
+  // a requested idr comes without parameter sets
+  bool params = (type == H264::Nal::kIdr &&
+      last_type_ != H264::Nal::kSps && last_type_ != H264::Nal::kPps &&
+      last_type_ != H264::Nal::kIdr && sps_.size() != 0 && pps_.size() != 0);
+  last_type_ = type;
+
+  // after a drop wait for an idr, parameter sets still go through
+  if (skip_ && type == H264::Nal::kIdr) {
+    skip_ = false;
+  }
+  if (skip_ && type != H264::Nal::kSps && type != H264::Nal::kPps) {
+    nals_dropped_++;
+    return false;
   }
-  std::memcpy(rtsp_nal->nal.data(), nal.addr, nal.length);
-  rtsp_nal->length = nal.length;
 
-  nal_work_.push_back(rtsp_nal);
+  unsigned int used = ring_head_ - ring_tail_;
+  bool wake = (used == 0);
+  unsigned int len = sizeof(Rtsp::Record) + nal.length;
+  if (params) {
+    len += 2 * sizeof(Rtsp::Record) + sps_.size() + pps_.size();
+  }
+  if (len > ring_len_ - used) {
+    dbgMsg("rtsp ring full: %u + %u\n", used, len);
+    nals_dropped_++;
+    skip_ = true;
+    return false;
+  }
 
-// moved to rtsp::running loop
-//  env_->taskScheduler().triggerEvent(live_src_->evt_id_, live_src_);
+  int64_t pts = std::chrono::duration_cast<std::chrono::microseconds>(
+      nal.stamp.time_since_epoch() + clock_offset_).count();
+  if (params) {
+    ringNal(sps_.data(), sps_.size(), pts);
+    ringNal(pps_.data(), pps_.size(), pts);
+  }
+  ringNal(nal.addr, nal.length, pts);
+
+  ring_max_ = std::max(ring_max_, used + len);
+
+  // live555 keeps asking for nals until the ring is empty, so it only
+  // needs a nudge when the first one goes in
+  if (wake) {
+    env_->taskScheduler().triggerEvent(live_src_->evt_id_, live_src_);
+    triggers_++;
+  }
   return true;
 }
 
 bool Rtsp::deliverFrame(unsigned int& max_size, unsigned int& frame_size, 
     unsigned int& trunc, struct timeval& pts, unsigned int& duration, unsigned char* to) {
 
-  std::unique_lock<std::timed_mutex> lck(nal_lock_, std::defer_lock);
+  // wait out the encoder's copy, a missed nal would sit in the
+  // ring until the next trigger
+  std::unique_lock<std::timed_mutex> lck(nal_lock_);
 
-  if (!lck.try_lock_for(std::chrono::microseconds(nal_timeout_))) {
-    dbgMsg("deliver frame nal lock busy\n");
+  if (ring_head_ == ring_tail_) {
     return false;
   }
 
-  if (nal_work_.size() != 0) {
-
-    auto rtsp_nal = nal_work_.front();
-    nal_work_.pop_front();
-
-    if (rtsp_nal->length > max_size) {
-      frame_size = max_size;
-      trunc = rtsp_nal->length - max_size;
-      if (overflow_.size() < trunc + overflow_len_) {
-        overflow_.resize(trunc + overflow_len_);
-      }
-      memcpy(overflow_.data() + overflow_len_, rtsp_nal->nal.data() + frame_size, trunc);
-      overflow_len_ += trunc;
-    } else {
-      frame_size = rtsp_nal->length;
-      if (overflow_len_) {
-        auto it = rtsp_nal->nal.begin();
-        rtsp_nal->nal.insert(it, overflow_len_, 0);
-        memcpy(rtsp_nal->nal.data(), overflow_.data(), overflow_len_);
-        frame_size += overflow_len_;
-        overflow_len_ = 0;
-      }
-    }
-    gettimeofday(&pts, NULL);
-    duration = 0;
-//    duration = 1000000 / framerate_;
-    memcpy(to, rtsp_nal->nal.data(), frame_size);
-    nal_pool_.push_back(rtsp_nal);
-    return true;
-  }
-
-  return false;
+  // a nal bigger than live555's buffer can only be truncated
+  Rtsp::Record rec;
+  ringRead(&rec, sizeof(rec));
+  frame_size = std::min<unsigned int>(rec.length, max_size);
+  trunc = rec.length - frame_size;
+  ringRead(to, frame_size);
+  ring_tail_ += trunc;
+  bytes_sent_ += frame_size;
+
+  // the nals of an access unit share the encoder's time stamp
+  pts.tv_sec = rec.pts / 1000000;
+  pts.tv_usec = rec.pts % 1000000;
+  duration = 0;
+  return true;
 }
 
 bool Rtsp::deliverFrame0(Rtsp* self, unsigned int& max_size, unsigned int& frame_size, 
@@ -172,26 +266,39 @@ bool Rtsp::deliverFrame0(Rtsp* self, unsigned int& max_size, unsigned int& frame
   return self->deliverFrame(max_size, frame_size, trunc, pts, duration, to);
 }
 
-void Rtsp::liveProc() {
-  // create task scheduler and environment
-  dbgMsg("create task scheduler and environment\n");
-  auto schd = std::unique_ptr<BasicTaskScheduler>(BasicTaskScheduler::createNew());
-  env_ = BasicUsageEnvironment::createNew(*schd.get());
+void Rtsp::liveCreate(UsageEnvironment* env) {
+  env_ = env;
+  live_src_ = LiveSource::createNew(env_, this);
+}
+
+bool Rtsp::liveClosing() {
+  return server_->live_watch_;
+}
+
+// false until the encoder's sps/pps have come through, the sink
+// puts them in the sdp
+bool Rtsp::liveSetup(RTSPServer* rtsp_server, const std::string& unicast) {
+
+  std::vector<unsigned char> sps;
+  std::vector<unsigned char> pps;
+  if (!paramSets(sps, pps)) {
+    return false;
+  }
 
   // unicast or multicast address
   dbgMsg("unicast or multicast address\n");
   struct in_addr dst_addr;
-  if (unicast_.empty()) {
+  if (unicast.empty()) {
     dbgMsg("  multicast address\n");
     dst_addr.s_addr = chooseRandomIPv4SSMAddress(*env_);
   } else {
     dbgMsg("  unicast address\n");
-    dst_addr.s_addr = our_inet_addr(unicast_.c_str());
+    dst_addr.s_addr = our_inet_addr(unicast.c_str());
   }
  
   // create ports
   dbgMsg("create ports\n");
-  const unsigned short rtpPortNum = 18888;
+  const unsigned short rtpPortNum = rtp_port_;
   const unsigned short rtcpPortNum = rtpPortNum+1;
   const unsigned char ttl = 255;
   const Port rtpPort(rtpPortNum);
@@ -199,18 +306,18 @@ void Rtsp::liveProc() {
 
   // create sockets
   dbgMsg("create sockets\n");
-  Groupsock rtp_sock(*env_, dst_addr, rtpPort, ttl);
-  Groupsock rtcp_sock(*env_, dst_addr, rtcpPort, ttl);
-  if (unicast_.empty()) {
-    rtp_sock.multicastSendOnly();
-    rtcp_sock.multicastSendOnly();
+  rtp_sock_ = std::make_unique<Groupsock>(*env_, dst_addr, rtpPort, ttl);
+  rtcp_sock_ = std::make_unique<Groupsock>(*env_, dst_addr, rtcpPort, ttl);
+  if (unicast.empty()) {
+    rtp_sock_->multicastSendOnly();
+    rtcp_sock_->multicastSendOnly();
   }
 
   // create video sink
   dbgMsg("create video sink\n");
-  OutPacketBuffer::maxSize = output_max_;
-  RTPSink* video_snk = H264VideoRTPSink::createNew(*env_, &rtp_sock, 96);
-  if (video_snk == nullptr) {
+  video_snk_ = H264VideoRTPSink::createNew(*env_, rtp_sock_.get(), 96,
+      sps.data(), sps.size(), pps.data(), pps.size());
+  if (video_snk_ == nullptr) {
     dbgMsg("failed:  create video sink\n");
   }
 
@@ -218,25 +325,18 @@ void Rtsp::liveProc() {
   dbgMsg("create rtcp\n");
   std::vector<char> cname(cname_len_, 0);
   gethostname(cname.data(), cname_len_);
-  RTCPInstance* rtcp = RTCPInstance::createNew(*env_, &rtcp_sock,
-    bitrate_ * 10 / 1000, (unsigned char*)cname.data(), video_snk, NULL, 
-    unicast_.empty() ? True : False);
-  if (rtcp == nullptr) {
+  rtcp_ = RTCPInstance::createNew(*env_, rtcp_sock_.get(),
+    bitrate_ * 10 / 1000, (unsigned char*)cname.data(), video_snk_, NULL, 
+    unicast.empty() ? True : False);
+  if (rtcp_ == nullptr) {
     dbgMsg("failed:  create rtcp\n");
   }
 
-  // create rtsp server
-  dbgMsg("create rtsp server\n");
-  RTSPServer* rtsp_server = RTSPServer::createNew(*env_, 8554);
-  if (rtsp_server == nullptr) {
-    dbgMsg("failed: create RTSP server %s\n", env_->getResultMsg());
-  }
-
   // create media session
   dbgMsg("create media session\n");
-  ServerMediaSession* sms = ServerMediaSession::createNew(*env_, "camera", "detector",
-      "Session streamed by -detector-", unicast_.empty() ? True : False);
-  sms->addSubsession(PassiveServerMediaSubsession::createNew(*video_snk, rtcp));
+  ServerMediaSession* sms = ServerMediaSession::createNew(*env_, session_.c_str(), "detector",
+      "Session streamed by -detector-", unicast.empty() ? True : False);
+  sms->addSubsession(LiveSubsession::createNew(*video_snk_, rtcp_, this));
   rtsp_server->addServerMediaSession(sms);
 
   // display stream url
@@ -247,46 +347,63 @@ void Rtsp::liveProc() {
 
   // start play
   dbgMsg("start play...\n");
-  live_src_ = LiveSource::createNew(env_, this);
-  H264VideoStreamFramer* video_src = 
-    H264VideoStreamFramer::createNew(*env_, live_src_, False);
-  video_snk->startPlaying(*video_src, afterPlay, video_snk);
+  video_src_ = H264VideoStreamDiscreteFramer::createNew(*env_, live_src_);
+  video_snk_->startPlaying(*video_src_, afterPlay, video_snk_);
 
-  // run until cancelled
-  live_sem_.post();
-  env_->taskScheduler().doEventLoop(&live_watch_);
+  return true;
+}
 
-  // shutdown
-  dbgMsg("rtsp shutdown\n");
-  video_snk->stopPlaying();
-  Medium::close(video_snk);
-  Medium::close(video_src);
-  Medium::close(rtsp_server);
-  Medium::close(rtcp);
-  env_->reclaim();
+void Rtsp::liveStop() {
+  if (video_snk_ != nullptr) {
+    video_snk_->stopPlaying();
+    Medium::close(video_snk_);
+    video_snk_ = nullptr;
+  }
+
+  // the framer closes the live source with it
+  if (video_src_ != nullptr) {
+    Medium::close(video_src_);
+    video_src_ = nullptr;
+  } else if (live_src_ != nullptr) {
+    Medium::close(live_src_);
+  }
 }
 
-void Rtsp::liveProc0(Rtsp* self) {
-  self->liveProc();
+// after the rtsp server is gone
+void Rtsp::liveClose() {
+  if (rtcp_ != nullptr) {
+    Medium::close(rtcp_);
+    rtcp_ = nullptr;
+  }
+  rtp_sock_.reset();
+  rtcp_sock_.reset();
 }
 
 bool Rtsp::waitingToRun() {
 
   if (!rtsp_on_) {
 
-    // create nal pool
-    dbgMsg("create nal pool\n");
-    for (unsigned int i = 0; i < nal_num_; i++) {
-      nal_pool_.push_back(std::shared_ptr<Rtsp::RtspNal>(new RtspNal(nal_len_)));
-    }
-
-    // launch live thread
-    dbgMsg("launch live thread\n");
-    live_watch_ = 0;
-    live_ = std::thread(liveProc0, this);
-
-    // wait...
-    live_sem_.wait();
+    // the live thread is already up and reading
+    std::unique_lock<std::timed_mutex> lck(nal_lock_);
+
+    // create nal ring
+    dbgMsg("create nal ring\n");
+    ring_.resize(ring_len_);
+    ring_head_ = 0;
+    ring_tail_ = 0;
+    clock_offset_ = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch() -
+        std::chrono::steady_clock::now().time_since_epoch());
+    skip_ = false;
+    sps_.clear();
+    pps_.clear();
+    last_type_ = H264::Nal::kSlice;
+    sessions_ = 0;
+    nals_queued_ = 0;
+    nals_dropped_ = 0;
+    triggers_ = 0;
+    ring_max_ = 0;
+    bytes_sent_ = 0;
 
     // begin streaming
     dbgMsg("begin streaming\n");
@@ -300,35 +417,161 @@ void Rtsp::afterPlay(void* data) {
   dbgMsg("afterPlay\n");
 }
 
-bool Rtsp::running() {
+bool Rtsp::waitingToHalt() {
+
   if (rtsp_on_) {
-    env_->taskScheduler().triggerEvent(live_src_->evt_id_, live_src_);
-//    std::unique_lock<std::timed_mutex> lck(nal_lock_, std::defer_lock);
-//    if (lck.try_lock_for(std::chrono::microseconds(Listener::timeout_))) {
-//      if (nal_work_.size() != 0) {
-//        env_->taskScheduler().triggerEvent(live_src_->evt_id_, live_src_);
-//        std::this_thread::sleep_for(std::chrono::microseconds(100));
-//        env_->taskScheduler().triggerEvent(live_src_->evt_id_, live_src_);
-//      }
-//    }
+
+    // no more triggers, the live thread may still empty the ring
+    {
+      std::unique_lock<std::timed_mutex> lck(nal_lock_);
+      rtsp_on_ = false;
+    }
+
+    // report
+    if (!quiet_) {
+      fprintf(stderr, "\nRtsp Results (%s)...\n", session_.c_str());
+      fprintf(stderr, "        sessions: %u\n", sessions_.load());
+      fprintf(stderr, "     nals queued: %u\n", nals_queued_);
+      fprintf(stderr, "    nals dropped: %u\n", nals_dropped_);
+      fprintf(stderr, "   live triggers: %u\n", triggers_);
+      fprintf(stderr, "      bytes sent: %llu\n",
+          static_cast<unsigned long long>(bytes_sent_));
+      fprintf(stderr, "  max ring bytes: %u of %u\n", ring_max_, ring_len_);
+      fprintf(stderr, "\n");
+    }
   }
+
   return true;
 }
 
-bool Rtsp::paused() {
+
+RtspServer::RtspServer(unsigned int yield_time)
+  : Base(yield_time, false) {
+}
+
+RtspServer::~RtspServer() {
+}
+
+std::unique_ptr<RtspServer> RtspServer::create(unsigned int yield_time, bool quiet,
+    std::string& unicast, unsigned short port) {
+  auto obj = std::unique_ptr<RtspServer>(new RtspServer(yield_time));
+  obj->init(quiet, unicast, port);
+  return obj;
+}
+
+bool RtspServer::init(bool quiet, std::string& unicast, unsigned short port) {
+
+  quiet_ = quiet;
+  unicast_ = unicast;
+  port_ = port;
+  env_ = nullptr;
+  rtsp_server_ = nullptr;
+  server_on_ = false;
+
   return true;
 }
 
-bool Rtsp::waitingToHalt() {
+bool RtspServer::addStream(Rtsp* stream) {
+  if (server_on_) {
+    dbgMsg("failed: rtsp server already running\n");
+    return false;
+  }
+  streams_.push_back(stream);
+  return true;
+}
 
-  if (rtsp_on_) {
+void RtspServer::setupStreams0(void* data) {
+  RtspServer* self = static_cast<RtspServer*>(data);
+  self->setupStreams();
+}
+
+void RtspServer::setupStreams() {
+  bool waiting = false;
+  for (unsigned int i = 0; i < streams_.size(); i++) {
+    if (!ready_[i]) {
+      ready_[i] = streams_[i]->liveSetup(rtsp_server_, unicast_);
+      waiting = waiting || !ready_[i];
+    }
+  }
+  if (waiting) {
+    env_->taskScheduler().scheduleDelayedTask(setup_time_, setupStreams0, this);
+  }
+}
+
+void RtspServer::liveProc() {
+  // create task scheduler and environment
+  dbgMsg("create task scheduler and environment\n");
+  auto schd = std::unique_ptr<BasicTaskScheduler>(BasicTaskScheduler::createNew());
+  env_ = BasicUsageEnvironment::createNew(*schd.get());
+
+  // sessions can queue nals from here on
+  for (auto stream : streams_) {
+    stream->liveCreate(env_);
+  }
+
+  // create rtsp server
+  dbgMsg("create rtsp server\n");
+  OutPacketBuffer::maxSize = output_max_;
+  rtsp_server_ = RTSPServer::createNew(*env_, port_);
+  if (rtsp_server_ == nullptr) {
+    dbgMsg("failed: create RTSP server %s\n", env_->getResultMsg());
+  }
+
+  // run until cancelled
+  ready_.assign(streams_.size(), false);
+  env_->taskScheduler().scheduleDelayedTask(0, setupStreams0, this);
+  live_sem_.post();
+  env_->taskScheduler().doEventLoop(&live_watch_);
+
+  // shutdown
+  dbgMsg("rtsp shutdown\n");
+  for (auto stream : streams_) {
+    stream->liveStop();
+  }
+  Medium::close(rtsp_server_);
+  for (auto stream : streams_) {
+    stream->liveClose();
+  }
+  env_->reclaim();
+}
+
+void RtspServer::liveProc0(RtspServer* self) {
+  self->liveProc();
+}
+
+bool RtspServer::waitingToRun() {
+
+  if (!server_on_) {
+
+    // launch live thread
+    dbgMsg("launch live thread\n");
+    server_on_ = true;
+    live_watch_ = 0;
+    live_ = std::thread(liveProc0, this);
+
+    // wait...
+    live_sem_.wait();
+  }
+
+  return true;
+}
+
+bool RtspServer::waitingToHalt() {
+
+  if (server_on_) {
 
     // kill live thread
     dbgMsg("kill live thread\n");
     live_watch_ = 1;
     live_.join();
+    server_on_ = false;
 
-    rtsp_on_ = false;
+    // report
+    if (!quiet_) {
+      fprintf(stderr, "\nRtsp Server Results (port %u)...\n", port_);
+      fprintf(stderr, "  sessions served: %u\n", static_cast<unsigned int>(streams_.size()));
+      fprintf(stderr, "\n");
+    }
   }
 
   return true;
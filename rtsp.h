@@ -20,7 +20,6 @@
 #define RTSP_H
 
 #include <string>
-#include <deque>
 #include <memory>
 #include <atomic>
 #include <thread>
@@ -30,6 +29,7 @@
 #include "utils.h"
 #include "listener.h"
 #include "base.h"
+#include "h264.h"
 
 #include "liveMedia.hh"
 #include "BasicUsageEnvironment.hh"
@@ -39,6 +39,8 @@
 namespace detector {
 
 class Rtsp;
+class RtspServer;
+class Encoder;
 class LiveSource : public FramedSource {
   public:
     static LiveSource* createNew(UsageEnvironment* env, Rtsp* owner) {
@@ -62,25 +64,51 @@ class LiveSource : public FramedSource {
     void deliverFrame();
 };
 
-class Rtsp : public Base, Listener<NalBuf> {
+// tells the owner when a client starts playing
+class LiveSubsession : public PassiveServerMediaSubsession {
+  public:
+    static LiveSubsession* createNew(RTPSink& sink, RTCPInstance* rtcp, Rtsp* owner) {
+      return new LiveSubsession(sink, rtcp, owner);
+    }
+
+  protected:
+    LiveSubsession(RTPSink& sink, RTCPInstance* rtcp, Rtsp* owner);
+
+  private:
+    Rtsp* owner_;
+    virtual void startStream(unsigned client_session_id, void* stream_token,
+        TaskFunc* rtcp_rr_handler, void* rtcp_rr_handler_data,
+        unsigned short& rtp_seq_num, unsigned& rtp_timestamp,
+        ServerRequestAlternativeByteHandler* alt_byte_handler,
+        void* alt_byte_handler_data);
+};
+
+// One session (rtsp://host:port/session) of a shared RtspServer.  The
+// live555 objects are made and closed on the server's live thread.
+// addMessage triggers the live thread, the stage thread has no run loop.
+class Rtsp : public Base, public Listener<NalBuf> {
   public:
     static std::unique_ptr<Rtsp> create(unsigned int yield_time, bool quiet, 
-        unsigned int bitrate, unsigned int framerate, std::string& unicast);
+        unsigned int bitrate, unsigned int framerate, RtspServer* server,
+        const std::string& session, unsigned short rtp_port);
     virtual ~Rtsp();
 
   public:
     virtual bool addMessage(NalBuf& data);
 
+    // the encoder feeding this stream makes an idr for each new client.
+    // Set before start(), the encoder is created after its listeners.
+    void keyFrames(Encoder* enc);
+    void newSession();
+
   protected:
     Rtsp() = delete;
     Rtsp(unsigned int yield_time);
     bool init(bool quiet, unsigned int bitrate, unsigned int framerate, 
-        std::string& unicast);
+        RtspServer* server, const std::string& session, unsigned short rtp_port);
 
   protected:
     virtual bool waitingToRun();
-    virtual bool running();
-    virtual bool paused();
     virtual bool waitingToHalt();
 
   public:
@@ -91,48 +119,127 @@ class Rtsp : public Base, Listener<NalBuf> {
       unsigned int& frame_size, unsigned int& trunc, struct timeval& pts, 
       unsigned int& duration, unsigned char* fTo);
 
+  public:
+    // live thread only
+    void liveCreate(UsageEnvironment* env);
+    bool liveSetup(RTSPServer* rtsp_server, const std::string& unicast);
+    void liveStop();
+    void liveClose();
+    bool liveClosing();
+
   public:
     LiveSource* live_src_;
-    char live_watch_;
 
   private:
     bool quiet_;
     unsigned int bitrate_;
     unsigned int framerate_;
-    std::string unicast_;
+    RtspServer* server_;
+    std::string session_;                    // rtsp://host:port/session
+    unsigned short rtp_port_;                // rtcp is rtp_port_ + 1
     UsageEnvironment* env_;
-    const unsigned output_max_ = {3 * 1024 * 1024};
     const unsigned cname_len_ = {100};
 
-    Semaphore live_sem_;
-    std::thread live_;
-    void liveProc();
-    static void liveProc0(Rtsp* self);
-
-    class RtspNal {
-      public:
-        RtspNal() = delete;
-        RtspNal(unsigned int len) 
-          : length(len), nal(len) {}
-        ~RtspNal() {}
+    std::unique_ptr<Groupsock> rtp_sock_;
+    std::unique_ptr<Groupsock> rtcp_sock_;
+    RTPSink* video_snk_;
+    RTCPInstance* rtcp_;
+    H264VideoStreamDiscreteFramer* video_src_;
+
+    // the nals waiting for live555, each one a header and the nal bytes
+    // (no start code).  The encoder copies them in at ring_head_ and the
+    // discrete framer takes one per call from ring_tail_.  Both are byte
+    // counts, the ring offset is count % ring_len_ and a record may wrap.
+    // If the ring is full the nal is dropped along with the rest of the
+    // stream up to the next idr.
+    class Record {
       public:
-        unsigned int length;
-        std::vector<unsigned char> nal;
+        uint32_t length;
+        uint32_t pad;
+        int64_t pts;                         // wall clock usec
     };
     std::timed_mutex nal_lock_;
-    const unsigned int nal_timeout_ = {20};
-    const unsigned int nal_num_ = {20};
-    const unsigned int nal_len_ = {20 * 1024};
-    std::deque<std::shared_ptr<Rtsp::RtspNal>> nal_pool_;
-    std::deque<std::shared_ptr<Rtsp::RtspNal>> nal_work_;
-
-    unsigned int overflow_len_ = {0};
-    std::vector<unsigned char> overflow_;
+    const unsigned int ring_len_ = {1024 * 1024};
+    std::vector<unsigned char> ring_;
+    uint64_t ring_head_;
+    uint64_t ring_tail_;
+    void ringWrite(const void* src, unsigned int len);
+    void ringRead(void* dst, unsigned int len);
+
+    // encoder stamps are steady clock, rtp wants wall clock
+    std::chrono::microseconds clock_offset_;
+
+    bool skip_;                              // dropping until the next idr
+
+    // latest parameter sets for the sdp, also sent again in front of any
+    // idr the encoder didn't precede with them (requested idrs)
+    std::vector<unsigned char> sps_;
+    std::vector<unsigned char> pps_;
+    H264::Nal last_type_;
+    bool paramSets(std::vector<unsigned char>& sps, std::vector<unsigned char>& pps);
+    bool ringNal(const void* nal, unsigned int len, int64_t pts);
+
+    Encoder* enc_;
+    std::atomic<unsigned int> sessions_;
+
+    unsigned int nals_queued_;
+    unsigned int nals_dropped_;
+    unsigned int triggers_;
+    unsigned int ring_max_;
+    uint64_t bytes_sent_;
 
     std::atomic<bool> rtsp_on_;
     static void afterPlay(void* data);
 };
 
+// The rtsp server and the live555 thread shared by every Rtsp session.
+// Sessions add themselves when they are created, so the server has to
+// be created first and started before them.
+class RtspServer : public Base {
+  public:
+    static std::unique_ptr<RtspServer> create(unsigned int yield_time, bool quiet,
+        std::string& unicast, unsigned short port);
+    virtual ~RtspServer();
+
+  public:
+    bool addStream(Rtsp* stream);
+
+  protected:
+    RtspServer() = delete;
+    RtspServer(unsigned int yield_time);
+    bool init(bool quiet, std::string& unicast, unsigned short port);
+
+  protected:
+    virtual bool waitingToRun();
+    virtual bool waitingToHalt();
+
+  public:
+    char live_watch_;
+
+  private:
+    bool quiet_;
+    std::string unicast_;
+    unsigned short port_;
+    const unsigned output_max_ = {3 * 1024 * 1024};
+    const unsigned int setup_time_ = {20000};   // usec between sps/pps checks
+
+    std::vector<Rtsp*> streams_;
+    std::vector<bool> ready_;
+    UsageEnvironment* env_;
+    RTSPServer* rtsp_server_;
+
+    Semaphore live_sem_;
+    std::thread live_;
+    void liveProc();
+    static void liveProc0(RtspServer* self);
+
+    // sessions go up once their encoder's sps/pps are in
+    void setupStreams();
+    static void setupStreams0(void* data);
+
+    std::atomic<bool> server_on_;
+};
+
 } // namespace detector
 
 #endif // RTSP_H
@@ -0,0 +1,396 @@
+/*
+ * Copyright © 2019 Tyler J. Brooks <tylerjbrooks@digispeaker.com> <https://www.digispeaker.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Try './detector -h' for usage.
+ */
+
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <dirent.h>
+#include <algorithm>
+
+#include "utils.h"
+#include "h264.h"
+#include "segmenter.h"
+
+namespace detector {
+
+const char Segmenter::magic_[8] = { 'H', '2', '6', '4', 'I', 'D', 'X', '1' };
+
+Segmenter::Segmenter()
+  : buf_(nullptr, free) {
+}
+
+Segmenter::~Segmenter() {
+  close();
+}
+
+std::unique_ptr<Segmenter> Segmenter::create(const std::string& prefix,
+    unsigned int seg_time, unsigned int seg_size, unsigned int sync_time) {
+  auto obj = std::unique_ptr<Segmenter>(new Segmenter());
+  obj->init(prefix, seg_time, seg_size, sync_time);
+  return obj;
+}
+
+bool Segmenter::init(const std::string& prefix, unsigned int seg_time,
+    unsigned int seg_size, unsigned int sync_time) {
+
+  prefix_ = prefix;
+  seg_time_ = std::chrono::seconds(seg_time);
+  seg_size_ = seg_size;
+  single_ = (seg_time == 0 && seg_size == 0);
+  mp4_ = prefix_.size() > 4 && prefix_.compare(prefix_.size() - 4, 4, ".mp4") == 0;
+  if (mp4_ && !single_) {
+    prefix_.resize(prefix_.size() - 4);
+  }
+
+  void* buf = nullptr;
+  if (posix_memalign(&buf, buf_align_, buf_size_) != 0) {
+    dbgMsg("failed: allocate write buffer\n");
+    buf = nullptr;
+  }
+  buf_.reset(static_cast<char*>(buf));
+
+  sync_time_ = std::chrono::seconds(sync_time);
+  sync_last_ = std::chrono::steady_clock::now();
+
+  fd_seg_ = nullptr;
+  fd_idx_ = nullptr;
+  seg_num_ = 0;
+  if (!single_) {
+    auto nums = Segmenter::listSegments(prefix_);
+    if (nums.size() != 0) {
+      seg_num_ = nums.back() + 1;
+    }
+  }
+  seg_first_ = seg_num_;
+  seg_bytes_ = 0;
+  seg_start_ = 0;
+  rec_start_ = -1;
+  unit_start_ = true;
+  unit_skip_ = false;
+
+  au_key_ = false;
+  pend_key_ = false;
+  pend_pts_ = 0;
+  last_dur_ = Mp4::timescale_ / 30;
+  frag_seq_ = 0;
+
+  wall_set_ = false;
+  wall_base_ = 0;
+  steady_base_ = 0;
+
+  return true;
+}
+
+std::string Segmenter::segmentName(const std::string& prefix, unsigned int num,
+    const char* ext) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "_%05u%s", num, ext);
+  return prefix + buf;
+}
+
+std::string Segmenter::indexName(const std::string& prefix, unsigned int num) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "_%05u.idx", num);
+  return prefix + buf;
+}
+
+int64_t Segmenter::steadyTime(std::chrono::steady_clock::time_point stamp) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      stamp.time_since_epoch()).count();
+}
+
+// wall clock of steady 'pts' as of the last anchor
+int64_t Segmenter::wallTime(int64_t pts) {
+  return wall_base_ + (pts - steady_base_);
+}
+
+// pick up the system clock, but never earlier than where we already are
+void Segmenter::anchorWall(int64_t pts) {
+  auto now = std::chrono::system_clock::now() -
+    std::chrono::duration_cast<std::chrono::system_clock::duration>(
+        std::chrono::steady_clock::now() - 
+        std::chrono::steady_clock::time_point(std::chrono::microseconds(pts)));
+  int64_t wall = std::chrono::duration_cast<std::chrono::microseconds>(
+      now.time_since_epoch()).count();
+  if (!wall_set_ || wall > wallTime(pts)) {
+    wall_base_ = wall;
+    steady_base_ = pts;
+    wall_set_ = true;
+  }
+}
+
+bool Segmenter::open(int64_t pts) {
+
+  close();
+
+  std::string seg = single_ ? prefix_ :
+    Segmenter::segmentName(prefix_, seg_num_, mp4_ ? ".mp4" : ".h264");
+  fd_seg_ = fopen(seg.c_str(), "wb");
+  if (fd_seg_ == nullptr) {
+    dbgMsg("failed: create segment %s\n", seg.c_str());
+    return false;
+  }
+  if (buf_) {
+    setvbuf(fd_seg_, buf_.get(), _IOFBF, buf_size_);
+  }
+  if (!single_) {
+    std::string idx = Segmenter::indexName(prefix_, seg_num_);
+    fd_idx_ = fopen(idx.c_str(), "wb");
+    if (fd_idx_ == nullptr) {
+      dbgMsg("failed: create index %s\n", idx.c_str());
+      close();
+      return false;
+    }
+    fwrite(Segmenter::magic_, 1, sizeof(Segmenter::magic_), fd_idx_);
+  }
+  seg_num_++;
+  seg_start_ = pts;
+  if (rec_start_ < 0) {
+    rec_start_ = pts;
+  }
+  anchorWall(pts);
+
+  if (mp4_) {
+    if (!Mp4::init(config_, box_)) {
+      dbgMsg("failed: no usable sps/pps for %s\n", seg.c_str());
+      box_.clear();
+    }
+    seg_bytes_ = fwrite(box_.data(), 1, box_.size(), fd_seg_);
+  } else {
+    seg_bytes_ = fwrite(config_.data(), 1, config_.size(), fd_seg_);
+  }
+
+  return true;
+}
+
+bool Segmenter::sync() {
+  differ_sync_.begin();
+  if (fd_seg_ != nullptr) {
+    fflush(fd_seg_);
+    fsync(fileno(fd_seg_));
+  }
+  if (fd_idx_ != nullptr) {
+    fflush(fd_idx_);
+    fsync(fileno(fd_idx_));
+  }
+  differ_sync_.end();
+  sync_last_ = std::chrono::steady_clock::now();
+  return true;
+}
+
+bool Segmenter::close() {
+  if (mp4_ && pend_.size() != 0) {
+    flushPending(pend_pts_ + static_cast<int64_t>(last_dur_) * 1000000 / Mp4::timescale_);
+  }
+  if (sync_time_.count() != 0) {
+    sync();
+  }
+  if (fd_seg_ != nullptr) {
+    fclose(fd_seg_);
+    fd_seg_ = nullptr;
+  }
+  if (fd_idx_ != nullptr) {
+    fclose(fd_idx_);
+    fd_idx_ = nullptr;
+  }
+  return true;
+}
+
+bool Segmenter::write(const NalBuf& nal) {
+
+  bool eof = nal.flags & NalBuf::kEndOfFrame;
+
+  // sps/pps go at the top of every segment
+  if (nal.flags & NalBuf::kConfig) {
+    config_part_.insert(config_part_.end(), nal.addr, nal.addr + nal.length);
+    if (eof) {
+      config_.swap(config_part_);
+      config_part_.clear();
+    }
+    return true;
+  }
+
+  // mp4 works on whole access units
+  if (mp4_) {
+    if (unit_start_) {
+      au_.clear();
+      au_key_ = (nal.flags & NalBuf::kKeyFrame) ||
+        H264::contains(nal.addr, nal.length, H264::Nal::kIdr);
+    }
+    au_.insert(au_.end(), nal.addr, nal.addr + nal.length);
+    unit_start_ = eof;
+    if (eof) {
+      writeUnit(nal);
+    }
+
+  } else {
+
+    // segments only change at an idr
+    if (unit_start_) {
+      bool key = (nal.flags & NalBuf::kKeyFrame) ||
+        H264::contains(nal.addr, nal.length, H264::Nal::kIdr);
+      unit_skip_ = false;
+      if (key) {
+        keyUnit(steadyTime(nal.stamp), nal.id);
+      } else if (fd_seg_ == nullptr) {
+        unit_skip_ = true;
+      }
+    }
+    unit_start_ = eof;
+
+    if (!unit_skip_ && fd_seg_ != nullptr) {
+      seg_bytes_ += fwrite(nal.addr, 1, nal.length, fd_seg_);
+    }
+  }
+
+  if (sync_time_.count() != 0 && eof &&
+      std::chrono::steady_clock::now() - sync_last_ >= sync_time_) {
+    sync();
+  }
+
+  return true;
+}
+
+// an idr starts at seg_bytes_: rotate if the segment is full and index it
+bool Segmenter::keyUnit(int64_t pts, uint32_t id) {
+
+  if (fd_seg_ == nullptr || (!single_ &&
+      ((seg_time_.count() != 0 && pts - seg_start_ >= seg_time_.count()) ||
+       (seg_size_ != 0 && seg_bytes_ >= seg_size_)))) {
+    open(pts);
+  }
+  if (fd_idx_ != nullptr) {
+    Segmenter::Entry ent;
+    ent.pts = wallTime(pts);
+    ent.id = id;
+    ent.pad = 0;
+    ent.offset = seg_bytes_;
+    fwrite(&ent, sizeof(ent), 1, fd_idx_);
+  }
+
+  return true;
+}
+
+// au_ is complete, 'nal' is its last chunk
+bool Segmenter::writeUnit(const NalBuf& nal) {
+
+  int64_t pts = steadyTime(nal.stamp);
+  if (pend_.size() != 0) {
+    flushPending(pts);
+  }
+
+  if (au_key_) {
+    keyUnit(pts, nal.id);
+  } else if (fd_seg_ == nullptr) {
+    return true;
+  }
+
+  pend_.swap(au_);
+  pend_key_ = au_key_;
+  pend_pts_ = pts;
+
+  return true;
+}
+
+// the next access unit is at 'pts' so the pending one can go out
+bool Segmenter::flushPending(int64_t pts) {
+
+  // both in ticks from the same origin so the durations add up to the times
+  auto ticks = [&](int64_t t) {
+    return t > rec_start_ ? (t - rec_start_) * Mp4::timescale_ / 1000000 : 0;
+  };
+  uint64_t decode_time = ticks(pend_pts_);
+  uint32_t dur = ticks(pts) - decode_time;
+  if (pts <= pend_pts_ || dur > Mp4::timescale_ * 10) {
+    dur = last_dur_;
+  }
+  last_dur_ = dur;
+
+  if (fd_seg_ != nullptr) {
+    Mp4::fragment(++frag_seq_, decode_time, dur, pend_key_,
+        pend_.data(), pend_.size(), box_);
+    seg_bytes_ += fwrite(box_.data(), 1, box_.size(), fd_seg_);
+  }
+  pend_.clear();
+
+  return true;
+}
+
+std::vector<unsigned int> Segmenter::listSegments(const std::string& prefix, bool indexes) {
+
+  std::vector<unsigned int> nums;
+  size_t slash = prefix.find_last_of('/');
+  std::string dir = (slash == std::string::npos) ? "." : prefix.substr(0, slash + 1);
+  std::string base = (slash == std::string::npos) ? prefix : prefix.substr(slash + 1);
+  base += "_";
+
+  DIR* dp = opendir(dir.c_str());
+  if (dp == nullptr) {
+    return nums;
+  }
+  struct dirent* ent;
+  while ((ent = readdir(dp)) != nullptr) {
+
+    // '<base>_<digits>.<ext>'
+    std::string name = ent->d_name;
+    if (name.compare(0, base.size(), base) != 0) {
+      continue;
+    }
+    size_t dot = name.find('.', base.size());
+    std::string num = name.substr(base.size(), dot - base.size());
+    std::string ext = (dot == std::string::npos) ? "" : name.substr(dot);
+    if (num.empty() || num.find_first_not_of("0123456789") != std::string::npos) {
+      continue;
+    }
+    if (ext == ".idx" || (!indexes && (ext == ".h264" || ext == ".mp4"))) {
+      nums.push_back(std::stoul(num));
+    }
+  }
+  closedir(dp);
+
+  std::sort(nums.begin(), nums.end());
+  nums.erase(std::unique(nums.begin(), nums.end()), nums.end());
+  return nums;
+}
+
+bool Segmenter::readIndex(const std::string& name, std::vector<Segmenter::Entry>& idx) {
+
+  idx.clear();
+  FILE* fd = fopen(name.c_str(), "rb");
+  if (fd == nullptr) {
+    return false;
+  }
+
+  char magic[sizeof(Segmenter::magic_)];
+  if (fread(magic, 1, sizeof(magic), fd) != sizeof(magic) ||
+      std::memcmp(magic, Segmenter::magic_, sizeof(magic)) != 0) {
+    dbgMsg("failed: not an index %s\n", name.c_str());
+    fclose(fd);
+    return false;
+  }
+
+  Segmenter::Entry ent;
+  while (fread(&ent, sizeof(ent), 1, fd) == 1) {
+    idx.push_back(ent);
+  }
+  fclose(fd);
+
+  return true;
+}
+
+} // namespace detector
@@ -0,0 +1,154 @@
+/*
+ * Copyright © 2019 Tyler J. Brooks <tylerjbrooks@digispeaker.com> <https://www.digispeaker.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Try './detector -h' for usage.
+ */
+
+#ifndef SEGMENTER_H
+#define SEGMENTER_H
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+
+#include "utils.h"
+#include "listener.h"
+#include "mp4.h"
+
+namespace detector {
+
+// Segmented h264 output.  The stream is cut into '<prefix>_NNNNN.h264'
+// files at IDR boundaries once a segment is 'seg_time' seconds or
+// 'seg_size' bytes long (0 means no limit).  Every segment starts with
+// the sps/pps so it plays on its own.  Next to each segment is a
+// '<prefix>_NNNNN.idx' file with one fixed size Entry per IDR: its
+// wall clock time, frame id and byte offset in the segment.  The index
+// is sorted by time so a clip can be found with a binary search.
+// Segment lengths and mp4 times run on the encoder's steady clock
+// stamps.  The wall clock is only read when a segment opens and only
+// ever moves the index times forward, so an ntp step back can't unsort
+// them.
+// With neither limit set the stream goes to the single file 'prefix'
+// and there is no index.  Numbering carries on after the highest
+// segment already there, so a restart never overwrites a recording.
+//
+// If 'prefix' ends in '.mp4' the segments are fragmented mp4 instead
+// ('<prefix>_NNNNN.mp4' without the '.mp4' in prefix): an init segment
+// and then one fragment per access unit, timed from the encoder stamps.
+// A fragment is written when the next access unit shows up, that is
+// when its duration is known.  The index offsets then point at the moof
+// of each IDR.
+//
+// Writes go through a large page aligned stdio buffer.  If 'sync_time'
+// is not 0 the files are fsync'ed every 'sync_time' seconds and when
+// they are closed, otherwise flushing is left to the kernel.
+class Segmenter {
+  public:
+    static std::unique_ptr<Segmenter> create(const std::string& prefix,
+        unsigned int seg_time, unsigned int seg_size, unsigned int sync_time);
+    virtual ~Segmenter();
+
+  public:
+    class Entry {
+      public:
+        int64_t pts;          // usec since the epoch
+        uint32_t id;          // capture frame id
+        uint32_t pad;
+        uint64_t offset;      // byte offset in the segment
+    };
+    static_assert(sizeof(Segmenter::Entry) == 24, "index entry must be packed");
+
+    // one chunk of encoder output
+    bool write(const NalBuf& nal);
+    bool close();
+
+    unsigned int segments() { return seg_num_ - seg_first_; }
+    const MicroDiffer<uint32_t>& syncTime() { return differ_sync_; }
+
+    // used by the clip tool
+    static std::string segmentName(const std::string& prefix, unsigned int num,
+        const char* ext = ".h264");
+    static std::string indexName(const std::string& prefix, unsigned int num);
+    static bool readIndex(const std::string& name, std::vector<Segmenter::Entry>& idx);
+    // numbers of the segments (or just their indexes) on disk, ascending
+    static std::vector<unsigned int> listSegments(const std::string& prefix, 
+        bool indexes = false);
+    static const char magic_[8];
+
+  protected:
+    Segmenter();
+    bool init(const std::string& prefix, unsigned int seg_time, unsigned int seg_size,
+        unsigned int sync_time);
+
+  private:
+    std::string prefix_;
+    std::chrono::microseconds seg_time_;
+    uint64_t seg_size_;
+    bool single_;                            // no limits, one file and no index
+    bool mp4_;
+
+    const unsigned int buf_size_ = {1024 * 1024};
+    const unsigned int buf_align_ = {4096};
+    std::unique_ptr<char, void (*)(void*)> buf_;
+
+    std::chrono::seconds sync_time_;
+    std::chrono::steady_clock::time_point sync_last_;
+    bool sync();
+
+    std::vector<unsigned char> config_;
+    std::vector<unsigned char> config_part_;
+
+    FILE* fd_seg_;
+    FILE* fd_idx_;
+    unsigned int seg_num_;
+    unsigned int seg_first_;
+    uint64_t seg_bytes_;
+    int64_t seg_start_;
+    int64_t rec_start_;                      // mp4 decode times count from here
+    bool unit_start_;
+    bool unit_skip_;
+
+    bool open(int64_t pts);
+    bool keyUnit(int64_t pts, uint32_t id);
+    bool writeUnit(const NalBuf& nal);
+
+    // mp4: the access unit being gathered and the one waiting for its duration
+    std::vector<unsigned char> au_;
+    bool au_key_;
+    std::vector<unsigned char> pend_;
+    bool pend_key_;
+    int64_t pend_pts_;
+    uint32_t last_dur_;
+    uint32_t frag_seq_;                      // across segments, like the decode times
+    std::vector<unsigned char> box_;
+    bool flushPending(int64_t pts);
+
+    // media times are steady clock usec, the index gets wall clock usec
+    bool wall_set_;
+    int64_t wall_base_;
+    int64_t steady_base_;
+    int64_t steadyTime(std::chrono::steady_clock::time_point stamp);
+    int64_t wallTime(int64_t pts);
+    void anchorWall(int64_t pts);
+
+    MicroDiffer<uint32_t> differ_sync_;
+};
+
+} // namespace detector
+
+#endif // SEGMENTER_H
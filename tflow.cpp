@@ -31,37 +31,43 @@
 namespace detector {
 
 Tflow::Tflow(unsigned int yield_time) 
-  : Base(yield_time),
-    tflow_empty_(true) {
+  : Base(yield_time) {
 }
 
 Tflow::~Tflow() {
 }
 
 std::unique_ptr<Tflow> Tflow::create(unsigned int yield_time, bool quiet, 
-    Encoder* enc, Tracker* trk, unsigned int width, unsigned int height, 
-    const char* model, const char* labels, unsigned int threads, float threshold, 
-    bool tpu) {
+    unsigned int width, unsigned int height, const char* model, const char* labels,
+    unsigned int threads, float threshold, bool tpu, unsigned int batch,
+    unsigned int batch_wait) {
   auto obj = std::unique_ptr<Tflow>(new Tflow(yield_time));
-  obj->init(quiet, enc, trk, width, height, model, labels, threads, threshold, tpu);
+  obj->init(quiet, width, height, model, labels, threads, threshold, tpu,
+      batch, batch_wait);
   return obj;
 }
 
-bool Tflow::init(bool quiet, Encoder* enc, Tracker* trk, unsigned int width, 
-    unsigned int height, const char* model, const char* labels, 
-    unsigned int threads, float threshold, bool tpu) {
+bool Tflow::init(bool quiet, unsigned int width, unsigned int height, const char* model,
+    const char* labels, unsigned int threads, float threshold, bool tpu,
+    unsigned int batch, unsigned int batch_wait) {
 
   quiet_ = quiet;
   tpu_ = tpu;
 
-  enc_ = enc;
-  trk_ = trk;
-  
   width_ = width;
   height_ = height;
 
   frame_len_ = ALIGN_16B(width_) * ALIGN_16B(height_) * channels_;
-  frame_.buf.resize(frame_len_);
+  yuv_len_ = ALIGN_16B(width_) * ALIGN_16B(height_) * 3 / 2;
+  next_camera_ = 0;
+  batch_ = std::max(batch, 1u);
+  batch_wait_ = std::chrono::microseconds(batch_wait);
+  model_batch_ = 1;
+  invokes_ = 0;
+  worker_set_ = false;
+  worker_policy_ = SCHED_OTHER;
+  worker_cpus_ = 0;
+  worker_num_ = 0;
 
   model_fname_ = model;
   labels_fname_ = labels;
@@ -73,26 +79,62 @@ bool Tflow::init(bool quiet, Encoder* enc, Tracker* trk, unsigned int width,
   return true; 
 }
 
+unsigned int Tflow::addCamera(Encoder* enc, Tracker* trk, Recorder* rec) {
+  auto cam = std::make_unique<Tflow::Camera>();
+  cam->enc = enc;
+  cam->trk = trk;
+  cam->rec = rec;
+  cam->frame.buf.resize(frame_len_);
+  cam->frame.format = V4L2_PIX_FMT_RGB24;
+  cam->empty = true;
+  cam->post_id = 0;
+  cam->offered = 0;
+  cam->busy = 0;
+  cameras_.push_back(std::move(cam));
+  return cameras_.size() - 1;
+}
+
+void Tflow::workers(int policy, unsigned int cpus) {
+  worker_set_ = true;
+  worker_policy_ = policy;
+  worker_cpus_ = cpus;
+}
+
 bool Tflow::addMessage(FrameBuf& fbuf) {
+  return addMessage(0, fbuf);
+}
 
-  std::unique_lock<std::timed_mutex> lck(tflow_lock_, std::defer_lock);
+bool Tflow::addMessage(unsigned int camera, FrameBuf& fbuf) {
+
+  if (camera >= cameras_.size()) {
+    return false;
+  }
+  Tflow::Camera& cam = *cameras_[camera];
+
+  std::unique_lock<std::timed_mutex> lck(cam.lock, std::defer_lock);
 
   if (!lck.try_lock_for(std::chrono::microseconds(Listener::timeout_))) {
 //    dbgMsg("tflow busy\n");
     return false;
   }
 
-  if (tflow_empty_) {
-    if (frame_len_ != fbuf.length) {
+  cam.offered++;
+  if (cam.empty) {
+    unsigned int len = (fbuf.format == V4L2_PIX_FMT_YUV420) ? yuv_len_ : frame_len_;
+    if (len != fbuf.length) {
       dbgMsg("tflow buffer size mismatch\n");
       return false;
     }
-    differ_copy_.begin();
-    frame_.id = fbuf.id;
-    frame_.length = fbuf.length;
-    std::memcpy(frame_.buf.data(), fbuf.addr, fbuf.length);
-    tflow_empty_ = false;
-    differ_copy_.end();
+    cam.differ_copy.begin();
+    cam.frame.id = fbuf.id;
+    cam.frame.length = fbuf.length;
+    cam.frame.format = fbuf.format;
+    std::memcpy(cam.frame.buf.data(), fbuf.addr, fbuf.length);
+    cam.stamp = std::chrono::steady_clock::now();
+    cam.empty = false;
+    cam.differ_copy.end();
+  } else {
+    cam.busy++;
   }
 
   return true;
@@ -102,6 +144,9 @@ bool Tflow::waitingToRun() {
 
   if (!tflow_on_) {
 
+    // threads from here on are tflite's or the tpu driver's
+    std::set<pid_t> tids = threadIds();
+
     // find tpu
     dbgMsg("find tpu\n");
     const auto& available_tpus =
@@ -134,6 +179,13 @@ bool Tflow::waitingToRun() {
     model_height_ = dims->data[1];
     model_width_ = dims->data[2];
     model_channels_ = dims->data[3];
+    model_batch_ = dims->data[0];
+    if (batch_ > 1 && !batchSize(batch_)) {
+      if (!quiet_) {
+        fprintf(stderr, "\ntflow: model has a fixed batch of 1, -N %u has no effect\n", batch_);
+      }
+      batch_ = 1;
+    }
 
     // make resize interpreter
     dbgMsg("make resize interpreter\n");
@@ -202,6 +254,19 @@ bool Tflow::waitingToRun() {
       label_pairs_[std::stoul(tokens[0])] = std::make_pair(tokens[1], btype);
     }
 
+    // the thread pool starts on the first invoke
+    if (worker_set_) {
+      dbgMsg("schedule worker threads\n");
+      model_interpreter_->Invoke();
+      worker_num_ = 0;
+      for (auto tid : threadIds()) {
+        if (tids.find(tid) == tids.end()) {
+          scheduleThread(tid, worker_policy_, getPriority(), worker_cpus_);
+          worker_num_++;
+        }
+      }
+    }
+
     differ_tot_.begin();
     tflow_on_ = true;
   }
@@ -239,14 +304,62 @@ void Tflow::resize(std::unique_ptr<tflite::Interpreter>& interpreter,
   }
 }
 
-bool Tflow::prep() {
+// size the interpreter's input to 'num' frames, false if the model can't
+bool Tflow::batchSize(unsigned int num) {
+
+  if (num == model_batch_) {
+    return true;
+  }
+  int input = model_interpreter_->inputs()[0];
+  if (model_interpreter_->ResizeInputTensor(input, {static_cast<int>(num),
+        static_cast<int>(model_height_), static_cast<int>(model_width_),
+        static_cast<int>(model_channels_)}) == kTfLiteOk &&
+      model_interpreter_->AllocateTensors() == kTfLiteOk) {
+
+    // the outputs have to follow, a batch 1 post-processing op won't
+    bool batched = true;
+    for (int output : model_interpreter_->outputs()) {
+      TfLiteIntArray* dims = model_interpreter_->tensor(output)->dims;
+      batched = batched && dims->size != 0 && 
+        dims->data[0] == static_cast<int>(num);
+    }
+    if (batched) {
+      model_batch_ = num;
+      return true;
+    }
+  }
+
+  // back to one frame per invoke
+  dbgMsg("model can't batch %u frames\n", num);
+  model_interpreter_->ResizeInputTensor(input, {1,
+      static_cast<int>(model_height_), static_cast<int>(model_width_),
+      static_cast<int>(model_channels_)});
+  model_interpreter_->AllocateTensors();
+  model_batch_ = 1;
+  return false;
+}
+
+bool Tflow::prep(Tflow::Camera& cam, unsigned int slot) {
 
 //  std::this_thread::sleep_for(std::chrono::microseconds(yield_time_));
+  cam.differ_wait.begin(cam.stamp);
+  cam.differ_wait.end();
   differ_prep_.begin();
+
+  // the model wants rgb
+  unsigned char* rgb = cam.frame.buf.data();
+  if (cam.frame.format == V4L2_PIX_FMT_YUV420) {
+    rgb_.resize(frame_len_);
+    convert_yuv420_to_rgb24(cam.frame.buf.data(), rgb_.data(), 
+        ALIGN_16B(width_), ALIGN_16B(height_));
+    rgb = rgb_.data();
+  }
+
   int input = model_interpreter_->inputs()[0];
   if (model_interpreter_->tensor(input)->type == kTfLiteUInt8) {
     resize(resize_interpreter_,
-        model_interpreter_->typed_tensor<uint8_t>(input), frame_.buf.data(), 
+        model_interpreter_->typed_tensor<uint8_t>(input) +
+          slot * model_height_ * model_width_ * model_channels_, rgb, 
         height_, width_, channels_,
         model_height_, model_width_, model_channels_, 
         yield_time_);
@@ -282,7 +395,7 @@ bool Tflow::prep() {
         dbgMsg("  writing fullsize - fmt:rgb24 len:%d\n",
             height_ * width_ * channels_);
 #endif
-        fwrite(frame_.buf.data(), 1, 
+        fwrite(rgb, 1, 
             height_ * width_ * channels_, fd);
         fclose(fd);
       }
@@ -298,24 +411,28 @@ bool Tflow::eval() {
     dbgMsg("failed invoke\n");
   }
   differ_eval_.end();
+  invokes_++;
   return true;
 }
 
-bool Tflow::post(bool report) {
+bool Tflow::post(Tflow::Camera& cam, unsigned int slot, bool report) {
 
   differ_post_.begin();
   
   auto boxes = std::make_shared<std::vector<BoxBuf>>();
 
+  // each frame of a batch has its own row of results
   const std::vector<int>& res = model_interpreter_->outputs();
-  float* locs = tflite::GetTensorData<float>(model_interpreter_->tensor(res[0]));
-  float* clas = tflite::GetTensorData<float>(model_interpreter_->tensor(res[1]));
-  float* scor = tflite::GetTensorData<float>(model_interpreter_->tensor(res[2]));
+  unsigned int row = model_interpreter_->tensor(res[1])->dims->data[1];
+  unsigned int num = std::min(result_num_, row);
+  float* locs = tflite::GetTensorData<float>(model_interpreter_->tensor(res[0])) + slot * row * 4;
+  float* clas = tflite::GetTensorData<float>(model_interpreter_->tensor(res[1])) + slot * row;
+  float* scor = tflite::GetTensorData<float>(model_interpreter_->tensor(res[2])) + slot * row;
 #if DEBUG_MESSAGES
-  float* tot  = tflite::GetTensorData<float>(model_interpreter_->tensor(res[3]));
+  float* tot  = tflite::GetTensorData<float>(model_interpreter_->tensor(res[3])) + slot;
   dbgMsg("total results: %d\n", static_cast<unsigned int>(tot[0]));
 #endif
-  for (unsigned int i = 0; i < result_num_; i++, locs += 4) {
+  for (unsigned int i = 0; i < num; i++, locs += 4) {
 
     unsigned int class_id = static_cast<unsigned int>(clas[i]);
 
@@ -351,7 +468,7 @@ bool Tflow::post(bool report) {
 
             BoxBuf::Type btype = label_pairs_[class_id].second;
             boxes->push_back(BoxBuf(
-                btype, frame_.id, left_uint, top_uint, width_uint, height_uint));
+                btype, cam.frame.id, left_uint, top_uint, width_uint, height_uint));
           }
         }
       }
@@ -359,50 +476,93 @@ bool Tflow::post(bool report) {
   }
 
   // send boxes if new
-  if (post_id_ <= frame_.id) {
-    if (enc_) {
-      if (!enc_->addMessage(boxes)) {
+  if (cam.post_id <= cam.frame.id) {
+    if (cam.enc) {
+      if (!cam.enc->addMessage(boxes)) {
         dbgMsg("encoder busy\n");
       }
     }
-    if (trk_) {
-      if (!trk_->addMessage(boxes)) {
+    if (cam.trk) {
+      if (!cam.trk->addMessage(boxes)) {
         dbgMsg("tracker busy\n");
       }
     }
-    post_id_ = frame_.id;
+    if (cam.rec) {
+      if (!cam.rec->addMessage(boxes)) {
+        dbgMsg("recorder busy\n");
+      }
+    }
+    cam.post_id = cam.frame.id;
   }
   differ_post_.end();
 
   return true;
 }
 
-bool Tflow::oneRun(bool report) {
-
-  if (!tflow_empty_) {
-
-    // prepare image
-    prep();
-    std::this_thread::sleep_for(std::chrono::microseconds(yield_time_));
+bool Tflow::oneRun(std::vector<Tflow::Camera*>& cams, bool report) {
 
-    // evaluate image
-    eval();
-    std::this_thread::sleep_for(std::chrono::microseconds(yield_time_));
+  if (cams.empty()) {
+    return true;
+  }
 
-    // post image
-    post(report);
-    std::this_thread::sleep_for(std::chrono::microseconds(yield_time_));
+  // no more than the model was sized for
+  if (cams.size() > model_batch_) {
+    for (unsigned int i = 0; i < cams.size(); i += model_batch_) {
+      std::vector<Tflow::Camera*> part(cams.begin() + i, 
+          cams.begin() + std::min<size_t>(i + model_batch_, cams.size()));
+      oneRun(part, report);
+    }
+    return true;
+  }
 
-    tflow_empty_ = true;
+  // prepare images
+  phase("prep");
+  for (unsigned int i = 0; i < cams.size(); i++) {
+    prep(*cams[i], i);
   }
+  std::this_thread::sleep_for(std::chrono::microseconds(yield_time_));
+
+  // evaluate images
+  phase("eval");
+  eval();
+  std::this_thread::sleep_for(std::chrono::microseconds(yield_time_));
+
+  // post images
+  phase("post");
+  for (unsigned int i = 0; i < cams.size(); i++) {
+    post(*cams[i], i, report);
+    cams[i]->empty = true;
+  }
+  std::this_thread::sleep_for(std::chrono::microseconds(yield_time_));
 
   return true;
 }
 
+// the waiting cameras after the last one served, up to a batch.  A
+// partial batch waits for the rest until its oldest frame is due.
 bool Tflow::running() {
 
   if (tflow_on_) {
-    return oneRun(true);
+    batch_cams_.clear();
+    bool due = false;
+    unsigned int last = 0;
+    auto now = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < cameras_.size(); i++) {
+      unsigned int n = (next_camera_ + i) % cameras_.size();
+      Tflow::Camera* cam = cameras_[n].get();
+      if (!cam->empty && batch_cams_.size() < batch_) {
+        batch_cams_.push_back(cam);
+        due = due || (now - cam->stamp >= batch_wait_);
+        last = n;
+      }
+    }
+    unsigned int full = std::min<unsigned int>(batch_, cameras_.size());
+    if (batch_cams_.empty() || (batch_cams_.size() < full && !due)) {
+      phase("frames", Base::Phase::kIdle);
+      return true;
+    }
+    next_camera_ = (last + 1) % cameras_.size();
+    return oneRun(batch_cams_, true);
   }
   return true;
 }
@@ -411,6 +571,15 @@ bool Tflow::paused() {
   return true;
 }
 
+// the model stays loaded, frames left in the slots would be stale on resume
+bool Tflow::waitingToPause() {
+  for (auto& cam : cameras_) {
+    std::unique_lock<std::timed_mutex> lck(cam->lock);
+    cam->empty = true;
+  }
+  return true;
+}
+
 bool Tflow::waitingToHalt() {
 
   if (tflow_on_) {
@@ -418,9 +587,17 @@ bool Tflow::waitingToHalt() {
     differ_tot_.end();
 
     // finish processing
-    while (!tflow_empty_) {
-      oneRun(false);
+    batch_cams_.clear();
+    for (auto& cam : cameras_) {
+      if (!cam->empty) {
+        batch_cams_.push_back(cam.get());
+      }
+      if (batch_cams_.size() == batch_) {
+        oneRun(batch_cams_, false);
+        batch_cams_.clear();
+      }
     }
+    oneRun(batch_cams_, false);
 
     // reset tensorflow ojects
     model_interpreter_.reset();
@@ -431,9 +608,6 @@ bool Tflow::waitingToHalt() {
     // report
     if (!quiet_) {
       fprintf(stderr, "\nTflow Results...\n");
-      fprintf(stderr, "  image copy time (us): high:%u avg:%u low:%u cnt:%u\n", 
-          differ_copy_.high, differ_copy_.avg, 
-          differ_copy_.low,  differ_copy_.cnt);
       fprintf(stderr, "  image prep time (us): high:%u avg:%u low:%u cnt:%u\n", 
           differ_prep_.high, differ_prep_.avg, 
           differ_prep_.low,  differ_prep_.cnt);
@@ -443,10 +617,29 @@ bool Tflow::waitingToHalt() {
       fprintf(stderr, "  image post time (us): high:%u avg:%u low:%u cnt:%u\n", 
           differ_post_.high, differ_post_.avg, 
           differ_post_.low,  differ_post_.cnt);
+      if (worker_set_) {
+        fprintf(stderr, "        worker threads: %u\n", worker_num_);
+      }
+      fprintf(stderr, "               invokes: %u (%.2f frames each, batch %u)\n",
+          invokes_, invokes_ ? static_cast<float>(differ_post_.cnt) / invokes_ : 0.f,
+          batch_);
       fprintf(stderr, "       total test time: %f sec\n", 
           differ_tot_.avg / 1000000.f);
       fprintf(stderr, "     frames per second: %f fps\n", 
           differ_post_.cnt * 1000000.f / differ_tot_.avg);
+      for (unsigned int i = 0; i < cameras_.size(); i++) {
+        Tflow::Camera& cam = *cameras_[i];
+        fprintf(stderr, "  camera %u:\n", i);
+        fprintf(stderr, "  image copy time (us): high:%u avg:%u low:%u cnt:%u\n", 
+            cam.differ_copy.high, cam.differ_copy.avg, 
+            cam.differ_copy.low,  cam.differ_copy.cnt);
+        fprintf(stderr, "  image wait time (us): high:%u avg:%u low:%u cnt:%u\n", 
+            cam.differ_wait.high, cam.differ_wait.avg, 
+            cam.differ_wait.low,  cam.differ_wait.cnt);
+        fprintf(stderr, "   frames offered/busy: %u/%u\n", cam.offered, cam.busy);
+        fprintf(stderr, "     frames per second: %f fps\n", 
+            cam.differ_wait.cnt * 1000000.f / differ_tot_.avg);
+      }
       fprintf(stderr, "\n");
     }
   }
@@ -25,12 +25,14 @@
 #include <thread>
 #include <mutex>
 #include <map>
+#include <vector>
 
 #include "utils.h"
 #include "listener.h"
 #include "base.h"
 #include "encoder.h"
 #include "tracker.h"
+#include "recorder.h"
 
 #include "edgetpu.h"
 
@@ -42,35 +44,47 @@
 
 namespace detector {
 
+// One model shared by every camera.  Each camera has a single frame
+// slot; the slots are served round robin, one frame per camera with a
+// frame waiting, so a busy camera can't starve the others.  Up to
+// 'batch' frames go through one invoke; a partial batch waits at most
+// 'batch_wait' usec (from its oldest frame) for the other cameras.
 class Tflow : public Base, Listener<FrameBuf> {
   public:
     static std::unique_ptr<Tflow> create(unsigned int yield_time, bool quiet, 
-        Encoder* enc, Tracker* trk, unsigned int width, unsigned int height, 
-        const char* model, const char* labels, unsigned int threads, 
-        float threshold, bool tpu);
+        unsigned int width, unsigned int height, const char* model, const char* labels,
+        unsigned int threads, float threshold, bool tpu, unsigned int batch,
+        unsigned int batch_wait);
     virtual ~Tflow();
 
   public:
-    virtual bool addMessage(FrameBuf& data);
+    // cameras are added before start(), the result is the camera number
+    unsigned int addCamera(Encoder* enc, Tracker* trk, Recorder* rec);
+
+    // policy and cpus (see Base) for the threads tflite and the tpu
+    // driver start, set before start()
+    void workers(int policy, unsigned int cpus);
+
+    virtual bool addMessage(FrameBuf& data);            // camera 0
+    bool addMessage(unsigned int camera, FrameBuf& data);
 
   protected:
     Tflow() = delete;
     Tflow(unsigned int yield_time);
-    bool init(bool quiet, Encoder* enc, Tracker* trk, unsigned int width, 
-        unsigned int height, const char* model, const char* labels, 
-        unsigned int threads, float threshold, bool tpu);
+    bool init(bool quiet, unsigned int width, unsigned int height, const char* model,
+        const char* labels, unsigned int threads, float threshold, bool tpu,
+        unsigned int batch, unsigned int batch_wait);
 
   protected:
     virtual bool waitingToRun();
     virtual bool running();
     virtual bool paused();
     virtual bool waitingToHalt();
+    virtual bool waitingToPause();
 
   private:
     bool quiet_;
     bool tpu_;
-    Encoder* enc_;
-    Tracker* trk_;
     unsigned int width_;
     unsigned int height_;
     const unsigned int channels_ = {3};
@@ -103,23 +117,61 @@ class Tflow : public Base, Listener<FrameBuf> {
       public:
         unsigned int id;
         unsigned int length;
+        unsigned int format;
         std::vector<unsigned char> buf;
     };
     unsigned int frame_len_;
-    Tflow::Frame frame_;
+    unsigned int yuv_len_;
+    std::vector<unsigned char> rgb_;        // I420 frames converted for the model
+
+    class Camera {
+      public:
+        Camera() {}
+        ~Camera() {}
+      public:
+        Encoder* enc;
+        Tracker* trk;
+        Recorder* rec;
+        Tflow::Frame frame;
+        std::timed_mutex lock;
+        std::atomic<bool> empty;
+        std::chrono::steady_clock::time_point stamp;  // frame copied in
+        unsigned int post_id;
+        unsigned int offered;
+        unsigned int busy;
+        MicroDiffer<uint32_t> differ_copy;
+        MicroDiffer<uint32_t> differ_wait;  // copied in to prep
+    };
+    std::vector<std::unique_ptr<Tflow::Camera>> cameras_;
+    unsigned int next_camera_;
+
+    // the model's input is sized to 'batch_' frames once, before the
+    // first invoke, and a partial batch runs with its unused rows left
+    // as they were (their results are ignored).  Models with a fixed
+    // batch (edgetpu, the detection post-processing op) stay at one
+    // frame per invoke and say so at startup.
+    unsigned int batch_;
+    std::chrono::microseconds batch_wait_;
+    unsigned int model_batch_;
+    std::vector<Tflow::Camera*> batch_cams_;
+    bool batchSize(unsigned int num);
+    unsigned int invokes_;
+
+    bool worker_set_;
+    int worker_policy_;
+    unsigned int worker_cpus_;
+    unsigned int worker_num_;
 
     std::unique_ptr<tflite::FlatBufferModel> model_;
     std::shared_ptr<edgetpu::EdgeTpuContext> edgetpu_context_;
     std::unique_ptr<tflite::Interpreter> model_interpreter_;
     std::unique_ptr<tflite::Interpreter> resize_interpreter_;
 
-    MicroDiffer<uint32_t> differ_copy_;
     MicroDiffer<uint32_t> differ_prep_;
     MicroDiffer<uint32_t> differ_eval_;
     MicroDiffer<uint32_t> differ_post_;
     MicroDiffer<uint32_t> differ_tot_;
 
-    unsigned int post_id_ = {0};
     const unsigned int result_num_ = {10};
 
     void resize(std::unique_ptr<tflite::Interpreter>& interpreter,
@@ -127,14 +179,12 @@ class Tflow : public Base, Listener<FrameBuf> {
         int image_height, int image_width, int image_channels, 
         int wanted_height, int wanted_width, int wanted_channels, 
         int yield);
-    bool prep();
+    bool prep(Tflow::Camera& cam, unsigned int slot);
     bool eval();
-    bool post(bool report);
-    bool oneRun(bool report);
+    bool post(Tflow::Camera& cam, unsigned int slot, bool report);
+    bool oneRun(std::vector<Tflow::Camera*>& cams, bool report);
 
-    std::timed_mutex tflow_lock_;
     std::atomic<bool> tflow_on_;
-    std::atomic<bool> tflow_empty_;
 
 #ifdef CAPTURE_ONE_RAW_FRAME
     unsigned int counter = {10};
@@ -26,6 +26,7 @@
 #include <algorithm>
 #include <iterator>
 #include <limits>
+#include <cmath>
 
 #include "tracker.h"
 #include "third_party/Hungarian/Hungarian.h"
@@ -48,9 +49,11 @@ const Eigen::Matrix<double, 2, 6> Tracker::Track::H_{
 Tracker::Track::Track(unsigned int track_id, const BoxBuf& box)
   : id(track_id), type(box.type),
     x(box.x), y(box.y), w(box.w), h(box.h),
-    touched(true) {
+    touched(true),
+    hist_slot(-1), hist_head(0), hist_cnt(0) {
 
   stamp = std::chrono::steady_clock::now();
+  born = stamp;
   state_ = Tracker::Track::State::kInit;
 
   // initialize state vector with inital position
@@ -137,20 +140,39 @@ Tracker::~Tracker() {
 
 std::unique_ptr<Tracker> Tracker::create(
     unsigned int yield_time, bool quiet, 
-    Encoder* enc, double max_dist, unsigned int max_time) {
+    Listener<std::shared_ptr<std::vector<TrackBuf>>>* enc, Counter* cnt,
+    const std::string& meta, double max_dist, unsigned int max_time) {
   auto obj = std::unique_ptr<Tracker>(new Tracker(yield_time));
-  obj->init(quiet, enc, max_dist, max_time);
+  obj->init(quiet, enc, cnt, meta, max_dist, max_time);
   return obj;
 }
 
-bool Tracker::init(bool quiet, Encoder* enc, double max_dist, unsigned int max_time) {
+bool Tracker::init(bool quiet, Listener<std::shared_ptr<std::vector<TrackBuf>>>* enc, 
+    Counter* cnt, const std::string& meta, double max_dist, unsigned int max_time) {
 
   quiet_ = quiet;
   enc_ = enc;
+  cnt_ = cnt;
+  meta_ = meta;
   max_dist_ = max_dist;
   max_time_ = max_time;
 
   track_cnt_ = 0;
+  targets_ready_ = false;
+  sparse_ = true;
+
+  // double buffered track lists handed to the encoder
+  for (unsigned int i = 0; i < post_num_; i++) {
+    auto tracks = std::make_shared<std::vector<TrackBuf>>();
+    tracks->reserve(post_len_);
+    post_pool_.push_back(tracks);
+  }
+  post_idx_ = 0;
+  tracks_dirty_ = false;
+
+  // trajectory history pool
+  hist_pool_.reserve(hist_grow_ * hist_len_);
+  fd_meta_ = nullptr;
 
   tracker_on_ = false;
   
@@ -169,10 +191,16 @@ bool Tracker::addMessage(std::shared_ptr<std::vector<BoxBuf>>& boxes) {
 
   // only copy targets types we are tracking
   targets_.resize(boxes->size());
-  std::copy_if(boxes->begin(), boxes->end(), targets_.begin(),
+  auto it = std::copy_if(boxes->begin(), boxes->end(), targets_.begin(),
       [&](const BoxBuf& box) {
         return target_types_.find(box.type) != target_types_.end();
       });
+  targets_.erase(it, targets_.end());
+
+  // wake up the tracker
+  targets_ready_ = true;
+  lck.unlock();
+  targets_cv_.notify_one();
 
   return true;
 }
@@ -181,6 +209,16 @@ bool Tracker::waitingToRun() {
 
   if (!tracker_on_) {
 
+    // create trajectory file
+    if (!meta_.empty()) {
+      fd_meta_ = fopen(meta_.c_str(), "w");
+      if (fd_meta_ == nullptr) {
+        dbgMsg("failed: create trajectory file\n");
+        return false;
+      }
+    }
+
+    start_ = std::chrono::steady_clock::now();
     differ_tot_.begin();
     tracker_on_ = true;
   }
@@ -188,6 +226,28 @@ bool Tracker::waitingToRun() {
   return true;
 }
 
+std::chrono::steady_clock::time_point Tracker::nextWakeup() {
+
+  auto now = std::chrono::steady_clock::now();
+
+  // retry soon if the last post did not go through
+  if (tracks_dirty_) {
+    return now + std::chrono::microseconds(yield_time_);
+  }
+
+  // otherwise sleep until the oldest track expires
+  auto wakeup = now + std::chrono::milliseconds(idle_time_);
+  std::for_each(tracks_.begin(), tracks_.end(),
+      [&](const Tracker::Track& t) {
+        auto expire = t.stamp + std::chrono::milliseconds(max_time_ + 1);
+        if (expire < wakeup) {
+          wakeup = expire;
+        }
+      });
+
+  return wakeup;
+}
+
 bool Tracker::untouchTracks() {
 
   differ_untouch_.begin();
@@ -202,41 +262,187 @@ bool Tracker::untouchTracks() {
   return true;
 }
 
-bool Tracker::associateTracks() {
+void Tracker::assignTarget(unsigned int trk, unsigned int tgt) {
+  tracks_[trk].addTarget(targets_[tgt]);
+  targets_[tgt].id = std::numeric_limits<unsigned int>::max();
+}
 
-  if (tracks_.size() && targets_.size()) {
+bool Tracker::assignDense() {
+
+  // compute cost matrix
+  std::vector<std::vector<double>> mat(tracks_.size(),
+      std::vector<double>(targets_.size(), 1.0e7));
+  for (unsigned int k = 0; k < targets_.size(); k++) {
+    double mid_x = targets_[k].x + targets_[k].w / 2.0;
+    double mid_y = targets_[k].y + targets_[k].h / 2.0;
+    for (unsigned int i = 0; i < tracks_.size(); i++) {
+      if (tracks_[i].type == targets_[k].type) {
+        mat[i][k] = tracks_[i].getDistance(mid_x, mid_y);
+      }
+    }
+  }
 
-    differ_associate_.begin();
+  // assign targets to tracks
+  HungarianAlgorithm hung_algo;
+  vector<int> assignments;
+  hung_algo.Solve(mat, assignments);
+
+  // add targets to tracks
+  for (unsigned int i = 0; i < assignments.size(); i++) {
+    int k = assignments[i];
+    if (k < 0) {
+      continue;
+    }
+    if (mat[i][k] <= max_dist_) {
+      assignTarget(i, k);
+    }
+  }
+
+  return true;
+}
 
-    // compute cost matrix
-    std::vector<std::vector<double>> mat(tracks_.size(),
-        std::vector<double>(targets_.size(), 1.0e7));
-    for (unsigned int k = 0; k < targets_.size(); k++) {
-      double mid_x = targets_[k].x + targets_[k].w / 2.0;
-      double mid_y = targets_[k].y + targets_[k].h / 2.0;
-      for (unsigned int i = 0; i < tracks_.size(); i++) {
-        if (tracks_[i].type == targets_[k].type) {
-          mat[i][k] = tracks_[i].getDistance(mid_x, mid_y);
+int64_t Tracker::cellKey(int64_t cx, int64_t cy) {
+  return static_cast<int64_t>((static_cast<uint64_t>(cx) << 32) |
+      static_cast<uint32_t>(cy));
+}
+
+unsigned int Tracker::findRoot(unsigned int n) {
+  while (roots_[n] != n) {
+    roots_[n] = roots_[roots_[n]];
+    n = roots_[n];
+  }
+  return n;
+}
+
+bool Tracker::assignSparse() {
+
+  unsigned int trk_num = tracks_.size();
+  unsigned int tgt_num = targets_.size();
+
+  // bin the predicted track centers
+  grid_.resize(trk_num);
+  for (unsigned int i = 0; i < trk_num; i++) {
+    int64_t cx = std::floor(tracks_[i].getMidX() / max_dist_);
+    int64_t cy = std::floor(tracks_[i].getMidY() / max_dist_);
+    grid_[i] = std::make_pair(cellKey(cx, cy), i);
+  }
+  std::sort(grid_.begin(), grid_.end());
+
+  // candidate pairs come from the 3x3 cells around each target
+  pairs_.clear();
+  for (unsigned int k = 0; k < tgt_num; k++) {
+    double mid_x = targets_[k].x + targets_[k].w / 2.0;
+    double mid_y = targets_[k].y + targets_[k].h / 2.0;
+    int64_t cx = std::floor(mid_x / max_dist_);
+    int64_t cy = std::floor(mid_y / max_dist_);
+    for (int64_t dy = -1; dy <= 1; dy++) {
+      for (int64_t dx = -1; dx <= 1; dx++) {
+        auto key = std::make_pair(cellKey(cx + dx, cy + dy), 0u);
+        auto it = std::lower_bound(grid_.begin(), grid_.end(), key);
+        for (; it != grid_.end() && it->first == key.first; it++) {
+          unsigned int i = it->second;
+          if (tracks_[i].type == targets_[k].type) {
+            double dist = tracks_[i].getDistance(mid_x, mid_y);
+            if (dist <= max_dist_) {
+              pairs_.push_back(Tracker::Pair(i, k, dist));
+            }
+          }
         }
       }
     }
+  }
 
-    // assign targets to tracks
-    HungarianAlgorithm hung_algo;
-    vector<int> assignments;
-    hung_algo.Solve(mat, assignments);
+  // split the candidate graph into independent clusters
+  // (tracks are nodes [0,trk_num), targets are nodes [trk_num,trk_num+tgt_num))
+  roots_.resize(trk_num + tgt_num);
+  for (unsigned int n = 0; n < roots_.size(); n++) {
+    roots_[n] = n;
+  }
+  std::for_each(pairs_.begin(), pairs_.end(),
+      [&](const Tracker::Pair& p) {
+        unsigned int a = findRoot(p.trk);
+        unsigned int b = findRoot(trk_num + p.tgt);
+        if (a != b) {
+          roots_[a] = b;
+        }
+      });
+  std::for_each(pairs_.begin(), pairs_.end(),
+      [&](Tracker::Pair& p) {
+        p.grp = findRoot(p.trk);
+      });
+  std::sort(pairs_.begin(), pairs_.end(),
+      [](const Tracker::Pair& a, const Tracker::Pair& b) {
+        return a.grp < b.grp;
+      });
 
-    // add targets to tracks
-    for (unsigned int i = 0; i < assignments.size(); i++) {
-      int k = assignments[i];
-      double mid_x = targets_[k].x + targets_[k].w / 2.0;
-      double mid_y = targets_[k].y + targets_[k].h / 2.0;
-      if (tracks_[i].getDistance(mid_x, mid_y) <= max_dist_) {
-        tracks_[i].addTarget(targets_[k]);
-        targets_[k].id = std::numeric_limits<unsigned int>::max();
+  // solve each cluster on its own
+  local_.assign(trk_num + tgt_num, -1);
+  HungarianAlgorithm hung_algo;
+  std::vector<std::vector<double>> mat;
+  std::vector<unsigned int> rows;
+  std::vector<unsigned int> cols;
+  vector<int> assignments;
+  auto first = pairs_.begin();
+  while (first != pairs_.end()) {
+    unsigned int grp = first->grp;
+    auto last = std::find_if(first, pairs_.end(),
+        [&](const Tracker::Pair& p) { return p.grp != grp; });
+
+    // trivial cluster
+    if (last - first == 1) {
+      assignTarget(first->trk, first->tgt);
+      first = last;
+      continue;
+    }
+
+    // local row/col numbering
+    rows.clear();
+    cols.clear();
+    for (auto it = first; it != last; it++) {
+      if (local_[it->trk] < 0) {
+        local_[it->trk] = rows.size();
+        rows.push_back(it->trk);
+      }
+      if (local_[trk_num + it->tgt] < 0) {
+        local_[trk_num + it->tgt] = cols.size();
+        cols.push_back(it->tgt);
+      }
+    }
+
+    // cluster cost matrix
+    mat.assign(rows.size(), std::vector<double>(cols.size(), 1.0e7));
+    for (auto it = first; it != last; it++) {
+      mat[local_[it->trk]][local_[trk_num + it->tgt]] = it->dist;
+    }
+    hung_algo.Solve(mat, assignments);
+    for (unsigned int r = 0; r < assignments.size(); r++) {
+      int c = assignments[r];
+      if (c >= 0 && mat[r][c] <= max_dist_) {
+        assignTarget(rows[r], cols[c]);
       }
     }
 
+    std::for_each(rows.begin(), rows.end(), [&](unsigned int i) { local_[i] = -1; });
+    std::for_each(cols.begin(), cols.end(), [&](unsigned int k) { local_[trk_num + k] = -1; });
+    first = last;
+  }
+
+  return true;
+}
+
+bool Tracker::associateTracks() {
+
+  if (tracks_.size() && targets_.size()) {
+
+    differ_associate_.begin();
+
+    // assign targets to tracks
+    if (sparse_ && max_dist_ > 0.0) {
+      assignSparse();
+    } else {
+      assignDense();
+    }
+
     // remove used targets
     targets_.erase(
         std::remove_if(targets_.begin(), targets_.end(),
@@ -259,6 +465,7 @@ bool Tracker::createNewTracks() {
     std::for_each(targets_.begin(), targets_.end(),
         [&](const BoxBuf& b) {
           tracks_.push_back(Tracker::Track(++track_cnt_, b));
+          tracks_.back().hist_slot = allocHistory();
         });
   }
 
@@ -269,6 +476,103 @@ bool Tracker::createNewTracks() {
   return true;
 }
 
+bool Tracker::countTracks() {
+
+  // tracks that just got a target (or were just created) have moved
+  if (cnt_) {
+    differ_count_.begin();
+
+    std::for_each(tracks_.begin(), tracks_.end(),
+        [&](Tracker::Track& track) {
+          if (track.touched) {
+            cnt_->update(track.count, track.type, track.getMidX(), track.getMidY());
+          }
+        });
+
+    differ_count_.end();
+  }
+
+  return true;
+}
+
+int Tracker::allocHistory() {
+
+  if (hist_free_.size() == 0) {
+    int first = hist_pool_.size() / hist_len_;
+    hist_pool_.resize(hist_pool_.size() + hist_grow_ * hist_len_);
+    for (int i = hist_grow_ - 1; i >= 0; i--) {
+      hist_free_.push_back(first + i);
+    }
+  }
+
+  int slot = hist_free_.back();
+  hist_free_.pop_back();
+  return slot;
+}
+
+void Tracker::freeHistory(Tracker::Track& track) {
+  if (track.hist_slot >= 0) {
+    hist_free_.push_back(track.hist_slot);
+    track.hist_slot = -1;
+  }
+}
+
+void Tracker::dumpHistory(const Tracker::Track& track) {
+
+  if (fd_meta_ == nullptr || track.hist_slot < 0) {
+    return;
+  }
+
+  const char* type = "unknown";
+  switch (track.type) {
+    case BoxBuf::Type::kPerson:  type = "person";  break;
+    case BoxBuf::Type::kPet:     type = "pet";     break;
+    case BoxBuf::Type::kVehicle: type = "vehicle"; break;
+    default: break;
+  }
+
+  using namespace std::chrono;
+  fprintf(fd_meta_, "{\"id\":%u,\"type\":\"%s\",\"begin\":%u,\"end\":%u,\"points\":[",
+      track.id, type,
+      static_cast<unsigned int>(duration_cast<milliseconds>(track.born - start_).count()),
+      static_cast<unsigned int>(duration_cast<milliseconds>(track.stamp - start_).count()));
+
+  // oldest point first
+  const Tracker::Point* ring = &hist_pool_[track.hist_slot * hist_len_];
+  unsigned int first = (track.hist_head + hist_len_ - track.hist_cnt) % hist_len_;
+  for (unsigned int i = 0; i < track.hist_cnt; i++) {
+    const Tracker::Point& p = ring[(first + i) % hist_len_];
+    fprintf(fd_meta_, "%s[%u,%.1f,%.1f,%.1f,%.1f]", i ? "," : "", 
+        p.ms, p.x, p.y, p.w, p.h);
+  }
+  fprintf(fd_meta_, "]}\n");
+}
+
+bool Tracker::recordTracks() {
+
+  differ_record_.begin();
+
+  // append new positions to the trajectory rings
+  std::for_each(tracks_.begin(), tracks_.end(),
+      [&](Tracker::Track& track) {
+        if (track.touched && track.hist_slot >= 0) {
+          using namespace std::chrono;
+          Tracker::Point& p = hist_pool_[track.hist_slot * hist_len_ + track.hist_head];
+          p.ms = duration_cast<milliseconds>(track.stamp - start_).count();
+          p.x = track.x;
+          p.y = track.y;
+          p.w = track.w;
+          p.h = track.h;
+          track.hist_head = (track.hist_head + 1) % hist_len_;
+          track.hist_cnt = std::min(track.hist_cnt + 1, hist_len_);
+        }
+      });
+
+  differ_record_.end();
+
+  return true;
+}
+
 bool Tracker::touchTracks() {
   differ_touch_.begin();
 
@@ -288,18 +592,31 @@ bool Tracker::cleanupTracks() {
   differ_cleanup_.begin();
 
   auto now = std::chrono::steady_clock::now();
+  auto num = tracks_.size();
 
   // remove old tracks
   tracks_.erase(
       std::remove_if(tracks_.begin(), tracks_.end(),
-        [&] (const Tracker::Track& t) {
+        [&] (Tracker::Track& t) {
           using namespace std::chrono;
           duration<unsigned int,std::milli> span = 
             duration_cast<duration<unsigned int,std::milli>>(now - t.stamp);
-          return max_time_ < span.count();
+          if (max_time_ < span.count()) {
+            if (cnt_) {
+              cnt_->remove(t.count, t.type);
+            }
+            dumpHistory(t);
+            freeHistory(t);
+            return true;
+          }
+          return false;
         }), 
       tracks_.end());
 
+  if (tracks_.size() != num) {
+    tracks_dirty_ = true;
+  }
+
   differ_cleanup_.end();
 
   return true;
@@ -307,23 +624,33 @@ bool Tracker::cleanupTracks() {
 
 bool Tracker::postTracks() {
 
-  differ_post_.begin();
+  // fill the buffer the encoder is not holding
+  auto& tracks = post_pool_[post_idx_];
+  if (tracks.use_count() > 1) {
+    dbgMsg("track buffer busy\n");
+    return false;
+  }
 
-  auto tracks = std::make_shared<std::vector<TrackBuf>>();
+  differ_post_.begin();
 
-  std::for_each(tracks_.begin(), tracks_.end(),
-      [&](const Tracker::Track& t) {
-        tracks->push_back(TrackBuf(
-              t.type, t.id,
-              round(t.x), round(t.y), round(t.w), round(t.h)));
+  tracks->resize(tracks_.size());
+  std::transform(tracks_.begin(), tracks_.end(), tracks->begin(),
+      [](const Tracker::Track& t) {
+        return TrackBuf(t.type, t.id,
+            round(t.x), round(t.y), round(t.w), round(t.h));
       });
 
   if (enc_) {
     if (!enc_->addMessage(tracks)) {
-      dbgMsg("encoder busy");
+      dbgMsg("encoder busy\n");
+      differ_post_.end();
+      return false;
     }
   }
 
+  post_idx_ = (post_idx_ + 1) % post_num_;
+  tracks_dirty_ = false;
+
   differ_post_.end();
   return true;
 }
@@ -334,15 +661,31 @@ bool Tracker::running() {
 
     std::unique_lock<std::timed_mutex> lck(targets_lock_);
 
-    if (targets_.size() != 0) {
-      untouchTracks();
-      associateTracks();
-      createNewTracks();
-      touchTracks();
+    // sleep until new targets arrive, a track expires or a request comes in
+    phase("targets", Base::Phase::kIdle);
+    targets_cv_.wait_until(lck, nextWakeup(), [&]() { 
+        return targets_ready_ || getState() != Base::State::kRunning; });
+    phase("track");
+
+    if (targets_ready_) {
+      if (targets_.size() != 0) {
+        untouchTracks();
+        associateTracks();
+        createNewTracks();
+        countTracks();
+        recordTracks();
+        touchTracks();
+        tracks_dirty_ = true;
+      }
+      targets_ready_ = false;
     }
 
     cleanupTracks();
-    postTracks();
+
+    // only post when the tracks changed
+    if (tracks_dirty_) {
+      postTracks();
+    }
   }
 
   return true;
@@ -352,12 +695,26 @@ bool Tracker::paused() {
   return true;
 }
 
+// a pause or stop ends the wait in running()
+void Tracker::wake() {
+  std::unique_lock<std::timed_mutex> lck(targets_lock_);
+  targets_cv_.notify_one();
+}
+
 bool Tracker::waitingToHalt() {
 
   if (tracker_on_) {
     differ_tot_.end();
     tracker_on_ = false;
 
+    // flush the tracks that are still alive
+    if (fd_meta_ != nullptr) {
+      std::for_each(tracks_.begin(), tracks_.end(),
+          [&](const Tracker::Track& t) { dumpHistory(t); });
+      fclose(fd_meta_);
+      fd_meta_ = nullptr;
+    }
+
     if (!quiet_) {
       fprintf(stderr, "\nTracker Results...\n");
       fprintf(stderr, "      target untouch time (us): high:%u avg:%u low:%u cnt:%u\n", 
@@ -369,6 +726,14 @@ bool Tracker::waitingToHalt() {
       fprintf(stderr, "        track create time (us): high:%u avg:%u low:%u cnt:%u\n", 
           differ_create_.high, differ_create_.avg, 
           differ_create_.low,  differ_create_.cnt);
+      if (cnt_) {
+        fprintf(stderr, "         track count time (us): high:%u avg:%u low:%u cnt:%u\n", 
+            differ_count_.high, differ_count_.avg, 
+            differ_count_.low,  differ_count_.cnt);
+      }
+      fprintf(stderr, "        track record time (us): high:%u avg:%u low:%u cnt:%u\n", 
+          differ_record_.high, differ_record_.avg, 
+          differ_record_.low,  differ_record_.cnt);
       fprintf(stderr, "        target touch time (us): high:%u avg:%u low:%u cnt:%u\n", 
           differ_touch_.high, differ_touch_.avg, 
           differ_touch_.low,  differ_touch_.cnt);
@@ -382,8 +747,22 @@ bool Tracker::waitingToHalt() {
       fprintf(stderr, "               total test time: %f sec\n", 
           differ_tot_.avg / 1000000.f);
       fprintf(stderr, "\n");
+
+      if (cnt_) {
+        cnt_->report();
+      }
     }
 
+    // drop the tracks, the next run starts a new trajectory file
+    // and a new time base
+    std::for_each(tracks_.begin(), tracks_.end(),
+        [&](Tracker::Track& t) {
+          if (cnt_) {
+            cnt_->remove(t.count, t.type);
+          }
+          freeHistory(t);
+        });
+    tracks_.clear();
   }
   return true;
 }
@@ -26,11 +26,12 @@
 #include <mutex>
 #include <set>
 #include <chrono>
+#include <condition_variable>
 
 #include "utils.h"
 #include "listener.h"
 #include "base.h"
-#include "encoder.h"
+#include "counter.h"
 
 #include "Eigen/Dense"
 
@@ -51,11 +52,13 @@ class Tracker : public Base, Listener<std::shared_ptr<std::vector<BoxBuf>>> {
         Track() = default;
         Track(unsigned int track_id, const BoxBuf& box);
         Track(const Tracker::Track& t) = default;
-        Tracker::Track& operator=(Tracker::Track&& t) { return *this; }
+        Tracker::Track& operator=(const Tracker::Track& t) = default;
         ~Track() {}
 
       public:
         double getDistance(double mid_x, double mid_y);
+        inline double getMidX() const { return X_(0); }
+        inline double getMidY() const { return X_(1); }
         void addTarget(const BoxBuf& box);
         void updateTime();
 
@@ -65,13 +68,20 @@ class Tracker : public Base, Listener<std::shared_ptr<std::vector<BoxBuf>>> {
         BoxBuf::Type type;
         double x, y, w, h;
         bool touched;
+        Counter::State count;
+
+        // trajectory ring in the tracker's history pool
+        std::chrono::steady_clock::time_point born;
+        int hist_slot;
+        unsigned int hist_head;
+        unsigned int hist_cnt;
 
       private:
         Track::State state_{Track::State::kInit};
 
-        const double initial_error_{1.0};
-        const double process_variance_{1.0};
-        const double measure_variance_{1.0};
+        static constexpr double initial_error_{1.0};
+        static constexpr double process_variance_{1.0};
+        static constexpr double measure_variance_{1.0};
 
         const static Eigen::Matrix<double, 6, 6> A_;
         const static Eigen::Matrix<double, 2, 6> H_;
@@ -87,26 +97,36 @@ class Tracker : public Base, Listener<std::shared_ptr<std::vector<BoxBuf>>> {
 
   public:
     static std::unique_ptr<Tracker> create(unsigned int yield_time, bool quiet, 
-        Encoder* enc, double max_dist, unsigned int max_time);
+        Listener<std::shared_ptr<std::vector<TrackBuf>>>* enc, Counter* cnt,
+        const std::string& meta, double max_dist, unsigned int max_time);
     virtual ~Tracker();
 
   public:
     virtual bool addMessage(std::shared_ptr<std::vector<BoxBuf>>& boxes);
 
+    inline bool getSparse()             { return sparse_; }
+    inline void setSparse(bool sparse)  { sparse_ = sparse; }
+
+    inline const MicroDiffer<uint32_t>& getAssociateDiffer() { return differ_associate_; }
+
   protected:
     Tracker() = delete;
     Tracker(unsigned int yield_time);
-    bool init(bool quiet, Encoder* enc, double max_dist, unsigned int max_time);
+    bool init(bool quiet, Listener<std::shared_ptr<std::vector<TrackBuf>>>* enc, 
+        Counter* cnt, const std::string& meta, double max_dist, unsigned int max_time);
 
   protected:
     virtual bool waitingToRun();
     virtual bool running();
     virtual bool paused();
     virtual bool waitingToHalt();
+    virtual void wake();
 
   private:
     bool quiet_;
-    Encoder* enc_;
+    Listener<std::shared_ptr<std::vector<TrackBuf>>>* enc_;
+    Counter* cnt_;
+    std::string meta_;
     double max_dist_;
     unsigned int max_time_;
 
@@ -117,11 +137,15 @@ class Tracker : public Base, Listener<std::shared_ptr<std::vector<BoxBuf>>> {
     MicroDiffer<uint32_t> differ_untouch_;
     MicroDiffer<uint32_t> differ_associate_;
     MicroDiffer<uint32_t> differ_create_;
+    MicroDiffer<uint32_t> differ_count_;
+    MicroDiffer<uint32_t> differ_record_;
     MicroDiffer<uint32_t> differ_touch_;
     MicroDiffer<uint32_t> differ_cleanup_;
     MicroDiffer<uint32_t> differ_post_;
 
     std::timed_mutex targets_lock_;
+    std::condition_variable_any targets_cv_;
+    bool targets_ready_;
     std::vector<BoxBuf> targets_;
     std::set<BoxBuf::Type> target_types_{ 
       BoxBuf::Type::kPerson, 
@@ -129,11 +153,65 @@ class Tracker : public Base, Listener<std::shared_ptr<std::vector<BoxBuf>>> {
       BoxBuf::Type::kVehicle
     };
 
+    const unsigned int idle_time_ = {100};   // max sleep between wakeups (ms)
+    const unsigned int post_num_ = {2};
+    const unsigned int post_len_ = {64};
+    std::vector<std::shared_ptr<std::vector<TrackBuf>>> post_pool_;
+    unsigned int post_idx_;
+    bool tracks_dirty_;
+
+    // spatial hash of predicted track centers (cell size is max_dist_)
+    // so only tracks in neighboring cells are considered for each target
+    class Pair {
+      public:
+        Pair() = default;
+        Pair(unsigned int trk, unsigned int tgt, double dist)
+          : grp(0), trk(trk), tgt(tgt), dist(dist) {}
+        ~Pair() {}
+      public:
+        unsigned int grp;
+        unsigned int trk;
+        unsigned int tgt;
+        double dist;
+    };
+    bool sparse_;
+    std::vector<std::pair<int64_t, unsigned int>> grid_;
+    std::vector<Tracker::Pair> pairs_;
+    std::vector<unsigned int> roots_;
+    std::vector<int> local_;
+
+    int64_t cellKey(int64_t cx, int64_t cy);
+    unsigned int findRoot(unsigned int n);
+    bool assignDense();
+    bool assignSparse();
+    void assignTarget(unsigned int trk, unsigned int tgt);
+
+    // trajectory history: hist_len_ points per track, one slot per track,
+    // slots come from a single pool that grows hist_grow_ slots at a time
+    class Point {
+      public:
+        uint32_t ms;        // since tracker start
+        float x, y, w, h;
+    };
+    const unsigned int hist_len_ = {64};
+    const unsigned int hist_grow_ = {64};
+    std::vector<Tracker::Point> hist_pool_;
+    std::vector<int> hist_free_;
+    std::chrono::steady_clock::time_point start_;
+    FILE* fd_meta_;
+
+    int allocHistory();
+    void freeHistory(Tracker::Track& track);
+    void dumpHistory(const Tracker::Track& track);
+
     std::atomic<bool> tracker_on_;
 
+    std::chrono::steady_clock::time_point nextWakeup();
     bool untouchTracks();
     bool associateTracks();
     bool createNewTracks();
+    bool countTracks();
+    bool recordTracks();
     bool touchTracks();
     bool cleanupTracks();
     bool postTracks();
@@ -0,0 +1,659 @@
+/*
+ * Copyright © 2019 Tyler J. Brooks <tylerjbrooks@digispeaker.com> <https://www.digispeaker.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Try './tracker_bench -?' for usage.
+ *
+ * ----------
+ *
+ *  Standalone tracker benchmark.  Drives the Tracker one detection batch
+ *  at a time (no threads, no camera, no encoder) and reports the per-frame
+ *  latency distribution plus the CLEAR MOT (MOTA, MOTP, ID switches) and
+ *  IDF1 scores against ground truth.
+ *
+ *  The input is either a synthetic scene of linearly moving targets with
+ *  position noise and missed detections, or MOTChallenge formatted files:
+ *
+ *     <frame>,<id>,<left>,<top>,<width>,<height>,<conf>,...
+ *
+ *  Ground truth rows with a zero <conf> column are ignored.  If no
+ *  detection file is given the ground truth boxes are used as detections.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <unistd.h>
+
+#include "utils.h"
+#include "listener.h"
+#include "tracker.h"
+#include "third_party/Hungarian/Hungarian.h"
+
+namespace detector {
+
+// run the tracker callbacks synchronously
+class BenchTracker : public Tracker {
+  public:
+    static std::unique_ptr<BenchTracker> create(bool quiet,
+        detector::Listener<std::shared_ptr<std::vector<TrackBuf>>>* lst,
+        const std::string& meta, double max_dist, unsigned int max_time, bool sparse) {
+      auto obj = std::unique_ptr<BenchTracker>(new BenchTracker());
+      obj->init(quiet, lst, nullptr, meta, max_dist, max_time);
+      obj->setSparse(sparse);
+      return obj;
+    }
+    virtual ~BenchTracker() {}
+
+  public:
+    bool begin()  { return waitingToRun(); }
+    bool step()   { return running(); }
+    bool end()    { return waitingToHalt(); }
+
+  protected:
+    BenchTracker() : Tracker(0) {}
+};
+
+// hold on to the latest posted tracks (like the encoder does)
+class Snapshot : public Listener<std::shared_ptr<std::vector<TrackBuf>>> {
+  public:
+    Snapshot() {}
+    virtual ~Snapshot() {}
+
+  public:
+    virtual bool addMessage(std::shared_ptr<std::vector<TrackBuf>>& tracks) {
+      tracks_ = tracks;
+      return true;
+    }
+
+  public:
+    std::shared_ptr<std::vector<TrackBuf>> tracks_;
+};
+
+// one object in one frame
+class Obj {
+  public:
+    Obj() = default;
+    Obj(unsigned int id, BoxBuf::Type type, double x, double y, double w, double h)
+      : id(id), type(type), x(x), y(y), w(w), h(h) {}
+    ~Obj() {}
+  public:
+    unsigned int id;
+    BoxBuf::Type type;
+    double x, y, w, h;
+};
+typedef std::vector<std::vector<Obj>> Sequence;
+
+// linearly moving targets bouncing around the field of view
+class Scene {
+  public:
+    Scene(unsigned int num, unsigned int width, unsigned int height,
+        double noise, double dropout, unsigned int seed)
+      : width_(width), height_(height), noise_(noise), dropout_(dropout),
+        gen_(seed), targets_(num) {
+      std::uniform_real_distribution<double> pos_x(0.0, width_ - max_size_);
+      std::uniform_real_distribution<double> pos_y(0.0, height_ - max_size_);
+      std::uniform_real_distribution<double> vel(-max_vel_, max_vel_);
+      std::uniform_real_distribution<double> size(min_size_, max_size_);
+      std::uniform_int_distribution<int> type(0, 1);
+      for (unsigned int i = 0; i < targets_.size(); i++) {
+        Obj& t = targets_[i].obj;
+        t.id = i + 1;
+        t.type = type(gen_) ? BoxBuf::Type::kPerson : BoxBuf::Type::kVehicle;
+        t.x = pos_x(gen_);
+        t.y = pos_y(gen_);
+        t.w = size(gen_);
+        t.h = size(gen_);
+        targets_[i].vx = vel(gen_);
+        targets_[i].vy = vel(gen_);
+      }
+    }
+    ~Scene() {}
+
+  public:
+    void make(unsigned int frames, Sequence& gt, Sequence& det) {
+      std::normal_distribution<double> noise(0.0, noise_ > 0.0 ? noise_ : 1.0);
+      std::uniform_real_distribution<double> drop(0.0, 1.0);
+      gt.assign(frames, std::vector<Obj>());
+      det.assign(frames, std::vector<Obj>());
+      for (unsigned int f = 0; f < frames; f++) {
+        std::for_each(targets_.begin(), targets_.end(),
+            [&](const Scene::Target& t) {
+              gt[f].push_back(t.obj);
+              if (drop(gen_) >= dropout_) {
+                Obj d = t.obj;
+                if (noise_ > 0.0) {
+                  d.x = std::max(0.0, d.x + noise(gen_));
+                  d.y = std::max(0.0, d.y + noise(gen_));
+                }
+                det[f].push_back(d);
+              }
+            });
+        step();
+      }
+    }
+
+  private:
+    void step() {
+      std::for_each(targets_.begin(), targets_.end(),
+          [&](Scene::Target& t) {
+            Obj& o = t.obj;
+            o.x += t.vx;
+            o.y += t.vy;
+            if (o.x < 0.0 || o.x + o.w >= width_)  { t.vx = -t.vx; o.x += 2 * t.vx; }
+            if (o.y < 0.0 || o.y + o.h >= height_) { t.vy = -t.vy; o.y += 2 * t.vy; }
+          });
+    }
+
+  private:
+    class Target {
+      public:
+        Obj obj;
+        double vx, vy;
+    };
+
+    const double min_size_ = {16.0};
+    const double max_size_ = {48.0};
+    const double max_vel_  = {4.0};
+
+    unsigned int width_;
+    unsigned int height_;
+    double noise_;
+    double dropout_;
+    std::mt19937 gen_;
+    std::vector<Scene::Target> targets_;
+};
+
+// read a MOTChallenge gt.txt or det.txt file
+bool loadMot(const std::string& fname, bool gt, Sequence& seq) {
+
+  std::ifstream ifs(fname.c_str(), std::ifstream::in);
+  if (!ifs) {
+    fprintf(stderr, "could not open %s\n", fname.c_str());
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::replace(line.begin(), line.end(), ',', ' ');
+    std::istringstream iss(line);
+    int frame, id;
+    double x, y, w, h, conf = 1.0;
+    if (!(iss >> frame >> id >> x >> y >> w >> h)) {
+      continue;
+    }
+    iss >> conf;
+    if (frame < 1 || (gt && conf == 0.0)) {
+      continue;
+    }
+    if (seq.size() < static_cast<unsigned int>(frame)) {
+      seq.resize(frame);
+    }
+    seq[frame - 1].push_back(Obj(gt ? id : 0, BoxBuf::Type::kPerson,
+          std::max(0.0, x - 1.0), std::max(0.0, y - 1.0), w, h));
+  }
+  return true;
+}
+
+// percentiles of a latency sample set
+class Latency {
+  public:
+    Latency() {}
+    ~Latency() {}
+
+  public:
+    void add(uint32_t usec) { samples_.push_back(usec); }
+
+    void report(const char* name) {
+      if (samples_.size() == 0) {
+        fprintf(stderr, "  %s time (us): no samples\n", name);
+        return;
+      }
+      std::sort(samples_.begin(), samples_.end());
+      uint64_t sum = 0;
+      std::for_each(samples_.begin(), samples_.end(), [&](uint32_t s) { sum += s; });
+      fprintf(stderr, "  %s time (us): p50:%u p90:%u p99:%u max:%u avg:%u cnt:%zu\n",
+          name, pct(0.50), pct(0.90), pct(0.99), samples_.back(),
+          static_cast<uint32_t>(sum / samples_.size()), samples_.size());
+    }
+
+    uint32_t avg() {
+      uint64_t sum = 0;
+      std::for_each(samples_.begin(), samples_.end(), [&](uint32_t s) { sum += s; });
+      return samples_.size() ? sum / samples_.size() : 0;
+    }
+
+  private:
+    uint32_t pct(double p) {
+      unsigned int idx = std::ceil(p * samples_.size());
+      return samples_[std::min<unsigned int>(idx ? idx - 1 : 0, samples_.size() - 1)];
+    }
+
+    std::vector<uint32_t> samples_;
+};
+
+// minimum cost matching on a sparse bipartite graph (solved per cluster)
+class Matcher {
+  public:
+    Matcher() {}
+    ~Matcher() {}
+
+  public:
+    void clear() { edges_.clear(); }
+    void add(unsigned int row, unsigned int col, double cost) {
+      edges_.push_back(Matcher::Edge{row, col, cost});
+    }
+
+    // assignment[row] = col or -1
+    void solve(unsigned int rows, unsigned int cols, std::vector<int>& assignment) {
+      assignment.assign(rows, -1);
+
+      // cluster rows and columns connected by an edge
+      roots_.resize(rows + cols);
+      for (unsigned int i = 0; i < roots_.size(); i++) {
+        roots_[i] = i;
+      }
+      std::for_each(edges_.begin(), edges_.end(),
+          [&](const Matcher::Edge& e) {
+            unsigned int a = find(e.row);
+            unsigned int b = find(rows + e.col);
+            if (a != b) {
+              roots_[a] = b;
+            }
+          });
+      std::sort(edges_.begin(), edges_.end(),
+          [&](const Matcher::Edge& a, const Matcher::Edge& b) {
+            return find(a.row) < find(b.row);
+          });
+
+      HungarianAlgorithm hung_algo;
+      std::vector<int> local;
+      for (unsigned int beg = 0; beg < edges_.size(); ) {
+        unsigned int root = find(edges_[beg].row);
+        unsigned int end = beg;
+        while (end < edges_.size() && find(edges_[end].row) == root) {
+          end++;
+        }
+
+        if (end - beg == 1) {
+          assignment[edges_[beg].row] = edges_[beg].col;
+        } else {
+          std::map<unsigned int, unsigned int> ridx;
+          std::map<unsigned int, unsigned int> cidx;
+          for (unsigned int i = beg; i < end; i++) {
+            ridx.emplace(edges_[i].row, ridx.size());
+            cidx.emplace(edges_[i].col, cidx.size());
+          }
+          std::vector<int> rmap(ridx.size());
+          std::vector<int> cmap(cidx.size());
+          std::for_each(ridx.begin(), ridx.end(),
+              [&](const std::pair<unsigned int, unsigned int>& p) { rmap[p.second] = p.first; });
+          std::for_each(cidx.begin(), cidx.end(),
+              [&](const std::pair<unsigned int, unsigned int>& p) { cmap[p.second] = p.first; });
+
+          std::vector<std::vector<double>> mat(ridx.size(),
+              std::vector<double>(cidx.size(), filler_));
+          for (unsigned int i = beg; i < end; i++) {
+            mat[ridx[edges_[i].row]][cidx[edges_[i].col]] = edges_[i].cost;
+          }
+          hung_algo.Solve(mat, local);
+          for (unsigned int r = 0; r < local.size(); r++) {
+            if (local[r] >= 0 && mat[r][local[r]] < filler_) {
+              assignment[rmap[r]] = cmap[local[r]];
+            }
+          }
+        }
+        beg = end;
+      }
+    }
+
+  private:
+    unsigned int find(unsigned int i) {
+      while (roots_[i] != i) {
+        roots_[i] = roots_[roots_[i]];
+        i = roots_[i];
+      }
+      return i;
+    }
+
+    class Edge {
+      public:
+        unsigned int row;
+        unsigned int col;
+        double cost;
+    };
+
+    const double filler_ = {1e12};
+
+    std::vector<Matcher::Edge> edges_;
+    std::vector<unsigned int> roots_;
+};
+
+// CLEAR MOT and identity scores
+class Metrics {
+  public:
+    Metrics(double iou) : iou_(iou) {}
+    ~Metrics() {}
+
+  public:
+    void addFrame(const std::vector<Obj>& gt,
+        const std::shared_ptr<std::vector<TrackBuf>>& tracks) {
+
+      unsigned int trk_num = tracks ? tracks->size() : 0;
+      gt_tot_ += gt.size();
+      trk_tot_ += trk_num;
+
+      // overlapping pairs
+      matcher_.clear();
+      for (unsigned int g = 0; g < gt.size(); g++) {
+        for (unsigned int t = 0; t < trk_num; t++) {
+          const TrackBuf& trk = (*tracks)[t];
+          double iou = overlap(gt[g], trk);
+          if (iou >= iou_) {
+            matcher_.add(g, t, 1.0 - iou);
+            ids_[std::make_pair(gt[g].id, trk.id)]++;
+          }
+        }
+      }
+
+      // frame matching
+      std::vector<int> assignment;
+      matcher_.solve(gt.size(), trk_num, assignment);
+      unsigned int matches = 0;
+      for (unsigned int g = 0; g < assignment.size(); g++) {
+        int t = assignment[g];
+        if (t < 0) {
+          continue;
+        }
+        const TrackBuf& trk = (*tracks)[t];
+        matches++;
+        iou_sum_ += overlap(gt[g], trk);
+        auto it = last_.find(gt[g].id);
+        if (it != last_.end() && it->second != trk.id) {
+          idsw_++;
+        }
+        last_[gt[g].id] = trk.id;
+      }
+      tp_ += matches;
+      fn_ += gt.size() - matches;
+      fp_ += trk_num - matches;
+    }
+
+    void report() {
+
+      // global identity matching (maximize co-occurring frames)
+      std::map<unsigned int, unsigned int> gt_idx;
+      std::map<unsigned int, unsigned int> trk_idx;
+      unsigned int high = 0;
+      std::for_each(ids_.begin(), ids_.end(),
+          [&](const std::pair<std::pair<unsigned int, unsigned int>, unsigned int>& p) {
+            gt_idx.emplace(p.first.first, gt_idx.size());
+            trk_idx.emplace(p.first.second, trk_idx.size());
+            high = std::max(high, p.second + 1);
+          });
+      matcher_.clear();
+      std::for_each(ids_.begin(), ids_.end(),
+          [&](const std::pair<std::pair<unsigned int, unsigned int>, unsigned int>& p) {
+            matcher_.add(gt_idx[p.first.first], trk_idx[p.first.second], high - p.second);
+          });
+      std::vector<int> assignment;
+      matcher_.solve(gt_idx.size(), trk_idx.size(), assignment);
+
+      std::vector<unsigned int> gt_ids(gt_idx.size());
+      std::vector<unsigned int> trk_ids(trk_idx.size());
+      std::for_each(gt_idx.begin(), gt_idx.end(),
+          [&](const std::pair<unsigned int, unsigned int>& p) { gt_ids[p.second] = p.first; });
+      std::for_each(trk_idx.begin(), trk_idx.end(),
+          [&](const std::pair<unsigned int, unsigned int>& p) { trk_ids[p.second] = p.first; });
+      uint64_t idtp = 0;
+      for (unsigned int g = 0; g < assignment.size(); g++) {
+        if (assignment[g] >= 0) {
+          idtp += ids_[std::make_pair(gt_ids[g], trk_ids[assignment[g]])];
+        }
+      }
+      uint64_t idfp = trk_tot_ - idtp;
+      uint64_t idfn = gt_tot_ - idtp;
+
+      double mota = gt_tot_ ? 1.0 - static_cast<double>(fn_ + fp_ + idsw_) / gt_tot_ : 0.0;
+      double motp = tp_ ? iou_sum_ / tp_ : 0.0;
+      double idf1 = (idtp + idfp + idfn) ? 2.0 * idtp / (2.0 * idtp + idfp + idfn) : 0.0;
+
+      fprintf(stderr, "                  MOTA: %f\n", mota);
+      fprintf(stderr, "           MOTP (iou): %f\n", motp);
+      fprintf(stderr, "                  IDF1: %f\n", idf1);
+      fprintf(stderr, "  gt:%lu tp:%lu fp:%lu fn:%lu idsw:%lu idtp:%lu\n",
+          (unsigned long)gt_tot_, (unsigned long)tp_, (unsigned long)fp_,
+          (unsigned long)fn_, (unsigned long)idsw_, (unsigned long)idtp);
+    }
+
+  private:
+    double overlap(const Obj& a, const TrackBuf& b) {
+      double l = std::max(a.x, static_cast<double>(b.x));
+      double t = std::max(a.y, static_cast<double>(b.y));
+      double r = std::min(a.x + a.w, static_cast<double>(b.x + b.w));
+      double d = std::min(a.y + a.h, static_cast<double>(b.y + b.h));
+      if (r <= l || d <= t) {
+        return 0.0;
+      }
+      double inter = (r - l) * (d - t);
+      return inter / (a.w * a.h + static_cast<double>(b.w) * b.h - inter);
+    }
+
+    double iou_;
+    uint64_t gt_tot_ = {0};
+    uint64_t trk_tot_ = {0};
+    uint64_t tp_ = {0};
+    uint64_t fp_ = {0};
+    uint64_t fn_ = {0};
+    uint64_t idsw_ = {0};
+    double iou_sum_ = {0.0};
+    Matcher matcher_;
+    std::map<unsigned int, unsigned int> last_;
+    std::map<std::pair<unsigned int, unsigned int>, unsigned int> ids_;
+};
+
+void usage() {
+  std::cout << "tracker_bench -?vntwhdmseoracgij"                            << std::endl;
+  std::cout << "version: 1.0"                                                 << std::endl;
+  std::cout                                                                   << std::endl;
+  std::cout << "  where:"                                                     << std::endl;
+  std::cout << "  ?            = this screen"                                 << std::endl;
+  std::cout << "  (v)erbose    = print tracker report    (default = false)"   << std::endl;
+  std::cout << "  (n)umber     = number of targets       (default = 1000)"    << std::endl;
+  std::cout << "  (t)frames    = number of frames        (default = 20)"      << std::endl;
+  std::cout << "  (w)idth      = field width             (default = 3840)"    << std::endl;
+  std::cout << "  (h)eight     = field height            (default = 2160)"    << std::endl;
+  std::cout << "  (d)istance   = max track distance      (default = 50)"      << std::endl;
+  std::cout << "  (m)ode       = sparse, dense or both   (default = both)"    << std::endl;
+  std::cout << "  (s)eed       = random seed             (default = 1)"       << std::endl;
+  std::cout << "  nois(e)      = position noise sigma    (default = 1.0 pix)" << std::endl;
+  std::cout << "  dr(o)pout    = missed detection ratio  (default = 0.0)"    << std::endl;
+  std::cout << "  (r)ate       = frames per second       (default = 0)"       << std::endl;
+  std::cout << "               = 0 to run as fast as possible"                << std::endl;
+  std::cout << "  (a)ge        = max track age           (default = 2000ms)"  << std::endl;
+  std::cout << "  (c)utoff     = iou match threshold     (default = 0.5)"     << std::endl;
+  std::cout << "  (g)t         = MOTChallenge gt.txt     (default = synthetic)" << std::endl;
+  std::cout << "  (i)nput      = MOTChallenge det.txt    (default = gt boxes)"  << std::endl;
+  std::cout << "  tra(j)ectory = track history file      (default = none)"  << std::endl;
+  std::cout << "               = written by the first mode run"              << std::endl;
+}
+
+bool runSequence(const char* name, bool sparse, bool quiet, const std::string& meta,
+    const Sequence& gt, const Sequence& det, double dist,
+    unsigned int rate, unsigned int age, double iou, uint32_t& avg) {
+
+  Snapshot snap;
+  Metrics metrics(iou);
+  Latency update;
+  Latency associate;
+  auto trk = BenchTracker::create(quiet, &snap, meta, dist, age, sparse);
+
+  trk->begin();
+  auto next = std::chrono::steady_clock::now();
+  for (unsigned int f = 0; f < det.size(); f++) {
+    auto boxes = std::make_shared<std::vector<BoxBuf>>();
+    std::for_each(det[f].begin(), det[f].end(),
+        [&](const Obj& o) {
+          boxes->push_back(BoxBuf(o.type, f,
+                round(o.x), round(o.y), round(o.w), round(o.h)));
+        });
+    trk->addMessage(boxes);
+
+    auto cnt = trk->getAssociateDiffer().cnt;
+    auto begin = std::chrono::steady_clock::now();
+    trk->step();
+    auto end = std::chrono::steady_clock::now();
+    update.add(std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count());
+    if (trk->getAssociateDiffer().cnt != cnt) {
+      associate.add(trk->getAssociateDiffer().last());
+    }
+
+    metrics.addFrame(f < gt.size() ? gt[f] : std::vector<Obj>(), snap.tracks_);
+
+    if (rate) {
+      next += std::chrono::microseconds(1000000 / rate);
+      std::this_thread::sleep_until(next);
+    }
+  }
+  trk->end();
+
+  fprintf(stderr, "\n%s...\n", name);
+  update.report("   frame update");
+  associate.report("    association");
+  metrics.report();
+
+  avg = update.avg();
+  return true;
+}
+
+int main(int argc, char** argv) {
+
+  // defaults
+  bool quiet = true;
+  unsigned int num = 1000;
+  unsigned int frames = 20;
+  unsigned int width = 3840;
+  unsigned int height = 2160;
+  double dist = 50.0;
+  std::string mode = "both";
+  unsigned int seed = 1;
+  double noise = 1.0;
+  double dropout = 0.0;
+  unsigned int rate = 0;
+  unsigned int age = 2000;
+  double iou = 0.5;
+  std::string gt_fname;
+  std::string det_fname;
+  std::string meta_fname;
+
+  // cmd line options
+  int c;
+  while((c = getopt(argc, argv, ":vn:t:w:h:d:m:s:e:o:r:a:c:g:i:j:")) != -1) {
+    switch (c) {
+      case 'v': quiet     = false;              break;
+      case 'n': num       = std::stoul(optarg); break;
+      case 't': frames    = std::stoul(optarg); break;
+      case 'w': width     = std::stoul(optarg); break;
+      case 'h': height    = std::stoul(optarg); break;
+      case 'd': dist      = std::stod(optarg);  break;
+      case 'm': mode      = optarg;             break;
+      case 's': seed      = std::stoul(optarg); break;
+      case 'e': noise     = std::stod(optarg);  break;
+      case 'o': dropout   = std::stod(optarg);  break;
+      case 'r': rate      = std::stoul(optarg); break;
+      case 'a': age       = std::stoul(optarg); break;
+      case 'c': iou       = std::stod(optarg);  break;
+      case 'g': gt_fname  = optarg;             break;
+      case 'i': det_fname = optarg;             break;
+      case 'j': meta_fname= optarg;             break;
+
+      case '?':
+      default:  usage(); return 0;
+    }
+  }
+
+  // make the ground truth and detections
+  Sequence gt;
+  Sequence det;
+  if (gt_fname.empty()) {
+    Scene scene(num, width, height, noise, dropout, seed);
+    scene.make(frames, gt, det);
+  } else {
+    if (!loadMot(gt_fname, true, gt)) {
+      return 1;
+    }
+    if (det_fname.empty()) {
+      det = gt;
+    } else if (!loadMot(det_fname, false, det)) {
+      return 1;
+    }
+    if (det.size() < gt.size()) {
+      det.resize(gt.size());
+    }
+  }
+
+  fprintf(stderr, "\nBench Setup...\n");
+  if (gt_fname.empty()) {
+    fprintf(stderr, "       input: synthetic\n");
+    fprintf(stderr, "     targets: %u\n", num);
+    fprintf(stderr, "       field: %ux%u pix\n", width, height);
+    fprintf(stderr, "       noise: %f pix\n", noise);
+    fprintf(stderr, "     dropout: %f\n", dropout);
+  } else {
+    fprintf(stderr, "ground truth: %s\n", gt_fname.c_str());
+    fprintf(stderr, "  detections: %s\n", det_fname.empty() ? "ground truth" : det_fname.c_str());
+  }
+  fprintf(stderr, "      frames: %zu\n", det.size());
+  fprintf(stderr, "    distance: %f pix\n", dist);
+  fprintf(stderr, "   track age: %u ms\n", age);
+  if (rate) {
+    fprintf(stderr, "        rate: %u fps\n", rate);
+  } else {
+    fprintf(stderr, "        rate: as fast as possible\n");
+  }
+  fprintf(stderr, "         iou: %f\n", iou);
+  fprintf(stderr, "        mode: %s\n", mode.c_str());
+
+  uint32_t sparse_avg = 0;
+  uint32_t dense_avg = 0;
+  if (mode == "sparse" || mode == "both") {
+    runSequence("Sparse Results", true, quiet, meta_fname, gt, det, dist, rate, age, iou, sparse_avg);
+  }
+  if (mode == "dense" || mode == "both") {
+    runSequence("Dense Results", false, quiet,
+        (mode == "both") ? std::string() : meta_fname, gt, det, dist, rate, age, iou, dense_avg);
+  }
+  if (mode == "both" && sparse_avg != 0) {
+    fprintf(stderr, "\n               speedup: %f\n",
+        static_cast<float>(dense_avg) / sparse_avg);
+  }
+  fprintf(stderr, "\n");
+
+  return 0;
+}
+
+} // namespace detector
+
+int main(int argc, char** argv) {
+  return detector::main(argc, argv);
+}
@@ -16,6 +16,12 @@
  * Try './detector -h' for usage.
  */
 
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <dirent.h>
+#include <sched.h>
+
 #include "utils.h"
 
 #include "third_party/font8x8/font8x8_basic.h"
@@ -252,6 +258,96 @@ void convert_yuv420_to_rgb24(unsigned char* src, unsigned char* dst,
   }
 }
 
+// one plane (C = 1) or packed rgb (C = 3).  The factor source rows are
+// first added into a row of 16 bit sums, a plain vectorizable loop, then
+// each group of factor sums is collapsed into one output sample.
+template<unsigned int C>
+static void box_plane(const unsigned char* src, unsigned int src_stride,
+    unsigned char* dst, unsigned int dst_stride,
+    unsigned int dst_width, unsigned int dst_height, unsigned int factor) {
+
+  if (factor == 2) {
+    for (unsigned int y = 0; y < dst_height; y++) {
+      const unsigned char* s0 = src + 2 * y * src_stride;
+      const unsigned char* s1 = s0 + src_stride;
+      unsigned char* d = dst + y * dst_stride;
+      for (unsigned int x = 0; x < dst_width; x++) {
+        for (unsigned int c = 0; c < C; c++) {
+          d[c] = (s0[c] + s0[C + c] + s1[c] + s1[C + c] + 2) >> 2;
+        }
+        s0 += 2 * C;
+        s1 += 2 * C;
+        d += C;
+      }
+    }
+    return;
+  }
+
+  unsigned int row = dst_width * factor * C;
+  unsigned int area = factor * factor;
+  std::vector<uint16_t> sums(row);
+  uint16_t* sum = sums.data();
+  for (unsigned int y = 0; y < dst_height; y++) {
+    const unsigned char* s = src + y * factor * src_stride;
+    for (unsigned int j = 0; j < row; j++) {
+      sum[j] = s[j];
+    }
+    for (unsigned int i = 1; i < factor; i++) {
+      s += src_stride;
+      for (unsigned int j = 0; j < row; j++) {
+        sum[j] += s[j];
+      }
+    }
+    const uint16_t* p = sum;
+    unsigned char* d = dst + y * dst_stride;
+    for (unsigned int x = 0; x < dst_width; x++) {
+      unsigned int tot[C];
+      for (unsigned int c = 0; c < C; c++) {
+        tot[c] = area / 2;
+      }
+      for (unsigned int k = 0; k < factor; k++) {
+        for (unsigned int c = 0; c < C; c++) {
+          tot[c] += p[c];
+        }
+        p += C;
+      }
+      for (unsigned int c = 0; c < C; c++) {
+        d[c] = tot[c] / area;
+      }
+      d += C;
+    }
+  }
+}
+
+void scale_yuv420_box(const unsigned char* src, unsigned int src_width,
+    unsigned int src_height, unsigned char* dst, unsigned int factor) {
+
+  unsigned int dst_width  = src_width / factor;
+  unsigned int dst_height = src_height / factor;
+
+  unsigned int src_stride = ALIGN_16B(src_width);
+  unsigned int src_plane  = src_stride * ALIGN_16B(src_height);
+  unsigned int dst_stride = ALIGN_16B(dst_width);
+  unsigned int dst_plane  = dst_stride * ALIGN_16B(dst_height);
+
+  box_plane<1>(src, src_stride, dst, dst_stride,
+      dst_width, dst_height, factor);
+  box_plane<1>(src + src_plane, src_stride / 2, dst + dst_plane, dst_stride / 2,
+      dst_width / 2, dst_height / 2, factor);
+  box_plane<1>(src + src_plane * 5 / 4, src_stride / 2, dst + dst_plane * 5 / 4, dst_stride / 2,
+      dst_width / 2, dst_height / 2, factor);
+}
+
+void scale_rgb24_box(const unsigned char* src, unsigned int src_width,
+    unsigned int src_height, unsigned char* dst, unsigned int factor) {
+
+  unsigned int dst_width  = src_width / factor;
+  unsigned int dst_height = src_height / factor;
+
+  box_plane<3>(src, src_width * 3, dst, dst_width * 3,
+      dst_width, dst_height, factor);
+}
+
 bool drawYUVHorizontalLine(unsigned int thick, unsigned char* start, 
     unsigned int stride, unsigned int width, unsigned char val) {
 
@@ -325,6 +421,53 @@ bool drawYUVBox(unsigned int thick,
   return true;
 }
 
+bool drawYUVText(unsigned char* dst_y, unsigned int dst_stride_y,
+    unsigned char* dst_u, unsigned int dst_stride_u,
+    unsigned char* dst_v, unsigned int dst_stride_v,
+    unsigned int x, unsigned int y, const char* txt,
+    unsigned char fg_y, unsigned char fg_u, unsigned char fg_v,
+    unsigned char bg_y, unsigned char bg_u, unsigned char bg_v) {
+
+  if (!dst_y || !dst_u || !dst_v) {
+    return false;
+  }
+  if (!txt || *txt == 0) {
+    return true;
+  }
+
+  // chroma is subsampled 2x2 so start on an even pixel
+  x &= ~1u;
+  y &= ~1u;
+
+  for (int i = 0; *txt; i++) {
+
+    char* bitmap = font8x8_basic[(int)*txt];
+    unsigned char* start_y = dst_y + y * dst_stride_y + x + i * 8;
+    unsigned char* start_u = dst_u + (y / 2) * dst_stride_u + (x / 2) + i * 4;
+    unsigned char* start_v = dst_v + (y / 2) * dst_stride_v + (x / 2) + i * 4;
+
+    for (int row = 0; row < 8; row++) {
+      for (int col = 0; col < 8; col++) {
+        int set = bitmap[row] & 1 << col;
+        start_y[col] = set ? fg_y : bg_y;
+        if (row % 2 == 0 && col % 2 == 0) {
+          int any = (bitmap[row] | bitmap[row + 1]) & (3 << col);
+          start_u[col / 2] = any ? fg_u : bg_u;
+          start_v[col / 2] = any ? fg_v : bg_v;
+        }
+      }
+      start_y += dst_stride_y;
+      if (row % 2) {
+        start_u += dst_stride_u;
+        start_v += dst_stride_v;
+      }
+    }
+    txt++;
+  }
+
+  return true;
+}
+
 struct draw_rgb {
   unsigned char r;
   unsigned char g;
@@ -627,5 +770,44 @@ const char* PixelFormatToStr(unsigned int pix) {
   return "unknown";
 }
 
-} // namespace detector
+std::set<pid_t> threadIds() {
+  std::set<pid_t> tids;
+  DIR* dir = opendir("/proc/self/task");
+  if (dir == nullptr) {
+    return tids;
+  }
+  struct dirent* ent;
+  while ((ent = readdir(dir)) != nullptr) {
+    if (ent->d_name[0] != '.') {
+      tids.insert(std::atoi(ent->d_name));
+    }
+  }
+  closedir(dir);
+  return tids;
+}
 
+bool scheduleThread(pid_t tid, int policy, int priority, unsigned int cpus) {
+  bool res = true;
+  struct sched_param param;
+  param.sched_priority = (policy == SCHED_OTHER) ? 0 : priority;
+  if (sched_setscheduler(tid, policy, &param) != 0) {
+    dbgMsg("failed: schedule thread %d\n", tid);
+    res = false;
+  }
+  if (cpus != 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned int i = 0; i < 32; i++) {
+      if (cpus & (1u << i)) {
+        CPU_SET(i, &set);
+      }
+    }
+    if (sched_setaffinity(tid, sizeof(set), &set) != 0) {
+      dbgMsg("failed: pin thread %d\n", tid);
+      res = false;
+    }
+  }
+  return res;
+}
+
+} // namespace detector
@@ -24,7 +24,9 @@
 
 #include <time.h>
 #include <stdint.h>
+#include <sys/types.h>
 #include <limits>
+#include <set>
 #include <mutex>
 #include <condition_variable>
 #include <cstring>
@@ -51,6 +53,15 @@ void convert_to_yuv420(int fmt,
 void convert_yuv420_to_rgb24(unsigned char* src, unsigned char* dst, 
     unsigned int width, unsigned int height);
 
+// box filter downscale by an integer factor (2..16), each output pixel is
+// the rounded average of a factor x factor block.  I420 planes use the
+// 16 byte aligned strides and plane heights the encoder uses, RGB24 rows
+// are packed.
+void scale_yuv420_box(const unsigned char* src, unsigned int src_width,
+    unsigned int src_height, unsigned char* dst, unsigned int factor);
+void scale_rgb24_box(const unsigned char* src, unsigned int src_width,
+    unsigned int src_height, unsigned char* dst, unsigned int factor);
+
 bool drawYUVHorizontalLine(unsigned int thick, 
     unsigned char* start, unsigned int stride, 
     unsigned int width, unsigned char val);
@@ -63,6 +74,12 @@ bool drawYUVBox(unsigned int thick,
     unsigned char* dst_v, unsigned int dst_stride_v,
     unsigned int x, unsigned int y, unsigned int w, unsigned int h,
     unsigned char val_y, unsigned char val_u, unsigned char val_v);
+bool drawYUVText(unsigned char* dst_y, unsigned int dst_stride_y,
+    unsigned char* dst_u, unsigned int dst_stride_u,
+    unsigned char* dst_v, unsigned int dst_stride_v,
+    unsigned int x, unsigned int y, const char* txt,
+    unsigned char fg_y, unsigned char fg_u, unsigned char fg_v,
+    unsigned char bg_y, unsigned char bg_u, unsigned char bg_v);
 
 bool drawRGBBox(unsigned int thick, unsigned char* dst,
     unsigned int width, unsigned int height,
@@ -83,6 +100,14 @@ const char* BufMemoryToStr(unsigned int bm);
 const char* ColorspaceToStr(unsigned int cs) ;
 const char* PixelFormatToStr(unsigned int pix);
 
+// kernel thread ids of this process (/proc/self/task), diffing two calls
+// finds the threads a library started in between
+std::set<pid_t> threadIds();
+
+// policy (SCHED_OTHER/FIFO/RR) and cpu mask (bit n = cpu n, 0 = any) of
+// any thread of this process, priority is ignored for SCHED_OTHER
+bool scheduleThread(pid_t tid, int policy, int priority, unsigned int cpus);
+
 class Semaphore {
   public:
     Semaphore (int count = 0) 
@@ -128,6 +153,10 @@ class Differ {
       begin_ = std::chrono::steady_clock::now();
     }
 
+    inline void begin(std::chrono::steady_clock::time_point tp) { 
+      begin_ = tp;
+    }
+
     inline void end() { 
       using namespace std::chrono;
       end_ = steady_clock::now();
@@ -145,6 +174,8 @@ class Differ {
       avg = diff_sum_ / cnt;
     }
 
+    inline U last() const { return static_cast<U>(diff_); }
+
   public:
     U cnt;
     U avg;
@@ -0,0 +1,144 @@
+/*
+ * Copyright © 2019 Tyler J. Brooks <tylerjbrooks@digispeaker.com> <https://www.digispeaker.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Try './detector -h' for usage.
+ */
+
+#include "watchdog.h"
+
+namespace detector {
+
+Watchdog::Watchdog(unsigned int yield_time)
+  : Base(yield_time) {
+}
+
+Watchdog::~Watchdog() {
+}
+
+std::unique_ptr<Watchdog> Watchdog::create(unsigned int yield_time, bool quiet,
+    unsigned int deadline) {
+  auto obj = std::unique_ptr<Watchdog>(new Watchdog(yield_time));
+  obj->init(quiet, deadline);
+  return obj;
+}
+
+bool Watchdog::init(bool quiet, unsigned int deadline) {
+
+  quiet_ = quiet;
+  deadline_ = deadline;
+  watch_on_ = false;
+
+  return true;
+}
+
+void Watchdog::watch(Base* stage) {
+  if (stage != nullptr) {
+    stages_.push_back({ stage, false, nullptr, 0, 0, 0, nullptr });
+  }
+}
+
+// stalls are logged as they start and end, quiet or not
+void Watchdog::check() {
+
+  for (auto& stage : stages_) {
+    const char* phase = nullptr;
+    unsigned int usec = 0;
+    bool stuck = stage.base->getPhase(phase, usec) && usec / 1000 >= deadline_;
+
+    // got going and stuck again since the last look
+    if (stage.stalled && (!stuck || usec < stage.usec)) {
+      stage.stalled = false;
+      fprintf(stderr, "\nwatchdog: %s back after %u ms in '%s'\n",
+          stage.base->getName().c_str(), stage.usec / 1000, stage.phase);
+    }
+
+    if (stuck) {
+      if (!stage.stalled) {
+        stage.stalled = true;
+        stage.phase = phase;
+        stage.stalls++;
+        fprintf(stderr, "\nwatchdog: %s stuck in '%s' for %u ms\n",
+            stage.base->getName().c_str(), phase, usec / 1000);
+      }
+      stage.usec = usec;
+      if (usec / 1000 > stage.longest) {
+        stage.longest = usec / 1000;
+        stage.longest_phase = phase;
+      }
+    }
+  }
+}
+
+bool Watchdog::waitingToRun() {
+
+  if (!watch_on_) {
+    differ_tot_.begin();
+    watch_on_ = true;
+  }
+
+  return true;
+}
+
+bool Watchdog::running() {
+
+  if (watch_on_) {
+    check();
+  }
+
+  return true;
+}
+
+bool Watchdog::paused() {
+  return true;
+}
+
+// a stall in progress is picked up again on resume
+bool Watchdog::waitingToPause() {
+  return true;
+}
+
+bool Watchdog::waitingToResume() {
+  return true;
+}
+
+bool Watchdog::waitingToHalt() {
+
+  if (watch_on_) {
+    watch_on_ = false;
+    differ_tot_.end();
+
+    // report
+    if (!quiet_) {
+      fprintf(stderr, "\nWatchdog Results...\n");
+      fprintf(stderr, "        deadline (ms): %u\n", deadline_);
+      for (auto& stage : stages_) {
+        if (stage.stalls != 0) {
+          fprintf(stderr, "   %10s stalls: %u longest:%u ms in '%s'\n",
+              stage.base->getName().c_str(), stage.stalls,
+              stage.longest, stage.longest_phase);
+        } else {
+          fprintf(stderr, "   %10s stalls: 0\n", stage.base->getName().c_str());
+        }
+      }
+      fprintf(stderr, "      total test time: %f sec\n",
+          differ_tot_.avg / 1000000.f);
+      fprintf(stderr, "\n");
+    }
+  }
+
+  return true;
+}
+
+} // namespace detector
@@ -0,0 +1,81 @@
+/*
+ * Copyright © 2019 Tyler J. Brooks <tylerjbrooks@digispeaker.com> <https://www.digispeaker.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Try './detector -h' for usage.
+ */
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <string>
+#include <memory>
+#include <vector>
+
+#include "utils.h"
+#include "base.h"
+
+namespace detector {
+
+// Stage watchdog thread.  Every few yields it looks at the phase of each
+// watched thread and reports any that has been in a busy or pending phase
+// past the deadline, then again when it gets going.  The stalls per
+// thread go in the results.
+class Watchdog : public Base {
+  public:
+    static std::unique_ptr<Watchdog> create(unsigned int yield_time, bool quiet,
+        unsigned int deadline);
+    virtual ~Watchdog();
+
+  public:
+    void watch(Base* stage);                 // before start()
+
+  protected:
+    Watchdog() = delete;
+    Watchdog(unsigned int yield_time);
+    bool init(bool quiet, unsigned int deadline);
+
+  protected:
+    virtual bool waitingToRun();
+    virtual bool running();
+    virtual bool paused();
+    virtual bool waitingToHalt();
+    virtual bool waitingToPause();
+    virtual bool waitingToResume();
+
+  private:
+    bool quiet_;
+    unsigned int deadline_;                  // msec
+
+    class Stage {
+      public:
+        Base* base;
+        bool stalled;
+        const char* phase;                   // of the current stall
+        unsigned int usec;
+        unsigned int stalls;
+        unsigned int longest;                // msec
+        const char* longest_phase;
+    };
+    std::vector<Watchdog::Stage> stages_;
+
+    void check();
+
+    bool watch_on_;
+    MicroDiffer<uint32_t> differ_tot_;
+};
+
+} // namespace detector
+
+#endif // WATCHDOG_H
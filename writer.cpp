@@ -0,0 +1,219 @@
+/*
+ * Copyright © 2019 Tyler J. Brooks <tylerjbrooks@digispeaker.com> <https://www.digispeaker.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Try './detector -h' for usage.
+ */
+
+#include "h264.h"
+#include "writer.h"
+
+namespace detector {
+
+Writer::Writer(unsigned int yield_time)
+  : Base(yield_time) {
+}
+
+Writer::~Writer() {
+}
+
+std::unique_ptr<Writer> Writer::create(unsigned int yield_time, bool quiet,
+    const std::string& output, unsigned int seg_time, unsigned int seg_size,
+    unsigned int sync_time) {
+  auto obj = std::unique_ptr<Writer>(new Writer(yield_time));
+  obj->init(quiet, output, seg_time, seg_size, sync_time);
+  return obj;
+}
+
+bool Writer::init(bool quiet, const std::string& output, unsigned int seg_time,
+    unsigned int seg_size, unsigned int sync_time) {
+
+  quiet_ = quiet;
+  output_ = output;
+  seg_time_ = seg_time;
+  seg_size_ = seg_size;
+  sync_time_ = sync_time;
+
+  chunks_.resize(chunk_num_);
+  head_ = 0;
+  tail_ = 0;
+
+  unit_start_ = true;
+  skip_ = false;
+
+  chunks_dropped_ = 0;
+  depth_max_ = 0;
+  chunks_written_ = 0;
+  depth_sum_ = 0;
+  bytes_written_ = 0;
+
+  write_on_ = false;
+
+  return true;
+}
+
+// encoder thread
+bool Writer::addMessage(NalBuf& nal) {
+
+  if (!write_on_) {
+    return false;
+  }
+
+  // after a drop wait for the start of an idr
+  if (skip_ && unit_start_ && !(nal.flags & NalBuf::kConfig)) {
+    skip_ = !((nal.flags & NalBuf::kKeyFrame) ||
+        H264::contains(nal.addr, nal.length, H264::Nal::kIdr));
+  }
+  unit_start_ = nal.flags & NalBuf::kEndOfFrame;
+  if (skip_ && !(nal.flags & NalBuf::kConfig)) {
+    chunks_dropped_++;
+    return false;
+  }
+
+  unsigned int head = head_.load(std::memory_order_relaxed);
+  unsigned int depth = head - tail_.load(std::memory_order_acquire);
+  if (depth >= chunk_num_) {
+    dbgMsg("writer ring full\n");
+    chunks_dropped_++;
+    skip_ = true;
+    return false;
+  }
+  if (depth + 1 > depth_max_) {
+    depth_max_ = depth + 1;
+  }
+
+  // the slot vectors only ever grow so this settles into a plain copy
+  Writer::Chunk& chunk = chunks_[head % chunk_num_];
+  chunk.data.assign(nal.addr, nal.addr + nal.length);
+  chunk.flags = nal.flags;
+  chunk.stamp = nal.stamp;
+  chunk.id = nal.id;
+  chunk.queued = std::chrono::steady_clock::now();
+  head_.store(head + 1, std::memory_order_release);
+
+  return true;
+}
+
+// writer thread
+bool Writer::drain() {
+
+  unsigned int tail = tail_.load(std::memory_order_relaxed);
+  unsigned int head = head_.load(std::memory_order_acquire);
+  for (; tail != head; tail++) {
+    Writer::Chunk& chunk = chunks_[tail % chunk_num_];
+    differ_queue_.begin(chunk.queued);
+    differ_queue_.end();
+    depth_sum_ += head - tail;
+
+    NalBuf nal(chunk.data.size(), chunk.data.data(), chunk.flags, chunk.stamp, chunk.id);
+    phase("write");
+    differ_write_.begin();
+    if (seg_) {
+      seg_->write(nal);
+    }
+    differ_write_.end();
+    chunks_written_++;
+    bytes_written_ += chunk.data.size();
+
+    tail_.store(tail + 1, std::memory_order_release);
+  }
+
+  return true;
+}
+
+bool Writer::waitingToRun() {
+
+  if (!write_on_) {
+    seg_ = Segmenter::create(output_, seg_time_, seg_size_, sync_time_);
+
+    differ_tot_.begin();
+    write_on_ = true;
+  }
+
+  return true;
+}
+
+bool Writer::running() {
+
+  if (write_on_) {
+    drain();
+    phase("chunks", Base::Phase::kIdle);
+  }
+
+  return true;
+}
+
+bool Writer::paused() {
+  return true;
+}
+
+// what is queued goes to the file, the file stays open
+bool Writer::waitingToPause() {
+  if (write_on_) {
+    drain();
+  }
+  return true;
+}
+
+bool Writer::waitingToHalt() {
+
+  if (write_on_) {
+    write_on_ = false;
+
+    drain();
+    differ_tot_.end();
+
+    unsigned int segments = 0;
+    MicroDiffer<uint32_t> differ_sync;
+    if (seg_) {
+      seg_->close();
+      segments = seg_->segments();
+      differ_sync = seg_->syncTime();
+      seg_.reset(nullptr);
+    }
+
+    // report
+    if (!quiet_) {
+      fprintf(stderr, "\nWriter Results...\n");
+      fprintf(stderr, "       chunks written: %u\n", chunks_written_);
+      fprintf(stderr, "       chunks dropped: %u\n", chunks_dropped_.load());
+      fprintf(stderr, "        bytes written: %llu\n",
+          static_cast<unsigned long long>(bytes_written_));
+      if (seg_time_ != 0 || seg_size_ != 0) {
+        fprintf(stderr, "     segments written: %u\n", segments);
+      }
+      fprintf(stderr, "   queue depth (chunks): max:%u avg:%.1f of:%u\n",
+          depth_max_.load(), chunks_written_ ?
+          static_cast<float>(depth_sum_) / chunks_written_ : 0.f, chunk_num_);
+      fprintf(stderr, "   queue wait time (us): high:%u avg:%u low:%u cnt:%u\n",
+          differ_queue_.high, differ_queue_.avg,
+          differ_queue_.low,  differ_queue_.cnt);
+      fprintf(stderr, "   chunk write time (us): high:%u avg:%u low:%u cnt:%u\n",
+          differ_write_.high, differ_write_.avg,
+          differ_write_.low,  differ_write_.cnt);
+      if (sync_time_ != 0) {
+        fprintf(stderr, "         fsync time (us): high:%u avg:%u low:%u cnt:%u\n",
+            differ_sync.high, differ_sync.avg,
+            differ_sync.low,  differ_sync.cnt);
+      }
+      fprintf(stderr, "        total test time: %f sec\n",
+          differ_tot_.avg / 1000000.f);
+      fprintf(stderr, "\n");
+    }
+  }
+
+  return true;
+}
+
+} // namespace detector
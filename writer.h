@@ -0,0 +1,115 @@
+/*
+ * Copyright © 2019 Tyler J. Brooks <tylerjbrooks@digispeaker.com> <https://www.digispeaker.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Try './detector -h' for usage.
+ */
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+#include "utils.h"
+#include "listener.h"
+#include "base.h"
+#include "segmenter.h"
+
+namespace detector {
+
+// Encoded output writer thread.  The encoder thread copies each chunk
+// into a single producer/single consumer ring of preallocated slots and
+// never waits on the writer; this thread drains the ring into a
+// Segmenter.  If the ring fills up (a long storage stall) chunks are
+// dropped up to the next IDR so the file stays decodable.
+class Writer : public Base, public Listener<NalBuf> {
+  public:
+    static std::unique_ptr<Writer> create(unsigned int yield_time, bool quiet,
+        const std::string& output, unsigned int seg_time, unsigned int seg_size,
+        unsigned int sync_time);
+    virtual ~Writer();
+
+  public:
+    virtual bool addMessage(NalBuf& nal);
+
+    // chunks waiting to be written
+    unsigned int depth() { return head_.load() - tail_.load(); }
+
+  protected:
+    Writer() = delete;
+    Writer(unsigned int yield_time);
+    bool init(bool quiet, const std::string& output, unsigned int seg_time,
+        unsigned int seg_size, unsigned int sync_time);
+
+  protected:
+    virtual bool waitingToRun();
+    virtual bool running();
+    virtual bool paused();
+    virtual bool waitingToHalt();
+    virtual bool waitingToPause();
+
+  private:
+    bool quiet_;
+    std::string output_;
+    unsigned int seg_time_;
+    unsigned int seg_size_;
+    unsigned int sync_time_;
+    std::unique_ptr<Segmenter> seg_;
+
+    class Chunk {
+      public:
+        Chunk() = default;
+        ~Chunk() {}
+      public:
+        std::vector<unsigned char> data;
+        unsigned int flags;
+        std::chrono::steady_clock::time_point stamp;
+        unsigned int id;
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    // slot i lives at chunks_[i % chunk_num_].  The encoder thread only
+    // moves head_ and the writer thread only moves tail_.
+    const unsigned int chunk_num_ = {128};
+    std::vector<Writer::Chunk> chunks_;
+    std::atomic<unsigned int> head_;
+    std::atomic<unsigned int> tail_;
+
+    // producer side only
+    bool unit_start_;
+    bool skip_;                              // dropping until the next idr
+
+    bool drain();
+
+    std::atomic<unsigned int> chunks_dropped_;
+    std::atomic<unsigned int> depth_max_;
+    unsigned int chunks_written_;
+    uint64_t depth_sum_;
+    uint64_t bytes_written_;
+
+    std::atomic<bool> write_on_;
+
+    MicroDiffer<uint32_t> differ_queue_;     // chunk time in the ring
+    MicroDiffer<uint32_t> differ_write_;
+    MicroDiffer<uint32_t> differ_tot_;
+};
+
+} // namespace detector
+
+#endif // WRITER_H